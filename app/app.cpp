@@ -1,41 +1,183 @@
 #include "app.hpp"
 
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+
 std::unique_ptr<Window> App::root_window;
 bool App::open = true;
 
+bool App::event_driven = true;
+App::Clock::duration App::frame_interval =
+    std::chrono::microseconds(1000000 / DEFAULT_FRAME_LIMIT);
+App::Clock::time_point App::next_frame;
+std::vector<App::Timer> App::timers;
+
+bool App::render_stats = false;
+App::Clock::time_point App::render_stats_start;
+size_t App::stats_frames = 0;
+RenderStats App::stats_total = {};
+
 void App::run() {
   Event* event = nullptr;
 
-  // TODO timer event generation
   while (open) {
+    if (event_driven) {
+      wait_for_events();
+    }
+
     event = Renderer::poll_event();
     while (event) {
-      if (event->get_type() == WINDOW_CLOSED) {
-        open = false;
-      }
-
-      EventQueue::add_event(event);
+      add_system_event(event);
       event = Renderer::poll_event();
     }
 
+    fire_timers();
+
     while (!EventQueue::empty()) {
       event = EventQueue::get_event();
       root_window->handle_event(event);
     }
 
-    root_window->render();
-    Renderer::draw_delayed();
-    Renderer::show();
-    Renderer::clear();
+    /* frames are paced by the frame limit, a polling loop sleeps even when
+     * there is nothing to draw */
+    if (!root_window->is_dirty() && event_driven) continue;
+
+    std::this_thread::sleep_until(next_frame);
+    next_frame = std::max(next_frame, Clock::now()) + frame_interval;
+
+    /* a frame is drawn only when some window changed, and clean subtrees
+     * are drawn from their caches */
+    if (root_window->is_dirty()) {
+      root_window->render_subtree();
+      Renderer::draw_delayed();
+      Renderer::show();
+      Renderer::clear();
+
+      if (render_stats) {
+        report_render_stats();
+      }
+    }
+  }
+}
+
+void App::report_render_stats() {
+  RenderStats frame = Renderer::get_render_stats();
+  stats_total.draw_calls += frame.draw_calls;
+  stats_total.primitives += frame.primitives;
+  ++stats_frames;
+
+  auto now = Clock::now();
+  if (now - render_stats_start < RENDER_STATS_INTERVAL) return;
+
+  OffscreenPoolStats pool = Renderer::get_offscreen_pool_stats();
+  auto atlas_size = ResourceManager::get_atlas().getSize();
+  fprintf(stderr,
+          "render: %zu frames, %.1f draw calls/frame, %.1f primitives/frame, "
+          "offscreen pool %zu textures %zu KiB, icon atlas %ux%u\n",
+          stats_frames,
+          static_cast<double>(stats_total.draw_calls) / stats_frames,
+          static_cast<double>(stats_total.primitives) / stats_frames,
+          pool.textures, pool.bytes / 1024, atlas_size.x, atlas_size.y);
+
+  render_stats_start = now;
+  stats_frames = 0;
+  stats_total = {};
+}
+
+void App::add_system_event(Event* event) {
+  if (event->get_type() == WINDOW_CLOSED) {
+    open = false;
+  }
+
+  if (event->get_type() == WINDOW_EXPOSED) {
+    root_window->invalidate();
+  }
+
+  EventQueue::add_event(event);
+}
+
+void App::wait_for_events() {
+  if (root_window->is_dirty() || !EventQueue::empty()) return;
+
+  /* without timers the loop blocks until the window system has an event */
+  int32_t timeout_ms = -1;
+  if (!timers.empty()) {
+    auto deadline = std::min_element(timers.begin(), timers.end(),
+                                     [](const Timer& lhs, const Timer& rhs) {
+                                       return lhs.deadline < rhs.deadline;
+                                     })
+                        ->deadline;
+
+    timeout_ms = std::max<int64_t>(
+        std::chrono::ceil<std::chrono::milliseconds>(deadline - Clock::now())
+            .count(),
+        0);
+  }
+
+  Event* event = Renderer::wait_event(timeout_ms);
+  if (event) {
+    add_system_event(event);
+  }
+}
+
+void App::fire_timers() {
+  auto now = Clock::now();
+
+  for (auto timer = timers.begin(); timer != timers.end();) {
+    if (timer->deadline > now) {
+      ++timer;
+      continue;
+    }
+
+    EventQueue::add_event(timer->event);
+    timer = timers.erase(timer);
   }
 }
 
+void App::add_timer(std::chrono::milliseconds delay, Event* event) {
+  assert(event != nullptr);
+  timers.push_back(Timer{Clock::now() + delay, event});
+}
+
+void App::set_event_driven(bool enabled) { event_driven = enabled; }
+
+void App::set_frame_limit(unsigned frame_limit) {
+  frame_interval = frame_limit ? Clock::duration(std::chrono::microseconds(
+                                     1000000 / frame_limit))
+                               : Clock::duration::zero();
+}
+
+void App::set_vertical_sync(bool enabled) {
+  Renderer::set_vertical_sync(enabled);
+}
+
+void App::set_render_stats(bool enabled) {
+  render_stats = enabled;
+  render_stats_start = Clock::now();
+  stats_frames = 0;
+  stats_total = {};
+}
+
 void App::init(Size size, const char* name) {
+  /* plugin icons are packed into the atlas together with the others */
+  for (auto& plugin : InstrumentManager::plugins_info) {
+    ResourceManager::get_icon(plugin.icon_path);
+  }
+
   Renderer::init(size, name);
   open = true;
+  next_frame = Clock::now();
 }
 
 void App::deinit() {
+  for (auto& timer : timers) {
+    delete timer.event;
+  }
+  timers.clear();
+
+  /* windows release their caches, so they go before the renderer */
+  root_window.reset();
   Renderer::deinit();
   InstrumentManager::deinit();
 }
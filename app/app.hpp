@@ -1,5 +1,6 @@
 #ifndef APP_HPP
 #define APP_HPP
+#include <chrono>
 #include <memory>
 #include <vector>
 #include <utility>
@@ -20,11 +21,48 @@
 #include "../subscription_manager/subscription_manager.hpp"
 #include "../instruments_manager/instruments_manager.hpp"
 
+const unsigned DEFAULT_FRAME_LIMIT = 60;
+const std::chrono::seconds RENDER_STATS_INTERVAL(1);
+
+/*!
+ * Main loop. In the event-driven mode, which is the default, the loop
+ * sleeps in the window system until input or the next timer whenever no
+ * window is dirty and no internal event is queued. Frames are drawn at most
+ * frame_limit times a second, in both modes.
+ *
+ * Threads other than the UI one can not wake the loop, so a window waiting
+ * for a worker keeps invalidating itself until the worker is done, as the
+ * canvas does while a plugin task runs.
+ * */
 class App {
  private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Timer {
+    Clock::time_point deadline;
+    Event* event;
+  };
+
   static std::unique_ptr<Window> root_window;
   static bool open;
 
+  static bool event_driven;
+  static Clock::duration frame_interval;
+  static Clock::time_point next_frame;
+  static std::vector<Timer> timers;
+
+  static bool render_stats;
+  static Clock::time_point render_stats_start;
+  static size_t stats_frames;
+  static RenderStats stats_total;
+
+  static void add_system_event(Event* event);
+  static void wait_for_events();
+  /* moves events of the expired timers into the event queue */
+  static void fire_timers();
+  /* prints the stats summed since the last report once in the interval */
+  static void report_render_stats();
+
  public:
   App() = delete;
 
@@ -32,6 +70,18 @@ class App {
   static void run();
   static void deinit();
   static void set_root_window(std::unique_ptr<Window>& window);
+
+  /* false brings back polling the window every frame */
+  static void set_event_driven(bool enabled);
+  /* frames per second, 0 removes the limit */
+  static void set_frame_limit(unsigned frame_limit);
+  static void set_vertical_sync(bool enabled);
+  /* draw calls and primitives per frame are printed to stderr */
+  static void set_render_stats(bool enabled);
+
+  /* event is added to the event queue after delay, must be called on the
+   * UI thread */
+  static void add_timer(std::chrono::milliseconds delay, Event* event);
 };
 
 #endif
@@ -0,0 +1,232 @@
+#include "brush_stamps.hpp"
+
+const int SOFT_DISC_SUBSAMPLES = 4;
+
+/*---------------------------------------*/
+/*            BrushStampCache            */
+/*---------------------------------------*/
+
+std::vector<std::unique_ptr<BrushStamp>>
+    BrushStampCache::stamps[BRUSH_SHAPES_COUNT];
+
+const BrushStamp& BrushStampCache::get(BRUSH_SHAPE shape, int radius) {
+  auto& shape_stamps = stamps[shape];
+  radius = std::max(radius, 0);
+  if (shape_stamps.size() <= static_cast<size_t>(radius)) {
+    shape_stamps.resize(radius + 1);
+  }
+
+  auto& stamp = shape_stamps[radius];
+  if (!stamp) {
+    stamp = std::make_unique<BrushStamp>();
+    stamp->radius = radius;
+
+    switch (shape) {
+      case HARD_DISC: {
+        build_hard_disc(*stamp);
+        break;
+      }
+
+      case SOFT_DISC: {
+        build_soft_disc(*stamp);
+        break;
+      }
+
+      case SQUARE: {
+        build_square(*stamp);
+        break;
+      }
+
+      /* BRUSH_SHAPES_COUNT is not a shape */
+      default: {
+        break;
+      }
+    }
+  }
+
+  return *stamp;
+}
+
+/* pixels with dx * dx + dy * dy < radius * radius, one span per dy in
+ * (-radius, radius) */
+void BrushStampCache::build_hard_disc(BrushStamp& stamp) {
+  int radius = stamp.radius;
+
+  for (int dy = -radius + 1; dy < radius; ++dy) {
+    int half_width = sqrt(radius * radius - dy * dy);
+    if (half_width * half_width == radius * radius - dy * dy) --half_width;
+
+    stamp.spans.push_back({static_cast<int16_t>(-half_width),
+                           static_cast<int16_t>(dy),
+                           static_cast<int16_t>(2 * half_width + 1), 0});
+  }
+}
+
+/* coverage is the share of pixel subsamples lying inside the circle */
+void BrushStampCache::build_soft_disc(BrushStamp& stamp) {
+  int radius = stamp.radius;
+  float radius_sqr = static_cast<float>(radius) * radius;
+  const int subsamples_count = SOFT_DISC_SUBSAMPLES * SOFT_DISC_SUBSAMPLES;
+
+  for (int dy = -radius; dy <= radius; ++dy) {
+    std::vector<uint8_t> row_coverage;
+
+    for (int dx = -radius; dx <= radius; ++dx) {
+      int inside = 0;
+
+      for (int sub_y = 0; sub_y < SOFT_DISC_SUBSAMPLES; ++sub_y) {
+        for (int sub_x = 0; sub_x < SOFT_DISC_SUBSAMPLES; ++sub_x) {
+          float x = dx - 0.5f + (sub_x + 0.5f) / SOFT_DISC_SUBSAMPLES;
+          float y = dy - 0.5f + (sub_y + 0.5f) / SOFT_DISC_SUBSAMPLES;
+          inside += x * x + y * y < radius_sqr;
+        }
+      }
+
+      row_coverage.push_back(inside * 255 / subsamples_count);
+    }
+
+    auto first = std::find_if(row_coverage.begin(), row_coverage.end(),
+                              [](uint8_t value) { return value != 0; });
+    if (first == row_coverage.end()) continue;
+
+    auto last = std::find_if(row_coverage.rbegin(), row_coverage.rend(),
+                             [](uint8_t value) { return value != 0; })
+                    .base();
+
+    stamp.spans.push_back(
+        {static_cast<int16_t>(-radius + (first - row_coverage.begin())),
+         static_cast<int16_t>(dy), static_cast<int16_t>(last - first),
+         static_cast<uint32_t>(stamp.coverage.size())});
+    stamp.coverage.insert(stamp.coverage.end(), first, last);
+  }
+}
+
+void BrushStampCache::build_square(BrushStamp& stamp) {
+  int radius = stamp.radius;
+
+  for (int dy = -radius + 1; dy < radius; ++dy) {
+    stamp.spans.push_back({static_cast<int16_t>(-radius + 1),
+                           static_cast<int16_t>(dy),
+                           static_cast<int16_t>(2 * radius - 1), 0});
+  }
+}
+
+void BrushStampCache::stamp(Image& canvas, BRUSH_SHAPE shape, int radius,
+                            Position center, Color color) {
+  const BrushStamp& brush_stamp = get(shape, radius);
+
+  for (auto& span : brush_stamp.spans) {
+    if (shape == SOFT_DISC) {
+      canvas.blend_span(center.x + span.dx, center.y + span.dy, span.length,
+                        color,
+                        brush_stamp.coverage.data() + span.coverage_offset);
+    } else {
+      canvas.fill_span(center.x + span.dx, center.y + span.dy, span.length,
+                       color);
+    }
+  }
+}
+
+/*---------------------------------------*/
+/*            StrokeRasterizer           */
+/*---------------------------------------*/
+
+std::vector<StrokeRasterizer::RowSpan> StrokeRasterizer::row_spans;
+
+/* sorts spans by row and joins the overlapping ones */
+void StrokeRasterizer::merge_row_spans() {
+  std::sort(row_spans.begin(), row_spans.end(),
+            [](const RowSpan& first, const RowSpan& second) {
+              if (first.y != second.y) return first.y < second.y;
+              return first.begin < second.begin;
+            });
+
+  size_t merged_count = 0;
+  for (auto& span : row_spans) {
+    if (merged_count && row_spans[merged_count - 1].y == span.y &&
+        row_spans[merged_count - 1].end >= span.begin) {
+      auto& merged = row_spans[merged_count - 1];
+      merged.end = std::max(merged.end, span.end);
+    } else {
+      row_spans[merged_count++] = span;
+    }
+  }
+
+  row_spans.resize(merged_count);
+}
+
+/* disc row covers pixels [x + dx, x + dx + length), which as an open interval
+ * is (x + dx - 1, x + dx + length) */
+void StrokeRasterizer::add_disc_interval(const BrushStamp& disc,
+                                         Position center, int y,
+                                         double& left, double& right) {
+  int row = y - center.y + disc.radius - 1;
+  if (row < 0 || static_cast<size_t>(row) >= disc.spans.size()) return;
+
+  const StampSpan& span = disc.spans[row];
+  left = std::min(left, center.x + span.dx - 1.0);
+  right = std::max(right, center.x + span.dx + span.length + 0.0);
+}
+
+/* Intersects row with the rectangle between two end discs: the point must
+ * lie closer than radius to the line and project inside the segment. Both
+ * conditions are linear in x, so each of them is an interval. */
+void StrokeRasterizer::add_band_interval(Position from, Position to, int y,
+                                         int radius, double& left,
+                                         double& right) {
+  double dx = to.x - from.x;
+  double dy = to.y - from.y;
+  double length_sqr = dx * dx + dy * dy;
+  if (length_sqr == 0) return;
+
+  double band_left = -INFINITY;
+  double band_right = INFINITY;
+
+  /* a * x + c has to lie in [lower, upper] */
+  auto restrict_linear = [&](double a, double c, double lower, double upper) {
+    if (a == 0) {
+      if (c < lower || c > upper) {
+        band_left = INFINITY;
+      }
+      return;
+    }
+
+    double bound_1 = (lower - c) / a;
+    double bound_2 = (upper - c) / a;
+    band_left = std::max(band_left, std::min(bound_1, bound_2));
+    band_right = std::min(band_right, std::max(bound_1, bound_2));
+  };
+
+  double half_band = radius * sqrt(length_sqr);
+  restrict_linear(-dy, dx * (y - from.y) + dy * from.x, -half_band, half_band);
+  restrict_linear(dx, dy * (y - from.y) - dx * from.x, 0, length_sqr);
+
+  if (band_left >= band_right) return;
+
+  left = std::min(left, band_left);
+  right = std::max(right, band_right);
+}
+
+/* stamps every pixel step of the segment, so the path has no gaps whatever
+ * its direction, both ends included */
+void StrokeRasterizer::add_stamp_segment(const BrushStamp& stamp,
+                                         Position from, Position to) {
+  int dx = to.x - from.x;
+  int dy = to.y - from.y;
+  int steps = std::max(abs(dx), abs(dy));
+
+  for (int step = 0; step <= steps; ++step) {
+    int x = from.x;
+    int y = from.y;
+
+    if (steps) {
+      x += lround(static_cast<double>(dx) * step / steps);
+      y += lround(static_cast<double>(dy) * step / steps);
+    }
+
+    for (auto& span : stamp.spans) {
+      row_spans.push_back(
+          {y + span.dy, x + span.dx, x + span.dx + span.length});
+    }
+  }
+}
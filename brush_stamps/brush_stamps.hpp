@@ -0,0 +1,182 @@
+#ifndef BRUSH_STAMPS_HPP
+#define BRUSH_STAMPS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "../data_classes/data_classes.hpp"
+
+enum BRUSH_SHAPE { HARD_DISC, SOFT_DISC, SQUARE, BRUSH_SHAPES_COUNT };
+
+/*!
+ * Row of a brush stamp relative to the brush center. For anti-aliased stamps
+ * coverage_offset points to length coverage values in BrushStamp::coverage.
+ * */
+struct StampSpan {
+  int16_t dx;
+  int16_t dy;
+  int16_t length;
+  uint32_t coverage_offset;
+};
+
+struct BrushStamp {
+  int radius;
+  std::vector<StampSpan> spans;
+  std::vector<uint8_t> coverage;
+};
+
+/*!
+ * Lazily built and reused brush masks, so that instruments don't recompute
+ * circle equation for every pixel of every stamp. Spans of a stamp are
+ * sorted by dy.
+ * */
+class BrushStampCache {
+ private:
+  static std::vector<std::unique_ptr<BrushStamp>> stamps[BRUSH_SHAPES_COUNT];
+
+  static void build_hard_disc(BrushStamp& stamp);
+  static void build_soft_disc(BrushStamp& stamp);
+  static void build_square(BrushStamp& stamp);
+
+ public:
+  BrushStampCache() = delete;
+
+  /* negative radii give the one-pixel stamp of radius 0 */
+  static const BrushStamp& get(BRUSH_SHAPE shape, int radius);
+
+  static void stamp(Image& canvas, BRUSH_SHAPE shape, int radius,
+                    Position center, Color color);
+};
+
+/*!
+ * Splits the capsule swept by a round brush moving between two points into
+ * horizontal spans, so that every covered pixel is visited exactly once.
+ * Pixel is covered if its distance to the segment is less than radius.
+ * */
+class StrokeRasterizer {
+ private:
+  struct RowSpan {
+    int y;
+    int begin;
+    int end;
+  };
+
+  static std::vector<RowSpan> row_spans;
+
+  static void merge_row_spans();
+  static void add_disc_interval(const BrushStamp& disc, Position center,
+                                int y, double& left, double& right);
+  static void add_band_interval(Position from, Position to, int y, int radius,
+                                double& left, double& right);
+  static void add_stamp_segment(const BrushStamp& stamp, Position from,
+                                Position to);
+
+ public:
+  StrokeRasterizer() = delete;
+
+  /*!
+   * @param callback callable taking (x, y, length) of each span
+   * */
+  template <typename SpanCallback>
+  static void rasterize_capsule(Position from, Position to, int radius,
+                                SpanCallback callback);
+
+  /*!
+   * Rasterizes the union of capsules start -> points[0] -> points[1] -> ...,
+   * so that pixels shared by neighbouring segments are visited once
+   * @param callback callable taking (x, y, length) of each span
+   * */
+  template <typename SpanCallback>
+  static void rasterize_polyline(Position start,
+                                 const std::vector<Position>& points,
+                                 int radius, SpanCallback callback);
+
+  /*!
+   * Rasterizes the union of stamps put at every pixel step of the path
+   * start -> points[0] -> points[1] -> ..., for brushes which are not round.
+   * Coverage of anti-aliased stamps is ignored.
+   * @param callback callable taking (x, y, length) of each span
+   * */
+  template <typename SpanCallback>
+  static void rasterize_stamp_polyline(const BrushStamp& stamp, Position start,
+                                       const std::vector<Position>& points,
+                                       SpanCallback callback);
+};
+
+template <typename SpanCallback>
+void StrokeRasterizer::rasterize_capsule(Position from, Position to,
+                                         int radius, SpanCallback callback) {
+  if (radius <= 0) return;
+
+  const BrushStamp& disc = BrushStampCache::get(HARD_DISC, radius);
+
+  int top = std::min(from.y, to.y) - radius + 1;
+  int bottom = std::max(from.y, to.y) + radius - 1;
+
+  for (int y = top; y <= bottom; ++y) {
+    /* capsule is convex, so its intersection with a row is one interval */
+    double left = INFINITY;
+    double right = -INFINITY;
+
+    add_disc_interval(disc, from, y, left, right);
+    add_disc_interval(disc, to, y, left, right);
+    add_band_interval(from, to, y, radius, left, right);
+
+    int begin = static_cast<int>(floor(left)) + 1;
+    int end = static_cast<int>(ceil(right)) - 1;
+
+    if (left < right && begin <= end) {
+      callback(begin, y, end - begin + 1);
+    }
+  }
+}
+
+template <typename SpanCallback>
+void StrokeRasterizer::rasterize_polyline(Position start,
+                                          const std::vector<Position>& points,
+                                          int radius, SpanCallback callback) {
+  row_spans.clear();
+
+  Position from = start;
+  for (auto& to : points) {
+    rasterize_capsule(from, to, radius, [](int x, int y, int length) {
+      row_spans.push_back({y, x, x + length});
+    });
+    from = to;
+  }
+
+  merge_row_spans();
+
+  for (auto& span : row_spans) {
+    callback(span.begin, span.y, span.end - span.begin);
+  }
+}
+
+template <typename SpanCallback>
+void StrokeRasterizer::rasterize_stamp_polyline(
+    const BrushStamp& stamp, Position start,
+    const std::vector<Position>& points, SpanCallback callback) {
+  row_spans.clear();
+
+  Position from = start;
+  for (auto& to : points) {
+    add_stamp_segment(stamp, from, to);
+    from = to;
+  }
+
+  /* a path of one point is a single stamp */
+  if (points.empty()) {
+    add_stamp_segment(stamp, start, start);
+  }
+
+  merge_row_spans();
+
+  for (auto& span : row_spans) {
+    callback(span.begin, span.y, span.end - span.begin);
+  }
+}
+
+#endif
@@ -1,18 +1,43 @@
 #include "data_classes.hpp"
 
+#include "raster_kernels.hpp"
+
 #include <bits/stdint-uintn.h>
 
 #include <cstdio>
+#include <cstring>
+
+const size_t MAX_DIRTY_REGIONS = 8;
+const uint64_t HASH_MULTIPLIER = 0x9E3779B97F4A7C15ull;
+
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  uint64_t hash = seed ^ (size * HASH_MULTIPLIER);
+  size_t i = 0;
+
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word = 0;
+    memcpy(&word, bytes + i, sizeof(uint64_t));
+    hash = (hash ^ word) * HASH_MULTIPLIER;
+    hash ^= hash >> 29;
+  }
+
+  for (; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * HASH_MULTIPLIER;
+  }
+
+  return hash ^ (hash >> 32);
+}
 
 /*---------------- SIZE CLASS -------------------------------*/
 
 Size::Size() = default;
-Size::Size(int16_t width, int16_t height) : width(width), height(height) {}
+Size::Size(int32_t width, int32_t height) : width(width), height(height) {}
 
 #ifdef SFML_ENGINE
 Size::Size(const sf::Vector2f& sfsize)
-    : width(static_cast<int16_t>(sfsize.x)),
-      height(static_cast<int16_t>(sfsize.y)) {}
+    : width(static_cast<int32_t>(sfsize.x)),
+      height(static_cast<int32_t>(sfsize.y)) {}
 
 Size::operator sf::Vector2f() const { return sf::Vector2f(width, height); }
 #endif
@@ -55,11 +80,11 @@ Color::operator sf::Color() const { return sf::Color(r, g, b, a); }
 /*--------------- POSITION ----------------------------------*/
 
 Position::Position() = default;
-Position::Position(int16_t x, int16_t y) : x(x), y(y) {}
+Position::Position(int32_t x, int32_t y) : x(x), y(y) {}
 
 #ifdef SFML_ENGINE
 Position::Position(const sf::Vector2f& sfpos)
-    : x(static_cast<uint16_t>(sfpos.x)), y(static_cast<uint16_t>(sfpos.y)) {}
+    : x(static_cast<int32_t>(sfpos.x)), y(static_cast<int32_t>(sfpos.y)) {}
 
 Position::operator sf::Vector2f() const { return sf::Vector2f(x, y); }
 #endif
@@ -92,46 +117,522 @@ Text::Text(const char* text, uint16_t character_size, const char* font_path,
 Viewport::Viewport() = default;
 Viewport::Viewport(Size size, Position pos) : size(size), pos(pos) {}
 
+/*--------------- REGION -----------------------------------*/
+Region::Region() : x(0), y(0), width(0), height(0) {}
+Region::Region(int x, int y, int width, int height)
+    : x(x), y(y), width(width), height(height) {}
+
+bool Region::empty() const { return width <= 0 || height <= 0; }
+
+bool Region::contains(const Region& other) const {
+  return other.x >= x && other.y >= y && other.x + other.width <= x + width &&
+         other.y + other.height <= y + height;
+}
+
+bool Region::touches(const Region& other) const {
+  return other.x <= x + width && x <= other.x + other.width &&
+         other.y <= y + height && y <= other.y + other.height;
+}
+
+Region Region::united(const Region& other) const {
+  if (empty()) return other;
+  if (other.empty()) return *this;
+
+  int left = std::min(x, other.x);
+  int top = std::min(y, other.y);
+  int right = std::max(x + width, other.x + other.width);
+  int bottom = std::max(y + height, other.y + other.height);
+
+  return Region(left, top, right - left, bottom - top);
+}
+
+Region Region::intersected(const Region& other) const {
+  int left = std::max(x, other.x);
+  int top = std::max(y, other.y);
+  int right = std::min(x + width, other.x + other.width);
+  int bottom = std::min(y + height, other.y + other.height);
+
+  if (right <= left || bottom <= top) return Region();
+
+  return Region(left, top, right - left, bottom - top);
+}
+
 /*-------------------- IMAGE -----------------------------*/
-Image::Image(Size size, Color color) : size(size) {
-  pixels.assign(size.width * size.height * sizeof(Color), 0);
-  printf("Image size: %ld\n", pixels.size());
-  fflush(stdout);
-  for (int i = 0; i < pixels.size(); i += sizeof(Color)) {
-    pixels[i] = color.r;
-    pixels[i + 1] = color.g;
-    pixels[i + 2] = color.b;
-    pixels[i + 3] = color.a;
+Image::Image(Size size, Color color) : Image(size.width, size.height, color) {}
+
+Image::Image(int width, int height, Color color)
+    : width(width),
+      height(height),
+      tiles_x((width + IMAGE_TILE_SIZE - 1) / IMAGE_TILE_SIZE),
+      tiles_y((height + IMAGE_TILE_SIZE - 1) / IMAGE_TILE_SIZE),
+      background(color) {
+  tiles.resize(tiles_x * tiles_y);
+  mark_all_dirty();
+}
+
+Image::Image(const Image& other)
+    : width(other.width),
+      height(other.height),
+      tiles_x(other.tiles_x),
+      tiles_y(other.tiles_y),
+      background(other.background),
+      tiles(other.tiles) {
+  mark_all_dirty();
+}
+
+Image& Image::operator=(const Image& other) {
+  if (this == &other) return *this;
+
+  width = other.width;
+  height = other.height;
+  tiles_x = other.tiles_x;
+  tiles_y = other.tiles_y;
+  background = other.background;
+  tiles = other.tiles;
+  canvas_buffer.clear();
+
+  mark_all_dirty();
+  return *this;
+}
+
+const uint8_t* Image::get_tile_pixels(int tile_x, int tile_y) const {
+  auto& tile = tiles[tile_y * tiles_x + tile_x];
+  return tile ? tile->pixels : nullptr;
+}
+
+uint8_t* Image::get_writable_tile_pixels(int tile_x, int tile_y) {
+  auto& tile = tiles[tile_y * tiles_x + tile_x];
+
+  if (!tile) {
+    tile = std::make_shared<ImageTile>();
+    Color* tile_pixels = reinterpret_cast<Color*>(tile->pixels);
+    std::fill(tile_pixels, tile_pixels + IMAGE_TILE_SIZE * IMAGE_TILE_SIZE,
+              background);
+  } else if (tile.use_count() > 1) {
+    tile = std::make_shared<ImageTile>(*tile);
   }
+
+  return tile->pixels;
 }
 
 void Image::setPixel(int x, int y, Color color) {
-  int pos = (y * size.width + x) * sizeof(Color);
-  pixels[pos] = color.r;
-  pixels[pos + 1] = color.g;
-  pixels[pos + 2] = color.b;
-  pixels[pos + 3] = color.a;
+  if (x < 0 || y < 0 || x >= width || y >= height) return;
+
+  uint8_t* tile_pixels =
+      get_writable_tile_pixels(x / IMAGE_TILE_SIZE, y / IMAGE_TILE_SIZE);
+  int pos = ((y % IMAGE_TILE_SIZE) * IMAGE_TILE_SIZE + x % IMAGE_TILE_SIZE) *
+            sizeof(Color);
+
+  tile_pixels[pos] = color.r;
+  tile_pixels[pos + 1] = color.g;
+  tile_pixels[pos + 2] = color.b;
+  tile_pixels[pos + 3] = color.a;
+
+  mark_dirty(Region(x, y, 1, 1));
 }
 
 Color Image::getPixel(int x, int y) {
-  return *reinterpret_cast<Color*>(
-      (pixels.data() + (y * size.width + x) * sizeof(Color)));
+  if (x < 0 || y < 0 || x >= width || y >= height) return background;
+
+  const uint8_t* tile_pixels =
+      get_tile_pixels(x / IMAGE_TILE_SIZE, y / IMAGE_TILE_SIZE);
+  if (!tile_pixels) return background;
+
+  int pos = ((y % IMAGE_TILE_SIZE) * IMAGE_TILE_SIZE + x % IMAGE_TILE_SIZE) *
+            sizeof(Color);
+  return *reinterpret_cast<const Color*>(tile_pixels + pos);
+}
+
+static uint32_t pack_color(Color color) {
+  uint32_t packed = 0;
+  memcpy(&packed, &color, sizeof(Color));
+  return packed;
+}
+
+/*!
+ * Clips span to the image and calls writer for each part of it lying inside
+ * one tile
+ * @param writer callable taking (tile pixel pointer, offset from span
+ * beginning, pixel count)
+ * */
+template <typename SegmentWriter>
+void Image::write_span(int x, int y, int length, SegmentWriter writer) {
+  if (y < 0 || y >= height) return;
+
+  int begin = std::max(x, 0);
+  int end = std::min(x + length, width);
+  if (begin >= end) return;
+
+  int tile_y = y / IMAGE_TILE_SIZE;
+  int tile_row = y % IMAGE_TILE_SIZE;
+
+  for (int cur_x = begin; cur_x < end;) {
+    int tile_column = cur_x % IMAGE_TILE_SIZE;
+    int count = std::min(IMAGE_TILE_SIZE - tile_column, end - cur_x);
+
+    uint8_t* tile_pixels =
+        get_writable_tile_pixels(cur_x / IMAGE_TILE_SIZE, tile_y);
+    writer(tile_pixels +
+               (tile_row * IMAGE_TILE_SIZE + tile_column) * sizeof(Color),
+           cur_x - x, count);
+
+    cur_x += count;
+  }
+
+  mark_dirty(Region(begin, y, end - begin, 1));
+}
+
+void Image::fill_span(int x, int y, int length, Color color) {
+  uint32_t packed_color = pack_color(color);
+
+  write_span(x, y, length, [packed_color](uint8_t* dst, int, int count) {
+    fill_pixels(dst, packed_color, count);
+  });
+}
+
+void Image::blend_span(int x, int y, int length, Color color,
+                       const uint8_t* coverage) {
+  uint32_t packed_color = pack_color(color);
+
+  write_span(x, y, length,
+             [packed_color, coverage](uint8_t* dst, int offset, int count) {
+               blend_pixels(dst, packed_color,
+                            coverage ? coverage + offset : nullptr, count);
+             });
+}
+
+void Image::copy_row(int x, int y, int length, const uint8_t* src) {
+  write_span(x, y, length, [src](uint8_t* dst, int offset, int count) {
+    memcpy(dst, src + offset * sizeof(Color), count * sizeof(Color));
+  });
+}
+
+void Image::fill_rect(Region region, Color color) {
+  Region image_region = Region(0, 0, width, height);
+  region = region.intersected(image_region);
+  if (region.empty()) return;
+
+  /* filling the whole image just drops the tiles */
+  if (region.contains(image_region)) {
+    std::fill(tiles.begin(), tiles.end(), nullptr);
+    background = color;
+    mark_all_dirty();
+    return;
+  }
+
+  for (int y = region.y; y < region.y + region.height; ++y) {
+    fill_span(region.x, y, region.width, color);
+  }
+}
+
+std::vector<Region> Image::get_changed_tiles(const Image& previous) const {
+  std::vector<Region> changed_tiles;
+  bool same_layout = previous.width == width && previous.height == height;
+  bool same_background =
+      pack_color(previous.background) == pack_color(background);
+
+  for (int tile_y = 0; tile_y < tiles_y; ++tile_y) {
+    for (int tile_x = 0; tile_x < tiles_x; ++tile_x) {
+      int index = tile_y * tiles_x + tile_x;
+
+      if (same_layout && tiles[index] == previous.tiles[index] &&
+          (tiles[index] || same_background)) {
+        continue;
+      }
+
+      changed_tiles.push_back(
+          Region(tile_x * IMAGE_TILE_SIZE, tile_y * IMAGE_TILE_SIZE,
+                 IMAGE_TILE_SIZE, IMAGE_TILE_SIZE)
+              .intersected(Region(0, 0, width, height)));
+    }
+  }
+
+  return changed_tiles;
+}
+
+Size Image::get_size() const { return Size(width, height); }
+
+int Image::get_width() const { return width; }
+
+int Image::get_height() const { return height; }
+
+void Image::read_region(Region region, uint8_t* dst, size_t dst_stride) const {
+  if (region.empty()) return;
+  if (!dst_stride) dst_stride = region.width * sizeof(Color);
+
+  for (int y = region.y; y < region.y + region.height; ++y) {
+    int tile_y = y / IMAGE_TILE_SIZE;
+    int tile_row = y % IMAGE_TILE_SIZE;
+    uint8_t* dst_row = dst + (y - region.y) * dst_stride;
+
+    for (int x = region.x; x < region.x + region.width;) {
+      int tile_x = x / IMAGE_TILE_SIZE;
+      int tile_column = x % IMAGE_TILE_SIZE;
+      int count = std::min(IMAGE_TILE_SIZE - tile_column,
+                           region.x + region.width - x);
+
+      const uint8_t* tile_pixels = get_tile_pixels(tile_x, tile_y);
+      uint8_t* dst_pixels = dst_row + (x - region.x) * sizeof(Color);
+
+      if (tile_pixels) {
+        memcpy(dst_pixels,
+               tile_pixels +
+                   (tile_row * IMAGE_TILE_SIZE + tile_column) * sizeof(Color),
+               count * sizeof(Color));
+      } else {
+        Color* dst_colors = reinterpret_cast<Color*>(dst_pixels);
+        std::fill(dst_colors, dst_colors + count, background);
+      }
+
+      x += count;
+    }
+  }
 }
 
-uint8_t* Image::get_pixel_array() { return pixels.data(); }
+uint64_t Image::hash_region(Region region) const {
+  /* rows are staged one by one, so that storage of the tiles does not
+   * affect the hash */
+  thread_local std::vector<uint8_t> row;
+  row.resize(region.width * sizeof(Color));
 
-Size Image::get_size() { return size; }
+  uint64_t hash = 0;
+  for (int y = region.y; y < region.y + region.height; ++y) {
+    read_region(Region(region.x, y, region.width, 1), row.data());
+    hash = hash_bytes(row.data(), row.size(), hash);
+  }
+
+  return hash;
+}
+
+void Image::write_region(Region region, const uint8_t* src,
+                         size_t src_stride) {
+  if (region.empty()) return;
+  if (!src_stride) src_stride = region.width * sizeof(Color);
+
+  for (int y = region.y; y < region.y + region.height; ++y) {
+    int tile_y = y / IMAGE_TILE_SIZE;
+    int tile_row = y % IMAGE_TILE_SIZE;
+    const uint8_t* src_row = src + (y - region.y) * src_stride;
+
+    for (int x = region.x; x < region.x + region.width;) {
+      int tile_x = x / IMAGE_TILE_SIZE;
+      int tile_column = x % IMAGE_TILE_SIZE;
+      int count = std::min(IMAGE_TILE_SIZE - tile_column,
+                           region.x + region.width - x);
+
+      uint8_t* tile_pixels = get_writable_tile_pixels(tile_x, tile_y);
+      memcpy(
+          tile_pixels + (tile_row * IMAGE_TILE_SIZE + tile_column) *
+                            sizeof(Color),
+          src_row + (x - region.x) * sizeof(Color), count * sizeof(Color));
+
+      x += count;
+    }
+  }
+
+  mark_dirty(region);
+}
+
+PluginAPI::Canvas Image::lock_canvas() {
+  canvas_buffer.resize(static_cast<size_t>(width) * height * sizeof(Color));
+  return lock_canvas(canvas_buffer.data());
+}
+
+PluginAPI::Canvas Image::lock_canvas(uint8_t* buffer) {
+  locked_pixels = buffer;
+  read_region(Region(0, 0, width, height), locked_pixels);
 
-Image::operator PluginAPI::Canvas() {
   PluginAPI::Canvas plugin_adapter_canvas = {};
 
-  plugin_adapter_canvas.height = size.height;
-  plugin_adapter_canvas.width = size.width;
-  plugin_adapter_canvas.pixels = pixels.data();
+  plugin_adapter_canvas.height = height;
+  plugin_adapter_canvas.width = width;
+  plugin_adapter_canvas.pixels = locked_pixels;
 
   return plugin_adapter_canvas;
 }
 
+void Image::unlock_canvas() {
+  size_t stride = width * sizeof(Color);
+  std::vector<uint8_t> tile_row(IMAGE_TILE_SIZE * sizeof(Color));
+
+  /* only tiles the plugin has actually changed are written back, the rest
+   * stay shared with other copies of the image */
+  for (int tile_y = 0; tile_y < tiles_y; ++tile_y) {
+    for (int tile_x = 0; tile_x < tiles_x; ++tile_x) {
+      Region tile_region =
+          Region(tile_x * IMAGE_TILE_SIZE, tile_y * IMAGE_TILE_SIZE,
+                 IMAGE_TILE_SIZE, IMAGE_TILE_SIZE)
+              .intersected(Region(0, 0, width, height));
+      size_t row_length = tile_region.width * sizeof(Color);
+      const uint8_t* src =
+          locked_pixels + tile_region.y * stride +
+          tile_region.x * sizeof(Color);
+
+      bool changed = false;
+      for (int y = 0; y < tile_region.height && !changed; ++y) {
+        read_region(Region(tile_region.x, tile_region.y + y,
+                           tile_region.width, 1),
+                    tile_row.data());
+        changed = memcmp(tile_row.data(), src + y * stride, row_length);
+      }
+
+      if (changed) {
+        write_region(tile_region, src, stride);
+      }
+    }
+  }
+}
+
+PluginAPI::CanvasView Image::lock_region(Region window) {
+  window = window.intersected(Region(0, 0, width, height));
+  canvas_buffer.resize(static_cast<size_t>(window.width) * window.height *
+                       sizeof(Color));
+  return lock_region(window, canvas_buffer.data());
+}
+
+PluginAPI::CanvasView Image::lock_region(Region window, uint8_t* buffer) {
+  locked_region = window.intersected(Region(0, 0, width, height));
+  locked_pixels = buffer;
+  return stage_region(locked_region, locked_pixels);
+}
+
+PluginAPI::CanvasView Image::stage_region(Region window,
+                                          std::vector<uint8_t>& buffer) const {
+  window = window.intersected(Region(0, 0, width, height));
+  buffer.resize(static_cast<size_t>(window.width) * window.height *
+                sizeof(Color));
+  return stage_region(window, buffer.data());
+}
+
+PluginAPI::CanvasView Image::stage_region(Region window,
+                                          uint8_t* buffer) const {
+  window = window.intersected(Region(0, 0, width, height));
+
+  size_t stride = window.width * sizeof(Color);
+  read_region(window, buffer, stride);
+
+  PluginAPI::CanvasView plugin_adapter_view = {};
+
+  plugin_adapter_view.pixels = buffer;
+  plugin_adapter_view.height = window.height;
+  plugin_adapter_view.width = window.width;
+  plugin_adapter_view.stride = stride;
+  plugin_adapter_view.x = window.x;
+  plugin_adapter_view.y = window.y;
+  plugin_adapter_view.canvas_height = height;
+  plugin_adapter_view.canvas_width = width;
+  plugin_adapter_view.format = PluginAPI::RGBA8888;
+
+  return plugin_adapter_view;
+}
+
+PluginAPI::CanvasView Image::view(Region rect) {
+  rect = rect.intersected(Region(0, 0, width, height));
+
+  int tile_x = rect.x / IMAGE_TILE_SIZE;
+  int tile_y = rect.y / IMAGE_TILE_SIZE;
+  if (rect.empty() ||
+      tile_x != (rect.x + rect.width - 1) / IMAGE_TILE_SIZE ||
+      tile_y != (rect.y + rect.height - 1) / IMAGE_TILE_SIZE) {
+    return lock_region(rect);
+  }
+
+  /* the tile is detached from other copies before anyone writes to it */
+  size_t stride = IMAGE_TILE_SIZE * sizeof(Color);
+  uint8_t* tile_pixels = get_writable_tile_pixels(tile_x, tile_y);
+
+  PluginAPI::CanvasView plugin_adapter_view = {};
+
+  plugin_adapter_view.pixels =
+      tile_pixels + (rect.y - tile_y * IMAGE_TILE_SIZE) * stride +
+      (rect.x - tile_x * IMAGE_TILE_SIZE) * sizeof(Color);
+  plugin_adapter_view.height = rect.height;
+  plugin_adapter_view.width = rect.width;
+  plugin_adapter_view.stride = stride;
+  plugin_adapter_view.x = rect.x;
+  plugin_adapter_view.y = rect.y;
+  plugin_adapter_view.canvas_height = height;
+  plugin_adapter_view.canvas_width = width;
+  plugin_adapter_view.format = PluginAPI::RGBA8888;
+
+  return plugin_adapter_view;
+}
+
+void Image::release_view(PluginAPI::CanvasView view) {
+  /* pixels changed in place stay changed, so staged ones are kept too */
+  Region view_region = Region(view.x, view.y, view.width, view.height);
+
+  if (view.pixels == locked_pixels) {
+    unlock_region(view_region);
+    return;
+  }
+
+  mark_dirty(view_region);
+}
+
+void Image::unlock_region(Region region) {
+  region = region.intersected(locked_region);
+  if (region.empty()) return;
+
+  size_t stride = locked_region.width * sizeof(Color);
+  write_region(region,
+               locked_pixels + (region.y - locked_region.y) * stride +
+                   (region.x - locked_region.x) * sizeof(Color),
+               stride);
+}
+
+void Image::set_tile(int tile_x, int tile_y, std::shared_ptr<ImageTile> tile) {
+  tiles[tile_y * tiles_x + tile_x] = std::move(tile);
+  mark_dirty(Region(tile_x * IMAGE_TILE_SIZE, tile_y * IMAGE_TILE_SIZE,
+                    IMAGE_TILE_SIZE, IMAGE_TILE_SIZE));
+}
+
+std::shared_ptr<ImageTile> Image::get_tile(int tile_x, int tile_y) const {
+  return tiles[tile_y * tiles_x + tile_x];
+}
+
+void Image::mark_dirty(Region region) {
+  region = region.intersected(Region(0, 0, width, height));
+  if (region.empty()) return;
+
+  /* consecutive writes usually hit the same area, so the last region is
+   * checked first */
+  for (auto it = dirty_regions.rbegin(); it != dirty_regions.rend(); ++it) {
+    if (it->contains(region)) return;
+  }
+
+  for (auto it = dirty_regions.rbegin(); it != dirty_regions.rend(); ++it) {
+    if (it->touches(region)) {
+      *it = it->united(region);
+      return;
+    }
+  }
+
+  dirty_regions.push_back(region);
+
+  if (dirty_regions.size() > MAX_DIRTY_REGIONS) {
+    Region bounding_region = {};
+    for (auto& dirty_region : dirty_regions) {
+      bounding_region = bounding_region.united(dirty_region);
+    }
+
+    dirty_regions.clear();
+    dirty_regions.push_back(bounding_region);
+  }
+}
+
+void Image::mark_all_dirty() {
+  dirty_regions.clear();
+  dirty_regions.push_back(Region(0, 0, width, height));
+}
+
+const std::vector<Region>& Image::get_dirty_regions() const {
+  return dirty_regions;
+}
+
+void Image::clear_dirty_regions() { dirty_regions.clear(); }
+
 /*------------------------- TEXTURE -------------------------------*/
 Texture::Texture() = default;
-Texture::Texture(const char* path, Size size) : path(path), size(size) {}
+Texture::Texture(TextureHandle handle, Size size)
+    : handle(handle), size(size) {}
@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <memory>
 #include <vector>
 #include <string>
 
@@ -15,12 +16,12 @@
 // conditional compilation or dedicated conversion fuctions or nothing?
 
 struct Size {
-  int16_t width;
-  int16_t height;
+  int32_t width;
+  int32_t height;
 
   Size();
 
-  Size(int16_t width, int16_t height);
+  Size(int32_t width, int32_t height);
 
 // private and render engine as friend
 #ifdef SFML_ENGINE
@@ -53,11 +54,11 @@ struct Color {
 };
 
 struct Position {
-  int16_t x;
-  int16_t y;
+  int32_t x;
+  int32_t y;
 
   Position();
-  Position(int16_t x, int16_t y);
+  Position(int32_t x, int32_t y);
 
   Position& operator+=(const Position& other);
 
@@ -92,35 +93,209 @@ struct Viewport {
   Viewport(Size size, Position pos);
 };
 
+struct Region {
+  int x;
+  int y;
+  int width;
+  int height;
+
+  Region();
+  Region(int x, int y, int width, int height);
+
+  bool empty() const;
+  bool contains(const Region& other) const;
+  bool touches(const Region& other) const;
+
+  Region united(const Region& other) const;
+  Region intersected(const Region& other) const;
+};
+
+/*!
+ * Fast non-cryptographic 64-bit hash of a byte range
+ * @param seed hash of the preceding data, lets ranges be hashed one by one
+ * */
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0);
+
+const int IMAGE_TILE_SIZE = 256;
+
+struct ImageTile {
+  uint8_t pixels[IMAGE_TILE_SIZE * IMAGE_TILE_SIZE * sizeof(Color)];
+};
+
+/*!
+ * RGBA pixel buffer stored as a grid of IMAGE_TILE_SIZE x IMAGE_TILE_SIZE
+ * tiles. Tiles are allocated on first write (untouched tiles are implicitly
+ * filled with the background color) and shared copy-on-write between
+ * copies, so copying an image only copies tile pointers. Every write is
+ * recorded as a dirty region, so the renderer can upload only the changed
+ * parts of the image to the GPU.
+ * */
 class Image {
  private:
-  std::vector<uint8_t> pixels;
-  Size size;
+  int width;
+  int height;
+  int tiles_x;
+  int tiles_y;
+  Color background;
+
+  std::vector<std::shared_ptr<ImageTile>> tiles;
+  std::vector<uint8_t> canvas_buffer;
+  uint8_t* locked_pixels = nullptr;
+  Region locked_region;
+  std::vector<Region> dirty_regions;
+
+  const uint8_t* get_tile_pixels(int tile_x, int tile_y) const;
+  uint8_t* get_writable_tile_pixels(int tile_x, int tile_y);
+
+  template <typename SegmentWriter>
+  void write_span(int x, int y, int length, SegmentWriter writer);
 
  public:
   Image(Size size, Color color);
-  
+  Image(int width, int height, Color color);
+
+  Image(const Image& other);
+  Image(Image&& other) = default;
+  Image& operator=(const Image& other);
+  Image& operator=(Image&& other) = default;
+
   void setPixel(int x, int y, Color color);
   Color getPixel(int x, int y);
-  
-  uint8_t* get_pixel_array();
 
-  operator PluginAPI::Canvas();
-
-  Size get_size();
+  /* Row operations. Spans are clipped to the image, so callers may pass
+   * coordinates lying partially outside of it. */
+  void fill_span(int x, int y, int length, Color color);
+
+  /*!
+   * Blends color over a row span
+   * @param coverage optional per-pixel coverage for length pixels, which is
+   * multiplied with the color alpha
+   * */
+  void blend_span(int x, int y, int length, Color color,
+                  const uint8_t* coverage = nullptr);
+  void copy_row(int x, int y, int length, const uint8_t* src);
+  void fill_rect(Region region, Color color);
+
+  /*!
+   * Copies region into RGBA buffer
+   * @param region part of the image to copy, must lie inside the image
+   * @param dst destination buffer
+   * @param dst_stride distance between rows of dst in bytes, 0 means rows are
+   * tightly packed
+   * */
+  void read_region(Region region, uint8_t* dst, size_t dst_stride = 0) const;
+
+  /*!
+   * Copies RGBA buffer into region and marks it dirty
+   * @param region part of the image to overwrite, must lie inside the image
+   * @param src source buffer
+   * @param src_stride distance between rows of src in bytes, 0 means rows are
+   * tightly packed
+   * */
+  void write_region(Region region, const uint8_t* src, size_t src_stride = 0);
+
+  /*!
+   * Hashes pixels of region, tiles which are not allocated yet give the same
+   * hash as tiles filled with the background color
+   * @param region part of the image to hash, must lie inside the image
+   * */
+  uint64_t hash_region(Region region) const;
+
+  void mark_dirty(Region region);
+  void mark_all_dirty();
+  const std::vector<Region>& get_dirty_regions() const;
+  void clear_dirty_regions();
+
+  /*!
+   * Flattens tiles into contiguous buffer for the plugin. The buffer is valid
+   * until unlock_canvas(), which writes changed tiles back into the image.
+   * */
+  PluginAPI::Canvas lock_canvas();
+  void unlock_canvas();
+
+  /*!
+   * Same as lock_canvas(), but flattens tiles into buffer provided by the
+   * caller, e.g. memory shared with a plugin process
+   * @param buffer at least width * height pixels
+   * */
+  PluginAPI::Canvas lock_canvas(uint8_t* buffer);
+
+  /*!
+   * Stages window of the image for the plugin, so plugins working on a small
+   * area do not pay for flattening the whole image
+   * @param window part of the image the plugin may read, clipped to the image
+   * */
+  PluginAPI::CanvasView lock_region(Region window);
+  PluginAPI::CanvasView lock_region(Region window, uint8_t* buffer);
+
+  /*!
+   * Copies window of the image into buffer and describes it for the plugin.
+   * Unlike lock_region() it does not touch the image, so it may be called
+   * from several threads at once.
+   * */
+  PluginAPI::CanvasView stage_region(Region window,
+                                     std::vector<uint8_t>& buffer) const;
+  PluginAPI::CanvasView stage_region(Region window, uint8_t* buffer) const;
+
+  /*!
+   * Writes back part of the window locked by lock_region()
+   * @param region part of the window the plugin was allowed to change
+   * */
+  void unlock_region(Region region);
+
+  /*!
+   * Gives access to rect of the image without copying when rect lies inside
+   * one tile: pixels point right into the tile, which is detached from other
+   * copies of the image first. Other rects are staged like in lock_region().
+   * The view is valid until release_view() and the next write to the image.
+   * */
+  PluginAPI::CanvasView view(Region rect);
+
+  /*!
+   * Finishes access given by view(), writing staged pixels back and marking
+   * the view dirty. Every pixel of the view is kept as the plugin left it,
+   * whether the view was staged or not.
+   * */
+  void release_view(PluginAPI::CanvasView view);
+
+  /*!
+   * Returns regions of the tiles whose storage is not shared with previous,
+   * which is a copy of this image made earlier. Only these tiles may contain
+   * changes since the copy was made.
+   * */
+  std::vector<Region> get_changed_tiles(const Image& previous) const;
+
+  /*!
+   * Replaces storage of one tile and marks it dirty. Lets results computed
+   * in parallel be merged without copying them once more.
+   * */
+  void set_tile(int tile_x, int tile_y, std::shared_ptr<ImageTile> tile);
+  std::shared_ptr<ImageTile> get_tile(int tile_x, int tile_y) const;
+
+  Size get_size() const;
+  int get_width() const;
+  int get_height() const;
 };
 
+/* icon of the resource manager */
+using TextureHandle = uint32_t;
+
 struct Texture {
-  const char* path;
+  TextureHandle handle;
   Size size;
 
   Texture();
-  Texture(const char* path, Size size);
+  Texture(TextureHandle handle, Size size);
 };
 
 struct PluginInfo {
+  std::string name;
   std::string icon_path;
   std::string lib_path;
+  /* modification time of the library, invalidates the cached entry */
+  int64_t lib_mtime = 0;
+  /* 0 until the library has been loaded once */
+  uint32_t api_version = 0;
 };
 
 #endif
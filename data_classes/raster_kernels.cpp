@@ -0,0 +1,192 @@
+#include "raster_kernels.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RASTER_KERNELS_X86
+#endif
+
+/* exact round(x / 255) for x in [0, 255 * 255] */
+static inline uint32_t div255(uint32_t x) {
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+static void fill_pixels_scalar(uint8_t* dst, uint32_t color, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    memcpy(dst + i * 4, &color, 4);
+  }
+}
+
+static void blend_pixels_scalar(uint8_t* dst, uint32_t color,
+                                const uint8_t* coverage, size_t count) {
+  uint8_t src[4] = {};
+  memcpy(src, &color, 4);
+
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t alpha = coverage ? div255(src[3] * coverage[i]) : src[3];
+    uint8_t* pixel = dst + i * 4;
+
+    for (int channel = 0; channel < 3; ++channel) {
+      pixel[channel] =
+          div255(src[channel] * alpha + pixel[channel] * (255 - alpha));
+    }
+    pixel[3] = div255(255 * alpha + pixel[3] * (255 - alpha));
+  }
+}
+
+#ifdef RASTER_KERNELS_X86
+
+/* Both blend kernels work on 16-bit lanes holding one channel each, so that
+ * src * a + dst * (255 - a) fits without overflow. The source alpha lane is
+ * set to 255, which turns the same formula into proper alpha compositing. */
+
+static void fill_pixels_sse2(uint8_t* dst, uint32_t color, size_t count) {
+  __m128i value = _mm_set1_epi32(color);
+  size_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), value);
+  }
+
+  fill_pixels_scalar(dst + i * 4, color, count - i);
+}
+
+static inline __m128i blend_lanes_sse2(__m128i dst, __m128i src,
+                                       __m128i alpha) {
+  __m128i inv_alpha = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+  __m128i sum = _mm_add_epi16(_mm_mullo_epi16(src, alpha),
+                              _mm_mullo_epi16(dst, inv_alpha));
+  sum = _mm_add_epi16(sum, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(sum, _mm_srli_epi16(sum, 8)), 8);
+}
+
+static void blend_pixels_sse2(uint8_t* dst, uint32_t color,
+                              const uint8_t* coverage, size_t count) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i src = _mm_unpacklo_epi8(_mm_set1_epi32(color | 0xFF000000u), zero);
+  uint16_t color_alpha = color >> 24;
+  __m128i alpha = _mm_set1_epi16(color_alpha);
+  size_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    __m128i* pixels = reinterpret_cast<__m128i*>(dst + i * 4);
+    __m128i dst_pixels = _mm_loadu_si128(pixels);
+    __m128i alpha_lo = alpha;
+    __m128i alpha_hi = alpha;
+
+    if (coverage) {
+      uint16_t a[4] = {};
+      for (int j = 0; j < 4; ++j) {
+        a[j] = div255(color_alpha * coverage[i + j]);
+      }
+      alpha_lo = _mm_set_epi16(a[1], a[1], a[1], a[1], a[0], a[0], a[0], a[0]);
+      alpha_hi = _mm_set_epi16(a[3], a[3], a[3], a[3], a[2], a[2], a[2], a[2]);
+    }
+
+    __m128i lo =
+        blend_lanes_sse2(_mm_unpacklo_epi8(dst_pixels, zero), src, alpha_lo);
+    __m128i hi =
+        blend_lanes_sse2(_mm_unpackhi_epi8(dst_pixels, zero), src, alpha_hi);
+    _mm_storeu_si128(pixels, _mm_packus_epi16(lo, hi));
+  }
+
+  blend_pixels_scalar(dst + i * 4, color, coverage ? coverage + i : nullptr,
+                      count - i);
+}
+
+__attribute__((target("avx2"))) static void fill_pixels_avx2(
+    uint8_t* dst, uint32_t color, size_t count) {
+  __m256i value = _mm256_set1_epi32(color);
+  size_t i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), value);
+  }
+
+  fill_pixels_sse2(dst + i * 4, color, count - i);
+}
+
+__attribute__((target("avx2"))) static inline __m256i blend_lanes_avx2(
+    __m256i dst, __m256i src, __m256i alpha) {
+  __m256i inv_alpha = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+  __m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(src, alpha),
+                                 _mm256_mullo_epi16(dst, inv_alpha));
+  sum = _mm256_add_epi16(sum, _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_srli_epi16(sum, 8)),
+                           8);
+}
+
+__attribute__((target("avx2"))) static void blend_pixels_avx2(
+    uint8_t* dst, uint32_t color, const uint8_t* coverage, size_t count) {
+  __m256i zero = _mm256_setzero_si256();
+  __m256i src =
+      _mm256_unpacklo_epi8(_mm256_set1_epi32(color | 0xFF000000u), zero);
+  uint16_t color_alpha = color >> 24;
+  __m256i alpha = _mm256_set1_epi16(color_alpha);
+  size_t i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m256i* pixels = reinterpret_cast<__m256i*>(dst + i * 4);
+    __m256i dst_pixels = _mm256_loadu_si256(pixels);
+    __m256i alpha_lo = alpha;
+    __m256i alpha_hi = alpha;
+
+    if (coverage) {
+      uint16_t a[8] = {};
+      for (int j = 0; j < 8; ++j) {
+        a[j] = div255(color_alpha * coverage[i + j]);
+      }
+      /* unpack works inside 128-bit lanes: low half gets pixels 0, 1, 4, 5
+       * and high half gets pixels 2, 3, 6, 7 */
+      alpha_lo = _mm256_set_epi16(a[5], a[5], a[5], a[5], a[4], a[4], a[4],
+                                  a[4], a[1], a[1], a[1], a[1], a[0], a[0],
+                                  a[0], a[0]);
+      alpha_hi = _mm256_set_epi16(a[7], a[7], a[7], a[7], a[6], a[6], a[6],
+                                  a[6], a[3], a[3], a[3], a[3], a[2], a[2],
+                                  a[2], a[2]);
+    }
+
+    __m256i lo = blend_lanes_avx2(_mm256_unpacklo_epi8(dst_pixels, zero), src,
+                                  alpha_lo);
+    __m256i hi = blend_lanes_avx2(_mm256_unpackhi_epi8(dst_pixels, zero), src,
+                                  alpha_hi);
+    _mm256_storeu_si256(pixels, _mm256_packus_epi16(lo, hi));
+  }
+
+  blend_pixels_sse2(dst + i * 4, color, coverage ? coverage + i : nullptr,
+                    count - i);
+}
+
+static const bool HAS_AVX2 = __builtin_cpu_supports("avx2");
+
+void fill_pixels(uint8_t* dst, uint32_t color, size_t count) {
+  if (HAS_AVX2) {
+    fill_pixels_avx2(dst, color, count);
+  } else {
+    fill_pixels_sse2(dst, color, count);
+  }
+}
+
+void blend_pixels(uint8_t* dst, uint32_t color, const uint8_t* coverage,
+                  size_t count) {
+  if (HAS_AVX2) {
+    blend_pixels_avx2(dst, color, coverage, count);
+  } else {
+    blend_pixels_sse2(dst, color, coverage, count);
+  }
+}
+
+#else
+
+void fill_pixels(uint8_t* dst, uint32_t color, size_t count) {
+  fill_pixels_scalar(dst, color, count);
+}
+
+void blend_pixels(uint8_t* dst, uint32_t color, const uint8_t* coverage,
+                  size_t count) {
+  blend_pixels_scalar(dst, color, coverage, count);
+}
+
+#endif
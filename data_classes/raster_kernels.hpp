@@ -0,0 +1,32 @@
+#ifndef RASTER_KERNELS_HPP
+#define RASTER_KERNELS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/*!
+ * Low level RGBA row kernels used by Image span operations. AVX2 versions
+ * are selected at runtime when the CPU supports them, SSE2 is used otherwise
+ * on x86-64 and plain loops on other architectures.
+ * */
+
+/*!
+ * Fills count RGBA pixels with the same color
+ * @param dst first pixel of the row
+ * @param color color packed in memory order (r, g, b, a)
+ * @param count number of pixels
+ * */
+void fill_pixels(uint8_t* dst, uint32_t color, size_t count);
+
+/*!
+ * Blends color over count RGBA pixels (source over)
+ * @param dst first pixel of the row
+ * @param color color packed in memory order (r, g, b, a)
+ * @param coverage optional per-pixel coverage (0..255) multiplied with the
+ * color alpha, nullptr means full coverage
+ * @param count number of pixels
+ * */
+void blend_pixels(uint8_t* dst, uint32_t color, const uint8_t* coverage,
+                  size_t count);
+
+#endif
@@ -15,7 +15,8 @@ MouseButtonEvent::MouseButtonEvent(Position pos, MouseButton button,
                                    Action action)
     : Event(MOUSE_BUTTON), pos(pos), button(button), action(action) {}
 
-MouseMoveEvent::MouseMoveEvent(Position pos) : Event(MOUSE_MOVE), pos(pos) {}
+MouseMoveEvent::MouseMoveEvent(Position pos)
+    : Event(MOUSE_MOVE), pos(pos), path({pos}) {}
 
 ButtonPressEvent::ButtonPressEvent(uint32_t value)
     : Event(BUTTON_PRESSED), value(value) {}
@@ -53,3 +54,6 @@ CanvasFileEvent::CanvasFileEvent(std::string filename, CanvasAction type)
 
 FileChoiceEvent::FileChoiceEvent(std::string filename)
     : filename(filename), Event(FILE_CHOOSEN) {}
+
+PluginTaskEvent::PluginTaskEvent(const Image* canvas, bool cancelled)
+    : Event(PLUGIN_TASK_FINISHED), canvas(canvas), cancelled(cancelled) {}
@@ -5,6 +5,7 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
 
 #include "../data_classes/data_classes.hpp"
 
@@ -26,7 +27,9 @@ enum SYSTEM_EVENT {
   CHANGE_INPUTBOX_VALUE,
   CANVAS_ACTION,
   FILE_CHOOSEN,
-  LOAD_PLUGINS
+  LOAD_PLUGINS,
+  PLUGIN_TASK_FINISHED,
+  WINDOW_EXPOSED
 };
 
 enum KEY {
@@ -63,7 +66,8 @@ enum KEY {
   Left,
   Right,
   Space,
-  Return
+  Return,
+  Escape
 };
 
 class Event {
@@ -97,6 +101,9 @@ class MouseButtonEvent : public Event {
 class MouseMoveEvent : public Event {
  public:
   Position pos;
+  /* all positions since the previous move event, ending with pos (several
+   * moves may be coalesced by the event queue) */
+  std::vector<Position> path;
 
   MouseMoveEvent(Position pos);
 };
@@ -188,4 +195,16 @@ class FileChoiceEvent : public Event {
   FileChoiceEvent(std::string filename);
 };
 
+/*!
+ * Sent by the plugin worker thread when an asynchronous plugin application
+ * is over
+ * */
+class PluginTaskEvent : public Event {
+ public:
+  const Image* canvas;
+  bool cancelled;
+
+  PluginTaskEvent(const Image* canvas, bool cancelled);
+};
+
 #endif
@@ -1,15 +1,36 @@
 #include "event_queue.hpp"
 
 std::queue<Event*> EventQueue::event_queue;
+std::mutex EventQueue::queue_mutex;
 
-bool EventQueue::empty() { return event_queue.empty(); }
+bool EventQueue::empty() {
+  std::lock_guard<std::mutex> lock(queue_mutex);
+  return event_queue.empty();
+}
 
 void EventQueue::add_event(Event* new_event) {
   assert(new_event != nullptr);
+  std::lock_guard<std::mutex> lock(queue_mutex);
+
+  /* consecutive mouse moves are merged into one event carrying the whole
+   * path, so handlers run once per batch instead of once per move */
+  if (new_event->get_type() == MOUSE_MOVE && !event_queue.empty() &&
+      event_queue.back()->get_type() == MOUSE_MOVE) {
+    auto last_move = dynamic_cast<MouseMoveEvent*>(event_queue.back());
+    auto new_move = dynamic_cast<MouseMoveEvent*>(new_event);
+
+    last_move->pos = new_move->pos;
+    last_move->path.push_back(new_move->pos);
+
+    delete new_event;
+    return;
+  }
+
   event_queue.push(new_event);
 }
 
 Event* EventQueue::get_event() {
+  std::lock_guard<std::mutex> lock(queue_mutex);
   assert(!event_queue.empty());
 
   Event* front_event = event_queue.front();
@@ -1,14 +1,20 @@
 #ifndef EVENT_QUEUE_HPP
 #define EVENT_QUEUE_HPP
 
-#include <queue>
 #include <cassert>
+#include <mutex>
+#include <queue>
 
 #include "../event/event.hpp"
 
+/*!
+ * Queue of events handled by the UI thread. Events may be added from any
+ * thread, e.g. by workers reporting that their job is done.
+ * */
 class EventQueue {
  private:
   static std::queue<Event*> event_queue;
+  static std::mutex queue_mutex;
 
   static Event* get_event();
  public:
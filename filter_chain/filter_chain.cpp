@@ -0,0 +1,134 @@
+#include "filter_chain.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+void FilterChain::add_stage(PluginAPI::Plugin* plugin,
+                            PluginAPI::PluginV2* plugin_v2) {
+  stages.push_back({plugin, plugin_v2});
+}
+
+void FilterChain::clear_stages() { stages.clear(); }
+
+size_t FilterChain::get_stages_count() const { return stages.size(); }
+
+bool FilterChain::init() { return true; }
+
+/* stages are deinitialized by their owner */
+bool FilterChain::deinit() { return true; }
+
+void FilterChain::start_apply_region(PluginAPI::CanvasView canvas,
+                                     PluginAPI::Rect roi,
+                                     PluginAPI::Position pos) {
+  run_stages(canvas, roi, pos, &PluginAPI::PluginV2::start_apply_region,
+             &PluginAPI::Plugin::start_apply);
+}
+
+void FilterChain::apply_region(PluginAPI::CanvasView canvas,
+                               PluginAPI::Rect roi, PluginAPI::Position pos) {
+  run_stages(canvas, roi, pos, &PluginAPI::PluginV2::apply_region,
+             &PluginAPI::Plugin::apply);
+}
+
+void FilterChain::stop_apply_region(PluginAPI::CanvasView canvas,
+                                    PluginAPI::Rect roi,
+                                    PluginAPI::Position pos) {
+  run_stages(canvas, roi, pos, &PluginAPI::PluginV2::stop_apply_region,
+             &PluginAPI::Plugin::stop_apply);
+}
+
+uint32_t FilterChain::get_capabilities() {
+  uint32_t capabilities = PluginAPI::CAPABILITY::TILE_PARALLEL |
+                          PluginAPI::CAPABILITY::POSITION_INDEPENDENT;
+
+  for (auto& stage : stages) {
+    capabilities &= stage.plugin_v2 ? stage.plugin_v2->get_capabilities() : 0;
+  }
+
+  return capabilities;
+}
+
+int64_t FilterChain::get_halo() {
+  int64_t halo = 0;
+
+  for (auto& stage : stages) {
+    halo += get_stage_halo(stage);
+  }
+
+  return halo;
+}
+
+void FilterChain::set_preview_scale(double scale) {
+  for (auto& stage : stages) {
+    if (stage.plugin_v2) stage.plugin_v2->set_preview_scale(scale);
+  }
+}
+
+int64_t FilterChain::get_stage_halo(const Stage& stage) {
+  if (stage.plugin_v2) return stage.plugin_v2->get_halo();
+
+  /* API v1 plugins do not report it, they are assumed to read no further
+   * than one brush radius away, like the host does for single plugins */
+  auto thickness = stage.plugin->properties.find(PluginAPI::TYPE::THICKNESS);
+  if (thickness == stage.plugin->properties.end()) return 0;
+
+  return thickness->second.int_value + 1;
+}
+
+void FilterChain::run_canvas_stage(const Stage& stage, CanvasMethod method,
+                                   PluginAPI::CanvasView canvas,
+                                   PluginAPI::Position pos) {
+  thread_local std::vector<uint8_t> stage_buffer;
+
+  size_t row_length = canvas.width * 4;
+  bool contiguous = canvas.stride == row_length;
+  uint8_t* pixels = canvas.pixels;
+
+  if (!contiguous) {
+    stage_buffer.resize(row_length * canvas.height);
+    pixels = stage_buffer.data();
+
+    for (size_t y = 0; y < canvas.height; ++y) {
+      memcpy(pixels + y * row_length, canvas.pixels + y * canvas.stride,
+             row_length);
+    }
+  }
+
+  /* the window is the whole canvas for the stage */
+  PluginAPI::Canvas stage_canvas = {pixels, canvas.height, canvas.width};
+  (stage.plugin->*method)(stage_canvas, PluginAPI::Position{pos.x - canvas.x,
+                                                           pos.y - canvas.y});
+
+  for (size_t y = 0; y < canvas.height && !contiguous; ++y) {
+    memcpy(canvas.pixels + y * canvas.stride, pixels + y * row_length,
+           row_length);
+  }
+}
+
+void FilterChain::run_stages(PluginAPI::CanvasView canvas,
+                             PluginAPI::Rect roi, PluginAPI::Position pos,
+                             RegionMethod region_method,
+                             CanvasMethod canvas_method) {
+  /* halo of all the stages after the current one */
+  int64_t halo = get_halo();
+
+  for (auto& stage : stages) {
+    halo -= get_stage_halo(stage);
+
+    if (!stage.plugin_v2) {
+      run_canvas_stage(stage, canvas_method, canvas, pos);
+      continue;
+    }
+
+    int64_t left = std::max(roi.x - halo, canvas.x);
+    int64_t top = std::max(roi.y - halo, canvas.y);
+    int64_t right = std::min<int64_t>(roi.x + roi.width + halo,
+                                      canvas.x + canvas.width);
+    int64_t bottom = std::min<int64_t>(roi.y + roi.height + halo,
+                                       canvas.y + canvas.height);
+    if (right <= left || bottom <= top) continue;
+
+    (stage.plugin_v2->*region_method)(
+        canvas, PluginAPI::Rect{left, top, right - left, bottom - top}, pos);
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef FILTER_CHAIN_HPP
+#define FILTER_CHAIN_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "../plugin_api/api.hpp"
+
+/*!
+ * Several plugins applied one after another as a single plugin. Every stage
+ * runs on the same window before the next one starts, so when the host
+ * applies the chain tile by tile each tile passes through all the stages
+ * while it is still in cache, instead of one pass over the canvas per
+ * filter. A stage changes roi grown by the halos of the stages after it,
+ * which is exactly what they read, and the chain asks the host for the sum
+ * of the halos of all stages.
+ *
+ * Stages are owned by the host. API v1 stages get the window as their
+ * canvas and make the chain lose TILE_PARALLEL, as they may keep state
+ * between calls.
+ * */
+class FilterChain : public PluginAPI::PluginV2 {
+ private:
+  struct Stage {
+    PluginAPI::Plugin* plugin;
+    /* the same plugin if it implements API v2, nullptr otherwise */
+    PluginAPI::PluginV2* plugin_v2;
+  };
+
+  using RegionMethod = void (PluginAPI::PluginV2::*)(
+      PluginAPI::CanvasView, PluginAPI::Rect, PluginAPI::Position);
+  using CanvasMethod = void (PluginAPI::Plugin::*)(PluginAPI::Canvas,
+                                                    PluginAPI::Position);
+
+  std::vector<Stage> stages;
+
+  static int64_t get_stage_halo(const Stage& stage);
+  static void run_canvas_stage(const Stage& stage, CanvasMethod method,
+                               PluginAPI::CanvasView canvas,
+                               PluginAPI::Position pos);
+
+  void run_stages(PluginAPI::CanvasView canvas, PluginAPI::Rect roi,
+                  PluginAPI::Position pos, RegionMethod region_method,
+                  CanvasMethod canvas_method);
+
+ public:
+  /*!
+   * Appends stage to the end of the chain
+   * @param plugin_v2 the same plugin if it implements API v2, nullptr
+   * otherwise
+   * */
+  void add_stage(PluginAPI::Plugin* plugin, PluginAPI::PluginV2* plugin_v2);
+  void clear_stages();
+  size_t get_stages_count() const;
+
+  bool init() override;
+  bool deinit() override;
+
+  void start_apply_region(PluginAPI::CanvasView canvas, PluginAPI::Rect roi,
+                          PluginAPI::Position pos) override;
+  void apply_region(PluginAPI::CanvasView canvas, PluginAPI::Rect roi,
+                    PluginAPI::Position pos) override;
+  void stop_apply_region(PluginAPI::CanvasView canvas, PluginAPI::Rect roi,
+                         PluginAPI::Position pos) override;
+
+  uint32_t get_capabilities() override;
+  int64_t get_halo() override;
+  void set_preview_scale(double scale) override;
+};
+
+#endif
@@ -4,6 +4,15 @@
 
 const int MAX_THICKNESS = 40;
 const int SPRAY_DENSITY = 20;
+const float SPLINE_SAMPLE_STEP = 3;
+const float SPLINE_MIN_KNOT_DELTA = 1e-3;
+const char* PLUGINS_PATH = "plugins";
+const char* PLUGIN_MANIFEST_PATH = "plugins/manifest.cache";
+const int PLUGIN_MANIFEST_LINE_LENGTH = 4096;
+const char* FILTER_CHAINS_PATH = "chains";
+const char* FILTER_CHAIN_EXTENSION = ".chain";
+const char* FILTER_CHAIN_ICON_PATH = "icons/filter_chain.png";
+const size_t DEFAULT_FILTER_CACHE_BUDGET = 64 << 20;
 
 void ToolbarListener::handle_event(Event* event) {
   if (event->get_type() == BUTTON_PRESSED) {
@@ -25,13 +34,126 @@ void ToolbarListener::handle_event(Event* event) {
 
 void ToolbarListener::render() {}
 
+/*---------------------------------------*/
+/*           SplineInterpolator          */
+/*---------------------------------------*/
+
+SplineInterpolator::SplineInterpolator() : points_count(0) {}
+
+void SplineInterpolator::reset() { points_count = 0; }
+
+void SplineInterpolator::add_point(Position point,
+                                   std::vector<Position>& curve) {
+  if (points_count &&
+      control_points[points_count - 1].x == point.x &&
+      control_points[points_count - 1].y == point.y) {
+    return;
+  }
+
+  if (points_count == SPLINE_CONTROL_POINTS) {
+    std::copy(control_points + 1, control_points + SPLINE_CONTROL_POINTS,
+              control_points);
+    --points_count;
+  }
+
+  control_points[points_count++] = point;
+
+  if (points_count < 3) return;
+
+  Position* last = control_points + points_count - 1;
+  Position first = points_count == SPLINE_CONTROL_POINTS ? last[-3] : last[-2];
+
+  emit_segment(first, last[-2], last[-1], last[0], curve);
+}
+
+void SplineInterpolator::finish(std::vector<Position>& curve) {
+  if (points_count == 1) {
+    curve.push_back(control_points[0]);
+  }
+
+  if (points_count >= 2) {
+    Position* last = control_points + points_count - 1;
+    Position first = points_count >= 3 ? last[-2] : last[-1];
+
+    emit_segment(first, last[-1], last[0], last[0], curve);
+  }
+
+  reset();
+}
+
+/* Evaluates segment p1 -> p2 with Barry-Goldman pyramid. Knots are spaced by
+ * square root of the distance between points (centripetal parametrization),
+ * which avoids cusps and self-intersections on sharp turns. */
+void SplineInterpolator::emit_segment(Position p0, Position p1, Position p2,
+                                      Position p3,
+                                      std::vector<Position>& curve) {
+  auto knot_delta = [](Position from, Position to) {
+    float distance = hypotf(to.x - from.x, to.y - from.y);
+    return std::max(sqrtf(distance), SPLINE_MIN_KNOT_DELTA);
+  };
+
+  float t0 = 0;
+  float t1 = t0 + knot_delta(p0, p1);
+  float t2 = t1 + knot_delta(p1, p2);
+  float t3 = t2 + knot_delta(p2, p3);
+
+  auto lerp = [](float a_x, float a_y, float b_x, float b_y, float t_a,
+                 float t_b, float t, float& x, float& y) {
+    float weight = (t - t_a) / (t_b - t_a);
+    x = a_x + (b_x - a_x) * weight;
+    y = a_y + (b_y - a_y) * weight;
+  };
+
+  int samples =
+      std::max(1, static_cast<int>(ceilf(hypotf(p2.x - p1.x, p2.y - p1.y) /
+                                         SPLINE_SAMPLE_STEP)));
+
+  for (int i = 1; i <= samples; ++i) {
+    Position sample = p2;
+
+    if (i < samples) {
+      float t = t1 + (t2 - t1) * i / samples;
+      float a1_x, a1_y, a2_x, a2_y, a3_x, a3_y;
+      float b1_x, b1_y, b2_x, b2_y, c_x, c_y;
+
+      lerp(p0.x, p0.y, p1.x, p1.y, t0, t1, t, a1_x, a1_y);
+      lerp(p1.x, p1.y, p2.x, p2.y, t1, t2, t, a2_x, a2_y);
+      lerp(p2.x, p2.y, p3.x, p3.y, t2, t3, t, a3_x, a3_y);
+      lerp(a1_x, a1_y, a2_x, a2_y, t0, t2, t, b1_x, b1_y);
+      lerp(a2_x, a2_y, a3_x, a3_y, t1, t3, t, b2_x, b2_y);
+      lerp(b1_x, b1_y, b2_x, b2_y, t1, t2, t, c_x, c_y);
+
+      sample = Position(roundf(c_x), roundf(c_y));
+    }
+
+    if (!curve.empty() && curve.back().x == sample.x &&
+        curve.back().y == sample.y) {
+      continue;
+    }
+
+    curve.push_back(sample);
+  }
+}
+
 AbstractInstrument::~AbstractInstrument() = default;
 
+bool AbstractInstrument::is_stroke_instrument() const { return false; }
+
+void AbstractInstrument::apply_polyline(Image& canvas,
+                                        const std::vector<Position>& points,
+                                        Position last_point, Color color,
+                                        uint8_t thickness) {
+  for (auto& point : points) {
+    apply(canvas, point, last_point, color, thickness);
+    last_point = point;
+  }
+}
+
 void AbstractInstrument::init(Position pos) {}
 void AbstractInstrument::deinit(Image& canvas, Color color) {}
 
 void AbstractShapeInstrument::default_axis_preparation(
-    int16_t Position::*pos_axis, int16_t Size::*size_axis) {
+    int32_t Position::*pos_axis, int32_t Size::*size_axis) {
   if (render_data.size.*size_axis < 0) {
     render_data.pos.*pos_axis += render_data.size.*size_axis;
     render_data.size.*size_axis = -(render_data.size.*size_axis);
@@ -57,86 +179,64 @@ void AbstractShapeInstrument::apply(Image& canvas, Position point,
   render_data.color = color;
   Renderer::add_delayed(render_data);
 }
+/* a click without moving the mouse leaves a single stamp */
+static bool is_dot(Position start, const std::vector<Position>& points) {
+  return std::all_of(points.begin(), points.end(), [&](Position point) {
+    return point.x == start.x && point.y == start.y;
+  });
+}
+
 Pencil::Pencil() = default;
 
+bool Pencil::is_stroke_instrument() const { return true; }
+
 void Pencil::apply(Image& canvas, Position point, Position last_point,
                    Color color, uint8_t thickness) {
-  int16_t Position::*primary_axis = nullptr;
-  int16_t Position::*secondary_axis = nullptr;
-
-  int16_t x_diff = abs(point.x - last_point.x);
-  int16_t y_diff = abs(point.y - last_point.y);
-
-  if (x_diff > y_diff) {
-    primary_axis = &Position::x;
-    secondary_axis = &Position::y;
-  } else {
-    primary_axis = &Position::y;
-    secondary_axis = &Position::x;
-  }
-
-  // TODO splines
-  // if there is not enough points for approximation (usually 4) you can
-  // duplicate points
-  float k =
-      static_cast<float>(point.*secondary_axis - last_point.*secondary_axis) /
-      (point.*primary_axis - last_point.*primary_axis);
-  float b = point.*secondary_axis - k * point.*primary_axis;
-
-  for (int x = std::min(point.*primary_axis, last_point.*primary_axis);
-       x <= std::max(point.*primary_axis, last_point.*primary_axis); x += 1) {
-    for (int i = -thickness; i <= thickness; ++i) {
-      for (int j = -thickness; j <= thickness; ++j) {
-        if (i * i + j * j < thickness * thickness) {
-          if (x_diff > y_diff) {
-            canvas.setPixel(std::max(x + i, 0), std::max(k * x + b + j, 0.f),
-                            color);
-          } else {
-            canvas.setPixel(std::max(k * x + b + i, 0.f), std::max(x + j, 0),
-                            color);
-          }
-        }
-      }
-    }
+  if (point.x == last_point.x && point.y == last_point.y) {
+    BrushStampCache::stamp(canvas, HARD_DISC, thickness, point, color);
+    return;
   }
+
+  StrokeRasterizer::rasterize_capsule(
+      last_point, point, thickness, [&](int x, int y, int length) {
+        canvas.fill_span(x, y, length, color);
+      });
+}
+
+void Pencil::apply_polyline(Image& canvas, const std::vector<Position>& points,
+                            Position last_point, Color color,
+                            uint8_t thickness) {
+  if (is_dot(last_point, points)) {
+    BrushStampCache::stamp(canvas, HARD_DISC, thickness, last_point, color);
+    return;
+  }
+
+  StrokeRasterizer::rasterize_polyline(
+      last_point, points, thickness, [&](int x, int y, int length) {
+        canvas.fill_span(x, y, length, color);
+      });
 }
 
 Eraser::Eraser() = default;
 
+bool Brush::is_stroke_instrument() const { return true; }
+
 void Brush::apply(Image& canvas, Position point, Position last_point,
                   Color color, uint8_t thickness) {
-  int16_t Position::*primary_axis = nullptr;
-  int16_t Position::*secondary_axis = nullptr;
-
-  int16_t x_diff = abs(point.x - last_point.x);
-  int16_t y_diff = abs(point.y - last_point.y);
-
-  if (x_diff > y_diff) {
-    primary_axis = &Position::x;
-    secondary_axis = &Position::y;
-  } else {
-    primary_axis = &Position::y;
-    secondary_axis = &Position::x;
-  }
-
-  // TODO splines
-  // if there is not enough points for approximation (usually 4) you can
-  // duplicate points
-  float k =
-      static_cast<float>(point.*secondary_axis - last_point.*secondary_axis) /
-      (point.*primary_axis - last_point.*primary_axis);
-  float b = point.*secondary_axis - k * point.*primary_axis;
-
-  for (int x = std::min(point.*primary_axis, last_point.*primary_axis);
-       x <= std::max(point.*primary_axis, last_point.*primary_axis); x += 1) {
-    for (int i = -thickness; i <= thickness; ++i) {
-      if (x_diff > y_diff) {
-        canvas.setPixel(x, k * x + b + i, color);
-      } else {
-        canvas.setPixel(k * x + b, x + i, color);
-      }
-    }
-  }
+  apply_polyline(canvas, std::vector<Position>(1, point), last_point, color,
+                 thickness);
+}
+
+/* square stamp of radius r covers 2 * r - 1 pixels */
+void Brush::apply_polyline(Image& canvas, const std::vector<Position>& points,
+                           Position last_point, Color color,
+                           uint8_t thickness) {
+  const BrushStamp& nib = BrushStampCache::get(SQUARE, thickness + 1);
+
+  StrokeRasterizer::rasterize_stamp_polyline(
+      nib, last_point, points, [&](int x, int y, int length) {
+        canvas.fill_span(x, y, length, color);
+      });
 }
 
 void Dropper::apply(Image& canvas, Position point, Position last_point,
@@ -145,58 +245,66 @@ void Dropper::apply(Image& canvas, Position point, Position last_point,
   SEND(SubscriptionManager::get_system_event_sender(), new DropperEvent(pixel));
 }
 
+void Spray::spray_span(Image& canvas, int x, int y, int length,
+                       Color color) {
+  coverage.resize(length);
+  for (auto& pixel_coverage : coverage) {
+    pixel_coverage = randomizer() % SPRAY_DENSITY ? 0 : 255;
+  }
+
+  canvas.blend_span(x, y, length, color, coverage.data());
+}
+
+void Spray::spray_stamp(Image& canvas, Position center, int radius,
+                        Color color) {
+  const BrushStamp& puff = BrushStampCache::get(SOFT_DISC, radius);
+
+  for (auto& span : puff.spans) {
+    coverage.resize(span.length);
+    for (int i = 0; i < span.length; ++i) {
+      coverage[i] = randomizer() % SPRAY_DENSITY
+                        ? 0
+                        : puff.coverage[span.coverage_offset + i];
+    }
+
+    canvas.blend_span(center.x + span.dx, center.y + span.dy, span.length,
+                      color, coverage.data());
+  }
+}
+
+bool Spray::is_stroke_instrument() const { return true; }
+
 void Spray::apply(Image& canvas, Position point, Position last_point,
                   Color color, uint8_t thickness) {
-  int16_t Position::*primary_axis = nullptr;
-  int16_t Position::*secondary_axis = nullptr;
-
-  int16_t x_diff = abs(point.x - last_point.x);
-  int16_t y_diff = abs(point.y - last_point.y);
-
-  if (x_diff > y_diff) {
-    primary_axis = &Position::x;
-    secondary_axis = &Position::y;
-  } else {
-    primary_axis = &Position::y;
-    secondary_axis = &Position::x;
-  }
-
-  std::minstd_rand randomizer;
-
-  // TODO splines
-  // if there is not enough points for approximation (usually 4) you can
-  // duplicate points
-  float k =
-      static_cast<float>(point.*secondary_axis - last_point.*secondary_axis) /
-      (point.*primary_axis - last_point.*primary_axis);
-  float b = point.*secondary_axis - k * point.*primary_axis;
-
-  for (int x = std::min(point.*primary_axis, last_point.*primary_axis);
-       x <= std::max(point.*primary_axis, last_point.*primary_axis); x += 1) {
-    for (int i = -thickness; i <= thickness; ++i) {
-      for (int j = -thickness; j <= thickness; ++j) {
-        bool not_colored = randomizer() % SPRAY_DENSITY;
-        if (i * i + j * j < thickness * thickness && !not_colored) {
-          if (x_diff > y_diff) {
-            canvas.setPixel(std::max(x + i, 0), std::max(k * x + b + j, 0.f),
-                            color);
-          } else {
-            canvas.setPixel(std::max(k * x + b + i, 0.f), std::max(x + j, 0),
-                            color);
-          }
-        }
-      }
-    }
+  if (point.x == last_point.x && point.y == last_point.y) {
+    spray_stamp(canvas, point, thickness, color);
+    return;
   }
+
+  StrokeRasterizer::rasterize_capsule(
+      last_point, point, thickness, [&](int x, int y, int length) {
+        spray_span(canvas, x, y, length, color);
+      });
+}
+
+void Spray::apply_polyline(Image& canvas, const std::vector<Position>& points,
+                           Position last_point, Color color,
+                           uint8_t thickness) {
+  if (is_dot(last_point, points)) {
+    spray_stamp(canvas, last_point, thickness, color);
+    return;
+  }
+
+  StrokeRasterizer::rasterize_polyline(
+      last_point, points, thickness, [&](int x, int y, int length) {
+        spray_span(canvas, x, y, length, color);
+      });
 }
 
 void Clear::apply(Image& canvas, Position point, Position last_point,
                   Color color, uint8_t thickness) {
-  for (int x = 0; x < canvas.get_size().width; ++x) {
-    for (int y = 0; y < canvas.get_size().height; ++y) {
-      canvas.setPixel(x, y, color);
-    }
-  }
+  canvas.fill_rect(Region(0, 0, canvas.get_width(), canvas.get_height()),
+                   color);
 }
 
 void Rect::init(Position pos) {
@@ -207,11 +315,9 @@ void Rect::init(Position pos) {
 void Rect::deinit(Image& canvas, Color color) {
   prepare_render_data();
 
-  for (int x = 0; x < render_data.size.width; ++x) {
-    for (int y = 0; y < render_data.size.height; ++y) {
-      canvas.setPixel(x + render_data.pos.x, y + render_data.pos.y, color);
-    }
-  }
+  canvas.fill_rect(Region(render_data.pos.x, render_data.pos.y,
+                          render_data.size.width, render_data.size.height),
+                   color);
 
   clear_render_data();
 }
@@ -227,16 +333,19 @@ void Ellipse::deinit(Image& canvas, Color color) {
   float radius_hor = static_cast<float>(render_data.size.width) / 2;
   float radius_vert = static_cast<float>(render_data.size.height) / 2;
 
-  for (int x = 0; x < render_data.size.width; ++x) {
-    for (int y = 0; y < render_data.size.height; ++y) {
-      float x_eq_part =
-          (x - radius_hor) * (x - radius_hor) / (radius_hor * radius_hor);
-      float y_eq_part =
-          (y - radius_vert) * (y - radius_vert) / (radius_vert * radius_vert);
-      if (x_eq_part + y_eq_part <= 1) {
-        canvas.setPixel(x + render_data.pos.x, y + render_data.pos.y, color);
-      }
-    }
+  for (int y = 0; y < render_data.size.height; ++y) {
+    float y_eq_part =
+        (y - radius_vert) * (y - radius_vert) / (radius_vert * radius_vert);
+    if (y_eq_part > 1) continue;
+
+    /* row of the ellipse is |x - radius_hor| <= half_width */
+    float half_width = radius_hor * sqrtf(1 - y_eq_part);
+    int begin = std::max(static_cast<int>(ceilf(radius_hor - half_width)), 0);
+    int end = std::min(static_cast<int>(floorf(radius_hor + half_width)),
+                       render_data.size.width - 1);
+
+    canvas.fill_span(begin + render_data.pos.x, y + render_data.pos.y,
+                     end - begin + 1, color);
   }
 
   clear_render_data();
@@ -246,10 +355,27 @@ std::vector<std::unique_ptr<AbstractInstrument>> InstrumentManager::instruments(
     COUNT);
 std::vector<void*> InstrumentManager::handles;
 std::vector<PluginAPI::Plugin*> InstrumentManager::plugins;
+std::vector<std::unique_ptr<RemotePlugin>> InstrumentManager::remote_plugins;
+std::vector<std::unique_ptr<PluginAPI::Plugin>>
+    InstrumentManager::native_filters;
+std::vector<std::unique_ptr<FilterChainEntry>>
+    InstrumentManager::filter_chains;
+std::vector<PluginPropertySlots> InstrumentManager::property_slots;
+uint64_t InstrumentManager::properties_version = 1;
+uint64_t InstrumentManager::plugin_properties_hash = 0;
 std::vector<PluginInfo> InstrumentManager::plugins_info;
 
+std::mutex InstrumentManager::plugins_mutex;
+std::vector<bool> InstrumentManager::plugins_loading;
+std::condition_variable InstrumentManager::plugin_loaded;
+std::thread InstrumentManager::prewarm_thread;
+std::atomic<bool> InstrumentManager::prewarm_stop = false;
+bool InstrumentManager::manifest_dirty = false;
+
 bool InstrumentManager::application_started = false;
 bool InstrumentManager::plugin_active = false;
+bool InstrumentManager::plugin_async = true;
+bool InstrumentManager::plugin_isolation = false;
 
 int InstrumentManager::current_instrument = PENCIL;
 uint8_t InstrumentManager::thickness = 1;
@@ -257,7 +383,12 @@ uint8_t InstrumentManager::thickness = 1;
 Color InstrumentManager::color = Color(0, 0, 0);
 Position InstrumentManager::last_point = Position(-1, -1);
 
-void InstrumentManager::init() {
+SplineInterpolator InstrumentManager::spline;
+std::vector<Position> InstrumentManager::curve_points;
+
+void InstrumentManager::init(bool prewarm_plugins, bool isolate_plugins) {
+  plugin_isolation = isolate_plugins;
+
   instruments[ERASER] =
       std::move(std::unique_ptr<AbstractInstrument>(new Eraser()));
   instruments[PENCIL] =
@@ -275,85 +406,458 @@ void InstrumentManager::init() {
   instruments[ELLIPSE_INSTRUMENT] =
       std::move(std::unique_ptr<AbstractInstrument>(new Ellipse()));
 
+  ThreadPool::init();
+
   get_plugins();
-  load_plugins();
+  plugins.assign(plugins_info.size(), nullptr);
+  handles.assign(plugins_info.size(), nullptr);
+  remote_plugins.resize(plugins_info.size());
+  property_slots.assign(plugins_info.size(), PluginPropertySlots());
+  plugins_loading.assign(plugins_info.size(), false);
+  filter_chains.clear();
+  filter_chains.resize(plugins_info.size());
+
+  add_native_filter(std::make_unique<BoxBlurFilter>(), "Box blur",
+                    "icons/box_blur.png");
+  add_native_filter(std::make_unique<GaussianBlurFilter>(), "Gaussian blur",
+                    "icons/gaussian_blur.png");
+  load_filter_chains();
+
+  if (prewarm_plugins) {
+    prewarm_stop = false;
+    prewarm_thread = std::thread(InstrumentManager::prewarm_plugins);
+  }
+
   EventQueue::add_event(new Event(LOAD_PLUGINS));
 }
 
 void InstrumentManager::deinit() {
+  PluginTask::deinit();
+
+  if (prewarm_thread.joinable()) {
+    prewarm_stop = true;
+    prewarm_thread.join();
+  }
+
   for (auto& plugin : plugins) {
-    plugin->deinit();
+    if (plugin) plugin->deinit();
   }
 
   for (auto& handle : handles) {
-    dlclose(handle);
+    if (handle) dlclose(handle);
+  }
+
+  FilterResultCache::clear();
+  remote_plugins.clear();
+  filter_chains.clear();
+  native_filters.clear();
+
+  /* the prewarm thread is joined, nothing else writes the flag */
+  if (manifest_dirty) {
+    save_plugin_manifest();
   }
+
+  ThreadPool::deinit();
 }
 
-void InstrumentManager::start_applying(Image& canvas, Position pos) {
+bool InstrumentManager::start_applying(Image& canvas, Position pos) {
+  /* the worker still owns the plugins of the previous application */
+  if (plugin_active && PluginTask::is_running()) return false;
+
   application_started = true;
-  last_point.x = pos.x + 1;
-  last_point.y = pos.y;
+  last_point = pos;
 
   if (!plugin_active) {
+    spline.reset();
     instruments[current_instrument]->init(pos);
-    return;
+    return true;
   }
 
-  for (auto& property : plugins[current_instrument]->properties) {
-    switch (property.first) {
-      case PluginAPI::TYPE::PRIMARY_COLOR: {
-        property.second.int_value = color;
-      }
+  sync_plugin_properties(current_instrument);
+  plugin_properties_hash = hash_plugin_properties(current_instrument);
 
-      case PluginAPI::TYPE::THICKNESS: {
-        property.second.int_value = thickness;
-      }
-    }
+  if (plugin_async) {
+    PluginTask::start(canvas, get_plugin_call(), pos);
+    return true;
   }
 
-  plugins[current_instrument]->start_apply(canvas, pos);
+  run_plugin_start(get_plugin_call(), canvas, pos);
+  return true;
 }
 
 void InstrumentManager::stop_applying(Image& canvas, Position pos) {
   application_started = false;
 
   if (!plugin_active) {
+    if (instruments[current_instrument]->is_stroke_instrument()) {
+      curve_points.clear();
+      spline.finish(curve_points);
+      apply_instrument(canvas, curve_points);
+    }
+
     instruments[current_instrument]->deinit(canvas, color);
     return;
   }
 
-  plugins[current_instrument]->stop_apply(canvas, pos);
+  if (plugin_async || PluginTask::is_running()) {
+    PluginTask::stop(pos);
+    return;
+  }
+
+  run_plugin_stop(get_plugin_call(), canvas, pos);
 }
 
 void InstrumentManager::apply(Image& canvas, Position pos) {
+  apply(canvas, std::vector<Position>({pos}));
+}
+
+void InstrumentManager::apply(Image& canvas,
+                              const std::vector<Position>& path) {
+  if (path.empty()) return;
+
   if (!plugin_active) {
-    switch (current_instrument) {
-      case ERASER: {
-        instruments[current_instrument]->apply(canvas, pos, last_point,
-                                               Color(255, 255, 255), thickness);
-        break;
-      }
+    if (!instruments[current_instrument]->is_stroke_instrument()) {
+      apply_instrument(canvas, path);
+      return;
+    }
 
-      case CLEAR: {
-        instruments[current_instrument]->apply(canvas, pos, last_point,
-                                               Color(255, 255, 255), thickness);
-        break;
-      }
+    curve_points.clear();
+    for (auto& pos : path) {
+      spline.add_point(pos, curve_points);
+    }
 
-      default: {
-        instruments[current_instrument]->apply(canvas, pos, last_point, color,
-                                               thickness);
-        break;
-      }
+    apply_instrument(canvas, curve_points);
+    return;
+  }
+
+  if (plugin_async || PluginTask::is_running()) {
+    PluginTask::apply(path);
+    return;
+  }
+
+  run_plugin_apply(get_plugin_call(), canvas, path);
+}
+
+void InstrumentManager::apply_instrument(Image& canvas,
+                                         const std::vector<Position>& points) {
+  if (points.empty()) return;
+
+  switch (current_instrument) {
+    case ERASER: {
+      instruments[current_instrument]->apply_polyline(
+          canvas, points, last_point, Color(255, 255, 255), thickness);
+      break;
+    }
+
+    case CLEAR: {
+      instruments[current_instrument]->apply(canvas, points.back(), last_point,
+                                             Color(255, 255, 255), thickness);
+      break;
     }
 
-    last_point = pos;
+    default: {
+      instruments[current_instrument]->apply_polyline(canvas, points,
+                                                      last_point, color,
+                                                      thickness);
+      break;
+    }
+  }
+
+  last_point = points.back();
+}
+
+PluginCall InstrumentManager::get_plugin_call() {
+  std::lock_guard<std::mutex> lock(plugins_mutex);
+  PluginCall call = {};
+
+  call.plugin = plugins[current_instrument];
+  call.remote = remote_plugins[current_instrument].get();
+  call.plugin_index = current_instrument;
+  call.properties_hash = plugin_properties_hash;
+  call.thickness = thickness;
+  if (plugins_info[current_instrument].api_version >= 2) {
+    call.plugin_v2 = static_cast<PluginAPI::PluginV2*>(call.plugin);
+  }
+
+  return call;
+}
+
+PluginAPI::Canvas InstrumentManager::lock_plugin_canvas(const PluginCall& call,
+                                                       Image& canvas) {
+  if (call.remote) {
+    uint8_t* shared_buffer = call.remote->acquire_buffer(get_buffer_size(
+        Region(0, 0, canvas.get_width(), canvas.get_height())));
+    if (shared_buffer) return canvas.lock_canvas(shared_buffer);
+  }
+
+  return canvas.lock_canvas();
+}
+
+void InstrumentManager::unlock_plugin_canvas(const PluginCall& call,
+                                             Image& canvas,
+                                             PluginAPI::Canvas plugin_canvas) {
+  canvas.unlock_canvas();
+
+  if (call.remote) {
+    call.remote->release_buffer(plugin_canvas.pixels);
+  }
+}
+
+size_t InstrumentManager::get_buffer_size(Region region) {
+  return static_cast<size_t>(region.width) * region.height * sizeof(Color);
+}
+
+void InstrumentManager::run_plugin_start(const PluginCall& call, Image& canvas,
+                                         Position pos) {
+  if (call.plugin_v2) {
+    apply_plugin_region(call, canvas, std::vector<Position>({pos}),
+                        &PluginAPI::PluginV2::start_apply_region);
+    return;
+  }
+
+  auto plugin_canvas = lock_plugin_canvas(call, canvas);
+  call.plugin->start_apply(plugin_canvas, pos);
+  unlock_plugin_canvas(call, canvas, plugin_canvas);
+}
+
+void InstrumentManager::run_plugin_apply(const PluginCall& call, Image& canvas,
+                                         const std::vector<Position>& path) {
+  if (call.plugin_v2 && (call.plugin_v2->get_capabilities() &
+                         PluginAPI::CAPABILITY::TILE_PARALLEL)) {
+    apply_plugin_tiles(call, canvas, path);
+    return;
+  }
 
+  if (call.plugin_v2) {
+    apply_plugin_region(call, canvas, path,
+                        &PluginAPI::PluginV2::apply_region);
     return;
   }
 
-  plugins[current_instrument]->apply(canvas, pos);
+  auto plugin_canvas = lock_plugin_canvas(call, canvas);
+  for (auto& pos : path) {
+    call.plugin->apply(plugin_canvas, pos);
+  }
+  unlock_plugin_canvas(call, canvas, plugin_canvas);
+}
+
+void InstrumentManager::run_plugin_stop(const PluginCall& call, Image& canvas,
+                                        Position pos) {
+  if (call.plugin_v2) {
+    apply_plugin_region(call, canvas, std::vector<Position>({pos}),
+                        &PluginAPI::PluginV2::stop_apply_region);
+    return;
+  }
+
+  auto plugin_canvas = lock_plugin_canvas(call, canvas);
+  call.plugin->stop_apply(plugin_canvas, pos);
+  unlock_plugin_canvas(call, canvas, plugin_canvas);
+}
+
+Region InstrumentManager::get_plugin_footprint(const PluginCall& call,
+                                                Position pos) {
+  /* plugins use the thickness as the radius of their brush, one more pixel
+   * covers rounding inside the plugin */
+  int radius = call.thickness + 1;
+  return Region(pos.x - radius, pos.y - radius, 2 * radius + 1,
+                2 * radius + 1);
+}
+
+void InstrumentManager::apply_plugin_region(const PluginCall& call,
+                                            Image& canvas,
+                                            const std::vector<Position>& path,
+                                            PluginRegionMethod method) {
+  Region image_region = Region(0, 0, canvas.get_width(), canvas.get_height());
+
+  Region footprint = {};
+  for (auto& pos : path) {
+    footprint = footprint.united(get_plugin_footprint(call, pos));
+  }
+
+  footprint = footprint.intersected(image_region);
+  if (footprint.empty()) return;
+
+  /* filters read neighbours of the changed pixels, so the window has a
+   * margin of one more brush radius around the footprint */
+  auto plugin = call.plugin_v2;
+  int margin = std::max<int64_t>(plugin->get_halo(), call.thickness + 1);
+  Region window = Region(footprint.x - margin, footprint.y - margin,
+                         footprint.width + 2 * margin,
+                         footprint.height + 2 * margin);
+
+  window = window.intersected(image_region);
+
+  /* plugin processes get the window right in their shared memory, local
+   * plugins work in place when the window lies inside one tile */
+  uint8_t* shared_buffer =
+      call.remote ? call.remote->acquire_buffer(get_buffer_size(window))
+                  : nullptr;
+  auto plugin_view = shared_buffer ? canvas.lock_region(window, shared_buffer)
+                                   : canvas.view(window);
+
+  for (auto& pos : path) {
+    Region roi = get_plugin_footprint(call, pos).intersected(image_region);
+    if (roi.empty()) continue;
+
+    (plugin->*method)(plugin_view,
+                      PluginAPI::Rect{roi.x, roi.y, roi.width, roi.height},
+                      pos);
+  }
+
+  canvas.release_view(plugin_view);
+
+  if (shared_buffer) {
+    call.remote->release_buffer(shared_buffer);
+  }
+}
+
+void InstrumentManager::apply_plugin_tiles(const PluginCall& call,
+                                           Image& canvas,
+                                           const std::vector<Position>& path) {
+  struct TileJob {
+    /* bounding box of the footprints inside the tile */
+    Region roi;
+    /* indices of the path positions whose footprints reach the tile */
+    std::vector<size_t> points;
+  };
+
+  auto plugin = call.plugin_v2;
+  int halo = plugin->get_halo();
+  bool cacheable = plugin->get_capabilities() &
+                   PluginAPI::CAPABILITY::POSITION_INDEPENDENT;
+
+  Region image_region = Region(0, 0, canvas.get_width(), canvas.get_height());
+  int tiles_row = (canvas.get_width() + IMAGE_TILE_SIZE - 1) / IMAGE_TILE_SIZE;
+
+  /* consecutive positions mostly touch the same tiles, so every tile is
+   * staged and written back once per path instead of once per position */
+  std::vector<TileJob> jobs;
+  std::unordered_map<int, size_t> job_indices;
+
+  for (size_t i = 0; i < path.size(); ++i) {
+    Region footprint =
+        get_plugin_footprint(call, path[i]).intersected(image_region);
+    if (footprint.empty()) continue;
+
+    for (int tile_y = footprint.y / IMAGE_TILE_SIZE;
+         tile_y <= (footprint.y + footprint.height - 1) / IMAGE_TILE_SIZE;
+         ++tile_y) {
+      for (int tile_x = footprint.x / IMAGE_TILE_SIZE;
+           tile_x <= (footprint.x + footprint.width - 1) / IMAGE_TILE_SIZE;
+           ++tile_x) {
+        Region tile_roi = footprint.intersected(
+            Region(tile_x * IMAGE_TILE_SIZE, tile_y * IMAGE_TILE_SIZE,
+                   IMAGE_TILE_SIZE, IMAGE_TILE_SIZE));
+
+        auto [job_index, inserted] =
+            job_indices.try_emplace(tile_y * tiles_row + tile_x, jobs.size());
+        if (inserted) jobs.emplace_back();
+
+        TileJob& job = jobs[job_index->second];
+        job.roi = job.roi.united(tile_roi);
+        job.points.push_back(i);
+      }
+    }
+  }
+
+  /* tasks only read the image and produce pixels of their roi, which are
+   * written back after all of them finish, so halos never see partial
+   * results */
+  std::vector<std::shared_ptr<const FilterResult>> results(jobs.size());
+  std::atomic<size_t> tiles_done = 0;
+
+  auto report_progress = [&]() {
+    size_t done = ++tiles_done;
+    if (call.preview) return;
+
+    PluginTask::report_command_progress(static_cast<float>(done) /
+                                        jobs.size());
+  };
+
+  ThreadPool::parallel_for(jobs.size(), [&](size_t index) {
+    thread_local std::vector<uint8_t> window_buffer;
+
+    if (PluginTask::is_cancel_requested()) return;
+
+    const TileJob& job = jobs[index];
+    Region window =
+        Region(job.roi.x - halo, job.roi.y - halo, job.roi.width + 2 * halo,
+               job.roi.height + 2 * halo)
+            .intersected(image_region);
+
+    Region tile_region =
+        Region(job.roi.x / IMAGE_TILE_SIZE * IMAGE_TILE_SIZE,
+               job.roi.y / IMAGE_TILE_SIZE * IMAGE_TILE_SIZE, 0, 0);
+
+    FilterCacheKey cache_key = {};
+    if (cacheable) {
+      cache_key.content_hash = canvas.hash_region(window);
+      cache_key.properties_hash = call.properties_hash;
+      for (size_t point : job.points) {
+        Region roi =
+            get_plugin_footprint(call, path[point]).intersected(job.roi);
+        int32_t tile_roi[] = {roi.x - tile_region.x, roi.y - tile_region.y,
+                              roi.width, roi.height};
+        cache_key.rois_hash =
+            hash_bytes(tile_roi, sizeof(tile_roi), cache_key.rois_hash);
+      }
+      cache_key.layout = {call.plugin_index,
+                          call.thickness,
+                          window.x - tile_region.x,
+                          window.y - tile_region.y,
+                          window.width,
+                          window.height,
+                          job.roi.x - tile_region.x,
+                          job.roi.y - tile_region.y,
+                          job.roi.width,
+                          job.roi.height};
+
+      if (auto cached_result = FilterResultCache::find(cache_key)) {
+        results[index] = std::move(cached_result);
+        report_progress();
+        return;
+      }
+    }
+
+    /* with isolated plugins every task borrows its own plugin process */
+    uint8_t* shared_buffer =
+        call.remote ? call.remote->acquire_buffer(get_buffer_size(window))
+                    : nullptr;
+    PluginAPI::CanvasView window_view =
+        shared_buffer ? canvas.stage_region(window, shared_buffer)
+                      : canvas.stage_region(window, window_buffer);
+
+    for (size_t point : job.points) {
+      Region roi = get_plugin_footprint(call, path[point]).intersected(job.roi);
+      plugin->apply_region(
+          window_view, PluginAPI::Rect{roi.x, roi.y, roi.width, roi.height},
+          path[point]);
+    }
+
+    size_t row_size = job.roi.width * sizeof(Color);
+    auto result = std::make_shared<FilterResult>(get_buffer_size(job.roi));
+    for (int y = 0; y < job.roi.height; ++y) {
+      memcpy(result->data() + y * row_size,
+             window_view.at(job.roi.x, job.roi.y + y), row_size);
+    }
+
+    if (shared_buffer) {
+      call.remote->release_buffer(shared_buffer);
+    }
+
+    if (cacheable) {
+      FilterResultCache::insert(cache_key, result);
+    }
+    results[index] = std::move(result);
+    report_progress();
+  });
+
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    /* tiles skipped after cancellation keep their old content */
+    if (!results[i]) continue;
+
+    canvas.write_region(jobs[i].roi, results[i]->data());
+  }
 }
 
 bool InstrumentManager::is_applying() { return application_started; }
@@ -363,36 +867,97 @@ void InstrumentManager::set_instrument(uint8_t instrument) {
 }
 
 void InstrumentManager::set_color(Color color) {
+  if (!memcmp(&InstrumentManager::color, &color, sizeof(Color))) return;
+
   InstrumentManager::color = color;
+  ++properties_version;
 }
 
 Color InstrumentManager::get_color() { return InstrumentManager::color; }
 
 void InstrumentManager::set_thickness(uint8_t thickness) {
+  if (InstrumentManager::thickness == thickness) return;
+
   InstrumentManager::thickness = thickness;
+  ++properties_version;
+}
+
+/* manifest keeps paths relative to the plugins directory, so it stays valid
+ * when the editor is moved together with its plugins */
+static std::string to_manifest_path(const std::string& path) {
+  if (path.empty()) return path;
+
+  auto plugins_path = std::filesystem::current_path() / PLUGINS_PATH;
+  return std::filesystem::path(path).lexically_relative(plugins_path).string();
+}
+
+static std::string from_manifest_path(const std::string& path) {
+  if (path.empty()) return path;
+
+  /* an absolute path is kept as it is */
+  return (std::filesystem::current_path() / PLUGINS_PATH / path).string();
 }
 
 void InstrumentManager::get_plugins() {
   auto plugins_path = std::filesystem::current_path();
-  plugins_path /= "plugins";
+  plugins_path /= PLUGINS_PATH;
 
+  std::unordered_map<std::string, PluginInfo> cached_plugins;
+  for (auto& cached_info : read_plugin_manifest()) {
+    cached_plugins[cached_info.name] = cached_info;
+  }
+
+  std::error_code error;
   for (auto& plugin_entry : std::filesystem::directory_iterator(plugins_path)) {
-    if (plugin_entry.is_directory()) {
-      PluginInfo current_plugin_info;
+    if (!plugin_entry.is_directory()) continue;
+
+    /* unchanged plugins cost one stat instead of a directory walk */
+    auto name = plugin_entry.path().filename().string();
+    auto cached_info = cached_plugins.find(name);
+    if (cached_info != cached_plugins.end()) {
+      auto& cached_plugin = cached_info->second;
+      auto lib_time =
+          std::filesystem::last_write_time(cached_plugin.lib_path, error);
+
+      if (!error &&
+          lib_time.time_since_epoch().count() == cached_plugin.lib_mtime) {
+        plugins_info.push_back(cached_plugin);
+        continue;
+      }
+    }
 
-      for (auto& plugin_asset :
-           std::filesystem::directory_iterator(plugin_entry)) {
-        auto filename = plugin_asset.path().filename();
+    PluginInfo current_plugin_info;
+    current_plugin_info.name = name;
 
-        if (filename.string().starts_with("icon")) {
-          current_plugin_info.icon_path = plugin_asset.path().string();
-        } else if (filename.string().ends_with(".so")) {
-          current_plugin_info.lib_path = plugin_asset.path().string();
-        }
-      }
+    for (auto& plugin_asset :
+         std::filesystem::directory_iterator(plugin_entry)) {
+      auto filename = plugin_asset.path().filename();
 
-      plugins_info.push_back(current_plugin_info);
+      if (filename.string().starts_with("icon")) {
+        current_plugin_info.icon_path = plugin_asset.path().string();
+      } else if (filename.string().ends_with(".so")) {
+        current_plugin_info.lib_path = plugin_asset.path().string();
+        current_plugin_info.lib_mtime =
+            plugin_asset.last_write_time().time_since_epoch().count();
+      }
     }
+
+    plugins_info.push_back(current_plugin_info);
+    manifest_dirty = true;
+  }
+
+  /* directory order is unspecified, the toolbar should not reshuffle */
+  std::sort(plugins_info.begin(), plugins_info.end(),
+            [](const PluginInfo& left, const PluginInfo& right) {
+              return left.name < right.name;
+            });
+
+  if (plugins_info.size() != cached_plugins.size()) {
+    manifest_dirty = true;
+  }
+
+  if (manifest_dirty) {
+    save_plugin_manifest();
   }
 
   for (auto& info_entry : plugins_info) {
@@ -401,22 +966,957 @@ void InstrumentManager::get_plugins() {
   }
 }
 
-void InstrumentManager::load_plugins() {
-  for (auto& lib_info : plugins_info) {
-    void* handle = dlopen(lib_info.lib_path.data(), RTLD_NOW);
-    handles.push_back(handle);
+std::vector<PluginInfo> InstrumentManager::read_plugin_manifest() {
+  std::vector<PluginInfo> manifest;
+
+  FILE* manifest_file = fopen(PLUGIN_MANIFEST_PATH, "r");
+  if (!manifest_file) return manifest;
+
+  /* one plugin per line: name, icon, library, library mtime, api version,
+   * separated by single tabs, the icon may be empty */
+  char line[PLUGIN_MANIFEST_LINE_LENGTH] = {};
+  while (fgets(line, sizeof(line), manifest_file)) {
+    line[strcspn(line, "\r\n")] = '\0';
+
+    std::vector<std::string> fields;
+    for (char* field = line;;) {
+      char* field_end = strchr(field, '\t');
+      if (!field_end) {
+        fields.emplace_back(field);
+        break;
+      }
+
+      fields.emplace_back(field, field_end);
+      field = field_end + 1;
+    }
+
+    if (fields.size() != 5 || fields[2].empty()) continue;
+
+    PluginInfo cached_info;
+    cached_info.name = fields[0];
+    cached_info.icon_path = from_manifest_path(fields[1]);
+    cached_info.lib_path = from_manifest_path(fields[2]);
+    cached_info.lib_mtime = strtoll(fields[3].data(), nullptr, 10);
+    cached_info.api_version = strtoul(fields[4].data(), nullptr, 10);
+
+    manifest.push_back(cached_info);
+  }
+
+  fclose(manifest_file);
+  return manifest;
+}
+
+void InstrumentManager::save_plugin_manifest() {
+  FILE* manifest_file = fopen(PLUGIN_MANIFEST_PATH, "w");
+  if (!manifest_file) return;
+
+  for (auto& info : plugins_info) {
+    /* native filters have no library and are added on every start */
+    if (info.lib_path.empty()) continue;
+
+    fprintf(manifest_file, "%s\t%s\t%s\t%lld\t%u\n", info.name.data(),
+            to_manifest_path(info.icon_path).data(),
+            to_manifest_path(info.lib_path).data(),
+            static_cast<long long>(info.lib_mtime), info.api_version);
+  }
+
+  fclose(manifest_file);
+  manifest_dirty = false;
+}
+
+bool InstrumentManager::load_plugin(int index) {
+  std::unique_lock<std::mutex> lock(plugins_mutex);
+  /* the prewarm thread and the UI thread may ask for the same plugin */
+  plugin_loaded.wait(lock, [index] { return !plugins_loading[index]; });
+  if (plugins[index]) return true;
+
+  /* stages of a chain take the lock one by one */
+  if (filter_chains[index]) {
+    lock.unlock();
+    return load_filter_chain(index);
+  }
+
+  /* plugin code may run for long in dlopen and init, and a plugin host
+   * takes a while to start, so only threads waiting for this plugin are
+   * blocked meanwhile */
+  plugins_loading[index] = true;
+  std::string lib_path = plugins_info[index].lib_path;
+  lock.unlock();
+
+  bool loaded = plugin_isolation ? load_remote_plugin(index, lib_path)
+                                 : load_local_plugin(index, lib_path);
+
+  lock.lock();
+  plugins_loading[index] = false;
+  lock.unlock();
+
+  plugin_loaded.notify_all();
+  return loaded;
+}
+
+bool InstrumentManager::load_local_plugin(int index,
+                                          const std::string& lib_path) {
+  void* handle = dlopen(lib_path.data(), RTLD_NOW);
+  if (!handle) {
+    printf("Failed to load plugin %s: %s\n", lib_path.data(), dlerror());
+    return false;
+  }
+
+  PluginAPI::Plugin* (*get_plugin)() =
+      reinterpret_cast<PluginAPI::Plugin* (*)()>(dlsym(handle, "get_plugin"));
+  if (!get_plugin) {
+    dlclose(handle);
+    return false;
+  }
+
+  auto plugin = get_plugin();
+  plugin->init();
+
+  /* plugins without the version symbol were built against API v1 */
+  uint32_t api_version = 1;
+  uint32_t (*get_plugin_api_version)() = reinterpret_cast<uint32_t (*)()>(
+      dlsym(handle, "get_plugin_api_version"));
+  if (get_plugin_api_version) {
+    api_version = get_plugin_api_version();
+  }
+
+  std::lock_guard<std::mutex> lock(plugins_mutex);
+  update_plugin_version(index, api_version);
+  handles[index] = handle;
+  plugins[index] = plugin;
+  resolve_property_slots(index);
+  return true;
+}
+
+bool InstrumentManager::load_remote_plugin(int index,
+                                           const std::string& lib_path) {
+  /* one process per pool worker and one for the calling thread */
+  auto remote_plugin = std::make_unique<RemotePlugin>(
+      lib_path, ThreadPool::get_threads_count() + 1);
+
+  if (!remote_plugin->init()) {
+    printf("Failed to start plugin host for %s\n", lib_path.data());
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(plugins_mutex);
+  update_plugin_version(index, remote_plugin->get_api_version());
+  plugins[index] = remote_plugin.get();
+  remote_plugins[index] = std::move(remote_plugin);
+  resolve_property_slots(index);
+  return true;
+}
+
+void InstrumentManager::update_plugin_version(int index,
+                                              uint32_t api_version) {
+  auto& lib_info = plugins_info[index];
+
+  if (lib_info.api_version != api_version) {
+    lib_info.api_version = api_version;
+    manifest_dirty = true;
+  }
+}
+
+void InstrumentManager::prewarm_plugins() {
+  /* chains created later are loaded when they are selected */
+  size_t plugins_count = 0;
+  {
+    std::lock_guard<std::mutex> lock(plugins_mutex);
+    plugins_count = plugins_info.size();
+  }
+
+  for (size_t i = 0; i < plugins_count && !prewarm_stop; ++i) {
+    load_plugin(i);
+  }
+}
+
+void InstrumentManager::add_native_filter(
+    std::unique_ptr<PluginAPI::Plugin> filter, const char* name,
+    const char* icon_path) {
+  filter->init();
+
+  PluginInfo filter_info;
+  filter_info.name = name;
+  filter_info.icon_path = icon_path;
+  filter_info.api_version = PluginAPI::API_VERSION;
+
+  /* loaded from the start, so load_plugin() never looks for a library */
+  plugins_info.push_back(filter_info);
+  plugins.push_back(filter.get());
+  handles.push_back(nullptr);
+  remote_plugins.emplace_back();
+  property_slots.emplace_back();
+  plugins_loading.push_back(false);
+  filter_chains.emplace_back();
+  native_filters.push_back(std::move(filter));
+  resolve_property_slots(plugins.size() - 1);
+}
+
+void InstrumentManager::load_filter_chains() {
+  std::vector<std::filesystem::path> chain_paths;
+
+  std::error_code error;
+  for (auto& chain_entry :
+       std::filesystem::directory_iterator(FILTER_CHAINS_PATH, error)) {
+    if (chain_entry.path().extension() == FILTER_CHAIN_EXTENSION) {
+      chain_paths.push_back(chain_entry.path());
+    }
+  }
+
+  std::sort(chain_paths.begin(), chain_paths.end());
+
+  for (auto& chain_path : chain_paths) {
+    FILE* chain_file = fopen(chain_path.c_str(), "r");
+    if (!chain_file) continue;
+
+    /* one plugin name per line, lines starting with # are comments */
+    std::vector<std::string> stage_names;
+    char line[PLUGIN_MANIFEST_LINE_LENGTH] = {};
+    while (fgets(line, sizeof(line), chain_file)) {
+      line[strcspn(line, "\r\n")] = '\0';
+      if (line[0] && line[0] != '#') {
+        stage_names.push_back(line);
+      }
+    }
+
+    fclose(chain_file);
+    add_filter_chain(chain_path.stem().string(), stage_names);
+  }
+}
+
+int InstrumentManager::add_filter_chain(
+    const std::string& name, const std::vector<std::string>& stage_names) {
+  PluginInfo chain_info;
+  chain_info.name = name;
+  chain_info.icon_path = FILTER_CHAIN_ICON_PATH;
+  chain_info.api_version = PluginAPI::API_VERSION;
+
+  auto chain_entry = std::make_unique<FilterChainEntry>();
+  chain_entry->stage_names = stage_names;
+
+  std::lock_guard<std::mutex> lock(plugins_mutex);
+  plugins_info.push_back(chain_info);
+  plugins.push_back(nullptr);
+  handles.push_back(nullptr);
+  remote_plugins.emplace_back();
+  property_slots.emplace_back();
+  plugins_loading.push_back(false);
+  filter_chains.push_back(std::move(chain_entry));
+
+  return plugins_info.size() - 1;
+}
+
+bool InstrumentManager::load_filter_chain(int index) {
+  std::unique_lock<std::mutex> lock(plugins_mutex);
+
+  /* entries are not moved when filter_chains grows, and stage names never
+   * change after the chain is added */
+  auto& chain_entry = *filter_chains[index];
+  std::string chain_name = plugins_info[index].name;
+
+  std::vector<int> stages;
+  for (auto& stage_name : chain_entry.stage_names) {
+    int stage = find_plugin(stage_name);
+
+    if (stage < 0 || filter_chains[stage]) {
+      printf("Failed to load filter chain %s: can not use %s\n",
+             chain_name.data(), stage_name.data());
+      return false;
+    }
+
+    stages.push_back(stage);
+  }
+
+  lock.unlock();
+  for (size_t i = 0; i < stages.size(); ++i) {
+    if (!load_plugin(stages[i])) {
+      printf("Failed to load filter chain %s: can not use %s\n",
+             chain_name.data(), chain_entry.stage_names[i].data());
+      return false;
+    }
+  }
+
+  lock.lock();
+  if (plugins[index]) return true;
+
+  for (int stage : stages) {
+    chain_entry.chain.add_stage(
+        plugins[stage], plugins_info[stage].api_version >= 2
+                            ? static_cast<PluginAPI::PluginV2*>(plugins[stage])
+                            : nullptr);
+  }
+
+  chain_entry.stages = stages;
+  plugins[index] = &chain_entry.chain;
+  resolve_property_slots(index);
+  return true;
+}
+
+int InstrumentManager::find_plugin(const std::string& name) {
+  for (size_t i = 0; i < plugins_info.size(); ++i) {
+    if (plugins_info[i].name == name) return i;
+  }
+
+  return -1;
+}
+
+int InstrumentManager::create_filter_chain(const std::string& name,
+                                           const std::vector<int>& stages) {
+  std::vector<std::string> stage_names;
+  {
+    std::lock_guard<std::mutex> lock(plugins_mutex);
+    for (int stage : stages) {
+      stage_names.push_back(plugins_info[stage].name);
+    }
+  }
+
+  return add_filter_chain(name, stage_names);
+}
+
+bool InstrumentManager::save_filter_chain(int index) {
+  FilterChainEntry* chain_entry = nullptr;
+  std::string chain_name;
+  {
+    std::lock_guard<std::mutex> lock(plugins_mutex);
+    chain_entry = filter_chains[index].get();
+    chain_name = plugins_info[index].name;
+  }
+
+  if (!chain_entry) return false;
+
+  std::error_code error;
+  std::filesystem::create_directories(FILTER_CHAINS_PATH, error);
+
+  auto chain_path = std::filesystem::path(FILTER_CHAINS_PATH) /
+                    (chain_name + FILTER_CHAIN_EXTENSION);
+  FILE* chain_file = fopen(chain_path.c_str(), "w");
+  if (!chain_file) return false;
+
+  fprintf(chain_file, "# plugins applied one after another\n");
+  for (auto& stage_name : chain_entry->stage_names) {
+    fprintf(chain_file, "%s\n", stage_name.data());
+  }
+
+  fclose(chain_file);
+  return true;
+}
+
+bool InstrumentManager::is_filter_chain(int index) {
+  std::lock_guard<std::mutex> lock(plugins_mutex);
+  return filter_chains[index] != nullptr;
+}
+
+void InstrumentManager::resolve_property_slots(int index) {
+  auto& properties = plugins[index]->properties;
+  PluginPropertySlots slots;
+
+  auto primary_color = properties.find(PluginAPI::TYPE::PRIMARY_COLOR);
+  if (primary_color != properties.end()) {
+    slots.primary_color = &primary_color->second;
+  }
+
+  auto thickness = properties.find(PluginAPI::TYPE::THICKNESS);
+  if (thickness != properties.end()) {
+    slots.thickness = &thickness->second;
+  }
+
+  property_slots[index] = slots;
+}
+
+void InstrumentManager::sync_plugin_properties(int index) {
+  if (filter_chains[index]) {
+    for (int stage : filter_chains[index]->stages) {
+      sync_plugin_properties(stage);
+    }
+  }
+
+  auto& slots = property_slots[index];
+  if (slots.synced_version == properties_version) return;
+
+  if (slots.primary_color) {
+    slots.primary_color->int_value = color;
+  }
+
+  if (slots.thickness) {
+    slots.thickness->int_value = thickness;
+  }
+
+  slots.synced_version = properties_version;
+}
+
+uint64_t InstrumentManager::hash_plugin_properties(int index) {
+  uint64_t hash = 0;
 
-    PluginAPI::Plugin* (*get_plugin)() =
-        reinterpret_cast<PluginAPI::Plugin* (*)()>(dlsym(handle, "get_plugin"));
+  if (filter_chains[index]) {
+    for (int stage : filter_chains[index]->stages) {
+      hash = hash_bytes(&hash, sizeof(hash), hash_plugin_properties(stage));
+    }
+  }
 
-    auto plugin = get_plugin();
-    plugin->init();
+  /* map order is unspecified, so entries are combined order-independently */
+  for (auto& property : plugins[index]->properties) {
+    uint64_t value = 0;
+    memcpy(&value, &property.second.double_value, sizeof(value));
 
-    plugins.push_back(plugin);
+    int64_t entry[] = {property.first, property.second.display_type,
+                       static_cast<int64_t>(value)};
+    hash += hash_bytes(entry, sizeof(entry));
   }
+
+  return hash;
+}
+
+void InstrumentManager::select_plugin(int index) {
+  if (!load_plugin(index)) return;
+
+  enable_plugin();
+  set_instrument(index);
 }
 
 void InstrumentManager::enable_plugin() { plugin_active = true; }
 
 void InstrumentManager::disable_plugin() { plugin_active = false; }
 
+void InstrumentManager::set_plugin_async(bool async) { plugin_async = async; }
+
+std::thread PluginTask::worker;
+std::mutex PluginTask::commands_mutex;
+std::condition_variable PluginTask::commands_condition;
+std::deque<PluginTask::Command> PluginTask::commands;
+
+PluginCall PluginTask::call = {};
+const Image* PluginTask::target = nullptr;
+std::unique_ptr<Image> PluginTask::base;
+std::unique_ptr<Image> PluginTask::result;
+
+std::atomic<bool> PluginTask::cancel_requested = false;
+std::atomic<size_t> PluginTask::commands_queued = 0;
+std::atomic<size_t> PluginTask::commands_done = 0;
+std::atomic<float> PluginTask::command_progress = 0;
+
+bool PluginTask::preview_enabled = false;
+size_t PluginTask::commands_previewed = 0;
+std::unique_ptr<Image> PluginTask::proxy;
+std::vector<bool> PluginTask::proxy_tiles_ready;
+
+std::mutex PluginTask::preview_mutex;
+std::vector<PluginTask::PreviewPatch> PluginTask::preview_patches;
+std::unique_ptr<Image> PluginTask::preview;
+
+void PluginTask::start(Image& canvas, const PluginCall& plugin_call,
+                       Position pos) {
+  if (is_running()) return;
+
+  call = plugin_call;
+  target = &canvas;
+
+  /* both copies share tiles with the canvas, the worker copies only tiles
+   * it writes to */
+  base = std::make_unique<Image>(canvas);
+  result = std::make_unique<Image>(canvas);
+
+  cancel_requested = false;
+  commands_queued = 0;
+  commands_done = 0;
+  command_progress = 0;
+
+  /* plugins which keep state between calls can not be run twice, so only
+   * tile parallel ones are previewed */
+  preview_enabled = call.plugin_v2 && (call.plugin_v2->get_capabilities() &
+                                       PluginAPI::CAPABILITY::TILE_PARALLEL);
+  if (preview_enabled) {
+    int proxy_width = (canvas.get_width() + PREVIEW_SCALE - 1) / PREVIEW_SCALE;
+    int proxy_height =
+        (canvas.get_height() + PREVIEW_SCALE - 1) / PREVIEW_SCALE;
+
+    proxy = std::make_unique<Image>(proxy_width, proxy_height,
+                                    Color(0, 0, 0, 0));
+    proxy_tiles_ready.assign(
+        ((proxy_width + IMAGE_TILE_SIZE - 1) / IMAGE_TILE_SIZE) *
+            ((proxy_height + IMAGE_TILE_SIZE - 1) / IMAGE_TILE_SIZE),
+        false);
+  }
+
+  push(Command{START, {pos}});
+  worker = std::thread(worker_loop);
+}
+
+void PluginTask::apply(const std::vector<Position>& path) {
+  if (!is_running()) return;
+  push(Command{APPLY, path});
+}
+
+void PluginTask::stop(Position pos) {
+  if (!is_running()) return;
+  push(Command{STOP, {pos}});
+}
+
+void PluginTask::push(Command command) {
+  {
+    std::lock_guard<std::mutex> lock(commands_mutex);
+    commands.push_back(std::move(command));
+    ++commands_queued;
+  }
+
+  commands_condition.notify_one();
+}
+
+void PluginTask::worker_loop() {
+  while (true) {
+    Command command;
+    std::vector<Command> preview_commands;
+
+    {
+      std::unique_lock<std::mutex> lock(commands_mutex);
+      commands_condition.wait(
+          lock, [] { return !commands.empty() || cancel_requested; });
+      if (cancel_requested) break;
+
+      /* commands queued behind the next one while the previous one ran
+       * are previewed, the next one starts at full resolution right away */
+      if (preview_enabled) {
+        preview_commands.assign(
+            commands.begin() + std::max<size_t>(commands_previewed, 1),
+            commands.end());
+        commands_previewed = commands.size();
+      }
+
+      command = std::move(commands.front());
+      commands.pop_front();
+      if (commands_previewed) --commands_previewed;
+    }
+
+    for (auto& preview_command : preview_commands) {
+      if (cancel_requested) break;
+      run_preview(preview_command);
+    }
+
+    command_progress = 0;
+
+    switch (command.type) {
+      case START: {
+        InstrumentManager::run_plugin_start(call, *result,
+                                            command.path.front());
+        break;
+      }
+
+      case APPLY: {
+        InstrumentManager::run_plugin_apply(call, *result, command.path);
+        break;
+      }
+
+      case STOP: {
+        InstrumentManager::run_plugin_stop(call, *result,
+                                           command.path.front());
+        break;
+      }
+    }
+
+    if (preview_enabled && !cancel_requested) {
+      publish_result(command);
+    }
+
+    ++commands_done;
+    if (command.type == STOP) break;
+  }
+
+  EventQueue::add_event(new PluginTaskEvent(target, cancel_requested));
+}
+
+void PluginTask::run_preview(const Command& command) {
+  /* the proxy gets its own properties hash, so its tiles never come out of
+   * FilterResultCache for the canvas itself */
+  int scale = PREVIEW_SCALE;
+  PluginCall proxy_call = call;
+  proxy_call.preview = true;
+  proxy_call.thickness = std::max(call.thickness / PREVIEW_SCALE, 1);
+  proxy_call.properties_hash =
+      hash_bytes(&scale, sizeof(scale), call.properties_hash);
+
+  std::vector<Position> proxy_path;
+  for (auto& pos : command.path) {
+    proxy_path.push_back(
+        Position(pos.x / PREVIEW_SCALE, pos.y / PREVIEW_SCALE));
+  }
+
+  Region proxy_image_region =
+      Region(0, 0, proxy->get_width(), proxy->get_height());
+
+  Region footprint = {};
+  for (auto& pos : proxy_path) {
+    footprint = footprint.united(
+        InstrumentManager::get_plugin_footprint(proxy_call, pos));
+  }
+
+  footprint = footprint.intersected(proxy_image_region);
+  if (footprint.empty()) return;
+
+  call.plugin_v2->set_preview_scale(1.0 / PREVIEW_SCALE);
+
+  /* plugin reads whole tiles around the footprint together with the halo,
+   * or one more brush radius for the first and the last points */
+  int margin = std::max<int64_t>(call.plugin_v2->get_halo(),
+                                 proxy_call.thickness + 1);
+  int tiles_x = footprint.x / IMAGE_TILE_SIZE * IMAGE_TILE_SIZE;
+  int tiles_y = footprint.y / IMAGE_TILE_SIZE * IMAGE_TILE_SIZE;
+  int tiles_end_x =
+      ((footprint.x + footprint.width - 1) / IMAGE_TILE_SIZE + 1) *
+      IMAGE_TILE_SIZE;
+  int tiles_end_y =
+      ((footprint.y + footprint.height - 1) / IMAGE_TILE_SIZE + 1) *
+      IMAGE_TILE_SIZE;
+
+  prepare_proxy(Region(tiles_x - margin, tiles_y - margin,
+                       tiles_end_x - tiles_x + 2 * margin,
+                       tiles_end_y - tiles_y + 2 * margin)
+                    .intersected(proxy_image_region));
+
+  switch (command.type) {
+    case START: {
+      InstrumentManager::run_plugin_start(proxy_call, *proxy,
+                                          proxy_path.front());
+      break;
+    }
+
+    case APPLY: {
+      InstrumentManager::run_plugin_apply(proxy_call, *proxy, proxy_path);
+      break;
+    }
+
+    case STOP: {
+      InstrumentManager::run_plugin_stop(proxy_call, *proxy,
+                                         proxy_path.front());
+      break;
+    }
+  }
+
+  call.plugin_v2->set_preview_scale(1);
+  publish_preview(footprint);
+}
+
+void PluginTask::prepare_proxy(Region proxy_region) {
+  if (proxy_region.empty()) return;
+
+  int tiles_row = (proxy->get_width() + IMAGE_TILE_SIZE - 1) / IMAGE_TILE_SIZE;
+  Region image_region = Region(0, 0, result->get_width(), result->get_height());
+  Region proxy_image_region =
+      Region(0, 0, proxy->get_width(), proxy->get_height());
+
+  std::vector<uint8_t> source;
+  std::vector<uint8_t> pixels;
+
+  for (int tile_y = proxy_region.y / IMAGE_TILE_SIZE;
+       tile_y <= (proxy_region.y + proxy_region.height - 1) / IMAGE_TILE_SIZE;
+       ++tile_y) {
+    for (int tile_x = proxy_region.x / IMAGE_TILE_SIZE;
+         tile_x <= (proxy_region.x + proxy_region.width - 1) / IMAGE_TILE_SIZE;
+         ++tile_x) {
+      if (proxy_tiles_ready[tile_y * tiles_row + tile_x]) continue;
+      proxy_tiles_ready[tile_y * tiles_row + tile_x] = true;
+
+      Region tile_region =
+          Region(tile_x * IMAGE_TILE_SIZE, tile_y * IMAGE_TILE_SIZE,
+                 IMAGE_TILE_SIZE, IMAGE_TILE_SIZE)
+              .intersected(proxy_image_region);
+      Region source_region =
+          Region(tile_region.x * PREVIEW_SCALE, tile_region.y * PREVIEW_SCALE,
+                 tile_region.width * PREVIEW_SCALE,
+                 tile_region.height * PREVIEW_SCALE)
+              .intersected(image_region);
+
+      source.resize(InstrumentManager::get_buffer_size(source_region));
+      pixels.resize(InstrumentManager::get_buffer_size(tile_region));
+      result->read_region(source_region, source.data());
+
+      /* every proxy pixel is the mean of the block it covers, blocks at the
+       * right and the bottom edges may be cut off */
+      for (int y = 0; y < tile_region.height; ++y) {
+        int block_y = y * PREVIEW_SCALE;
+        int block_height =
+            std::min(PREVIEW_SCALE, source_region.height - block_y);
+
+        for (int x = 0; x < tile_region.width; ++x) {
+          int block_x = x * PREVIEW_SCALE;
+          int block_width =
+              std::min(PREVIEW_SCALE, source_region.width - block_x);
+          uint32_t sums[sizeof(Color)] = {};
+
+          for (int dy = 0; dy < block_height; ++dy) {
+            const uint8_t* row =
+                source.data() +
+                ((block_y + dy) * source_region.width + block_x) *
+                    sizeof(Color);
+            for (int i = 0; i < block_width * (int)sizeof(Color); ++i) {
+              sums[i % sizeof(Color)] += row[i];
+            }
+          }
+
+          uint32_t count = block_width * block_height;
+          uint8_t* pixel =
+              pixels.data() + (y * tile_region.width + x) * sizeof(Color);
+          for (size_t i = 0; i < sizeof(Color); ++i) {
+            pixel[i] = (sums[i] + count / 2) / count;
+          }
+        }
+      }
+
+      proxy->write_region(tile_region, pixels.data());
+    }
+  }
+}
+
+void PluginTask::publish_preview(Region proxy_region) {
+  Region image_region = Region(0, 0, result->get_width(), result->get_height());
+  Region region = Region(proxy_region.x * PREVIEW_SCALE,
+                         proxy_region.y * PREVIEW_SCALE,
+                         proxy_region.width * PREVIEW_SCALE,
+                         proxy_region.height * PREVIEW_SCALE)
+                      .intersected(image_region);
+
+  std::vector<uint8_t> source(InstrumentManager::get_buffer_size(proxy_region));
+  proxy->read_region(proxy_region, source.data());
+
+  PreviewPatch patch = {region, {}};
+  patch.pixels.resize(InstrumentManager::get_buffer_size(region));
+
+  for (int y = 0; y < region.height; ++y) {
+    const uint8_t* source_row = source.data() + (y / PREVIEW_SCALE) *
+                                                    proxy_region.width *
+                                                    sizeof(Color);
+    uint8_t* row = patch.pixels.data() + y * region.width * sizeof(Color);
+
+    for (int x = 0; x < region.width; ++x) {
+      memcpy(row + x * sizeof(Color),
+             source_row + (x / PREVIEW_SCALE) * sizeof(Color), sizeof(Color));
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(preview_mutex);
+  preview_patches.push_back(std::move(patch));
+}
+
+void PluginTask::publish_result(const Command& command) {
+  Region image_region = Region(0, 0, result->get_width(), result->get_height());
+
+  Region footprint = {};
+  for (auto& pos : command.path) {
+    footprint = footprint.united(
+        InstrumentManager::get_plugin_footprint(call, pos));
+  }
+
+  footprint = footprint.intersected(image_region);
+  if (footprint.empty()) return;
+
+  PreviewPatch patch = {footprint, {}};
+  patch.pixels.resize(InstrumentManager::get_buffer_size(footprint));
+  result->read_region(footprint, patch.pixels.data());
+
+  /* previews of the next commands read the footprint from the result */
+  int tiles_row = (proxy->get_width() + IMAGE_TILE_SIZE - 1) / IMAGE_TILE_SIZE;
+  int source_tile_size = IMAGE_TILE_SIZE * PREVIEW_SCALE;
+
+  for (int tile_y = footprint.y / source_tile_size;
+       tile_y <= (footprint.y + footprint.height - 1) / source_tile_size;
+       ++tile_y) {
+    for (int tile_x = footprint.x / source_tile_size;
+         tile_x <= (footprint.x + footprint.width - 1) / source_tile_size;
+         ++tile_x) {
+      proxy_tiles_ready[tile_y * tiles_row + tile_x] = false;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(preview_mutex);
+  preview_patches.push_back(std::move(patch));
+}
+
+void PluginTask::reset_preview() {
+  if (preview) {
+    Renderer::release_image(*preview);
+  }
+
+  preview_enabled = false;
+  commands_previewed = 0;
+  proxy.reset();
+  proxy_tiles_ready.clear();
+  preview_patches.clear();
+  preview.reset();
+}
+
+void PluginTask::cancel() {
+  if (!is_running()) return;
+
+  /* a plugin in another process can be stopped in the middle of a call */
+  if (call.remote) {
+    call.remote->interrupt();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(commands_mutex);
+    cancel_requested = true;
+  }
+
+  commands_condition.notify_one();
+}
+
+bool PluginTask::is_cancel_requested() { return cancel_requested; }
+
+void PluginTask::finish(Image& canvas) {
+  if (!is_running()) return;
+  worker.join();
+
+  /* the canvas may have been replaced by another image meanwhile */
+  bool same_image = canvas.get_width() == result->get_width() &&
+                    canvas.get_height() == result->get_height();
+
+  if (!cancel_requested && same_image) {
+    for (auto& tile_region : result->get_changed_tiles(*base)) {
+      int tile_x = tile_region.x / IMAGE_TILE_SIZE;
+      int tile_y = tile_region.y / IMAGE_TILE_SIZE;
+      canvas.set_tile(tile_x, tile_y, result->get_tile(tile_x, tile_y));
+    }
+  }
+
+  commands.clear();
+  base.reset();
+  result.reset();
+  reset_preview();
+  target = nullptr;
+  cancel_requested = false;
+}
+
+void PluginTask::deinit() {
+  if (!is_running()) return;
+
+  cancel();
+  worker.join();
+
+  commands.clear();
+  base.reset();
+  result.reset();
+  reset_preview();
+}
+
+bool PluginTask::is_running() { return worker.joinable(); }
+
+bool PluginTask::is_running_on(const Image& canvas) {
+  return is_running() && target == &canvas;
+}
+
+Image* PluginTask::get_preview(const Image& canvas) {
+  if (!is_running_on(canvas) || !preview_enabled) return nullptr;
+
+  std::vector<PreviewPatch> patches;
+  {
+    std::lock_guard<std::mutex> lock(preview_mutex);
+    patches.swap(preview_patches);
+  }
+
+  if (!preview && patches.empty()) return nullptr;
+
+  /* the preview shares tiles with the canvas, so only patched tiles are
+   * copied, and only patched regions are uploaded to the texture */
+  if (!preview) {
+    preview = std::make_unique<Image>(canvas);
+  }
+
+  for (auto& patch : patches) {
+    preview->write_region(patch.region, patch.pixels.data());
+  }
+
+  return preview.get();
+}
+
+float PluginTask::get_progress() {
+  size_t queued = commands_queued;
+  if (!queued) return 0;
+
+  return std::min((commands_done + command_progress) / queued, 1.0f);
+}
+
+void PluginTask::report_command_progress(float fraction) {
+  command_progress = fraction;
+}
+
+/*---------------------------------------*/
+/*           FilterResultCache           */
+/*---------------------------------------*/
+
+std::mutex FilterResultCache::cache_mutex;
+std::list<FilterResultCache::Entry> FilterResultCache::entries;
+std::unordered_map<FilterCacheKey,
+                   std::list<FilterResultCache::Entry>::iterator,
+                   FilterCacheKeyHash>
+    FilterResultCache::entries_index;
+size_t FilterResultCache::budget = DEFAULT_FILTER_CACHE_BUDGET;
+size_t FilterResultCache::size = 0;
+size_t FilterResultCache::hits = 0;
+size_t FilterResultCache::misses = 0;
+
+size_t FilterCacheKeyHash::operator()(const FilterCacheKey& key) const {
+  return hash_bytes(key.layout.data(), sizeof(key.layout),
+                    key.content_hash ^ key.properties_hash ^ key.rois_hash);
+}
+
+std::shared_ptr<const FilterResult> FilterResultCache::find(
+    const FilterCacheKey& key) {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+
+  auto entry = entries_index.find(key);
+  if (entry == entries_index.end()) {
+    ++misses;
+    return nullptr;
+  }
+
+  ++hits;
+  entries.splice(entries.begin(), entries, entry->second);
+  return entry->second->second;
+}
+
+void FilterResultCache::insert(const FilterCacheKey& key,
+                               std::shared_ptr<const FilterResult> result) {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  if (budget < result->size() || entries_index.count(key)) return;
+
+  evict(budget - result->size());
+  size += result->size();
+  entries.emplace_front(key, std::move(result));
+  entries_index[key] = entries.begin();
+}
+
+void FilterResultCache::evict(size_t budget) {
+  while (size > budget) {
+    size -= entries.back().second->size();
+    entries_index.erase(entries.back().first);
+    entries.pop_back();
+  }
+}
+
+void FilterResultCache::set_budget(size_t bytes) {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+
+  budget = bytes;
+  evict(budget);
+}
+
+void FilterResultCache::clear() {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+
+  entries_index.clear();
+  entries.clear();
+  size = 0;
+}
+
+size_t FilterResultCache::get_size() {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  return size;
+}
+
+size_t FilterResultCache::get_hits() {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  return hits;
+}
+
+size_t FilterResultCache::get_misses() {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  return misses;
+}
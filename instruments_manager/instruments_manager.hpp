@@ -3,18 +3,32 @@
 
 #include <dlfcn.h>
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
 #include <cstdarg>
+#include <cstring>
+#include <deque>
 #include <filesystem>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <random>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "../brush_stamps/brush_stamps.hpp"
 #include "../data_classes/data_classes.hpp"
 #include "../event/event.hpp"
 #include "../event_queue/event_queue.hpp"
+#include "../filter_chain/filter_chain.hpp"
+#include "../native_filters/native_filters.hpp"
 #include "../plugin_api/api.hpp"
+#include "../plugin_host/remote_plugin.hpp"
 #include "../sfml_engine/sfml_engine.hpp"
 #include "../subscription_manager/subscription_manager.hpp"
+#include "../thread_pool/thread_pool.hpp"
 #include "../window_base/window_base.hpp"
 
 class ToolbarListener : public Window {
@@ -35,6 +49,41 @@ enum INSTRUMENTS {
   COUNT
 };
 
+/*!
+ * Smooths sampled mouse path with centripetal Catmull-Rom spline. Keeps a
+ * ring of the last SPLINE_CONTROL_POINTS points and emits the curve segment
+ * between the two middle ones as soon as the next point arrives, so every
+ * part of the curve is evaluated once. Missing control points at the stroke
+ * ends are replaced with duplicates.
+ * */
+class SplineInterpolator {
+ private:
+  static const int SPLINE_CONTROL_POINTS = 4;
+
+  Position control_points[SPLINE_CONTROL_POINTS];
+  int points_count;
+
+  static void emit_segment(Position p0, Position p1, Position p2, Position p3,
+                           std::vector<Position>& curve);
+
+ public:
+  SplineInterpolator();
+
+  void reset();
+
+  /*!
+   * Adds sampled point and appends the finalized part of the curve
+   * @param curve output polyline
+   * */
+  void add_point(Position point, std::vector<Position>& curve);
+
+  /*!
+   * Appends the rest of the curve, called when the stroke ends
+   * @param curve output polyline
+   * */
+  void finish(std::vector<Position>& curve);
+};
+
 class AbstractInstrument {
  public:
   virtual void init(Position pos);
@@ -42,13 +91,25 @@ class AbstractInstrument {
   virtual void apply(Image& canvas, Position point, Position last_point,
                      Color color, uint8_t thickness) = 0;
 
+  /*!
+   * Applies instrument along the path last_point -> points[0] -> ... By
+   * default every segment is applied separately.
+   * */
+  virtual void apply_polyline(Image& canvas,
+                              const std::vector<Position>& points,
+                              Position last_point, Color color,
+                              uint8_t thickness);
+
+  /* stroke instruments get their path smoothed with splines */
+  virtual bool is_stroke_instrument() const;
+
   virtual ~AbstractInstrument();
 };
 
 class AbstractShapeInstrument : public AbstractInstrument {
  private:
-  void default_axis_preparation(int16_t Position::*pos_axis,
-                                int16_t Size::*size_axis);
+  void default_axis_preparation(int32_t Position::*pos_axis,
+                                int32_t Size::*size_axis);
 
  protected:
   DelayedRenderData render_data;
@@ -61,8 +122,13 @@ class AbstractShapeInstrument : public AbstractInstrument {
 class Pencil : public AbstractInstrument {
  public:
   Pencil();
+  virtual bool is_stroke_instrument() const override;
   virtual void apply(Image& canvas, Position point, Position last_point,
                      Color color, uint8_t thickness) override;
+  virtual void apply_polyline(Image& canvas,
+                              const std::vector<Position>& points,
+                              Position last_point, Color color,
+                              uint8_t thickness) override;
 };
 
 class Eraser : public Pencil {
@@ -70,16 +136,35 @@ class Eraser : public Pencil {
   Eraser();
 };
 
+/* flat brush with a square nib 2 * thickness + 1 pixels wide */
 class Brush : public AbstractInstrument {
  public:
+  virtual bool is_stroke_instrument() const override;
   virtual void apply(Image& canvas, Position point, Position last_point,
                      Color color, uint8_t thickness) override;
+  virtual void apply_polyline(Image& canvas,
+                              const std::vector<Position>& points,
+                              Position last_point, Color color,
+                              uint8_t thickness) override;
 };
 
 class Spray : public AbstractInstrument {
+ private:
+  std::minstd_rand randomizer;
+  std::vector<uint8_t> coverage;
+
+  void spray_span(Image& canvas, int x, int y, int length, Color color);
+  /* a single puff, thinning out to the edge like the soft disc does */
+  void spray_stamp(Image& canvas, Position center, int radius, Color color);
+
  public:
+  virtual bool is_stroke_instrument() const override;
   virtual void apply(Image& canvas, Position point, Position last_point,
                      Color color, uint8_t thickness) override;
+  virtual void apply_polyline(Image& canvas,
+                              const std::vector<Position>& points,
+                              Position last_point, Color color,
+                              uint8_t thickness) override;
 };
 
 class Dropper : public AbstractInstrument {
@@ -108,6 +193,222 @@ class Ellipse : public AbstractShapeInstrument {
   friend class InstrumentManager;
 };
 
+/*!
+ * Plugin together with the settings it is applied with. Captured once per
+ * application, so a plugin running on a worker thread does not depend on
+ * the UI changing the current instrument or thickness meanwhile.
+ * */
+struct PluginCall {
+  PluginAPI::Plugin* plugin;
+  /* the same plugin if it implements API v2, nullptr otherwise */
+  PluginAPI::PluginV2* plugin_v2;
+  /* the same plugin if it runs in plugin host processes, nullptr otherwise */
+  RemotePlugin* remote;
+  int plugin_index;
+  /* hash of the plugin properties, including those of chain stages */
+  uint64_t properties_hash;
+  uint8_t thickness;
+  /* set for runs on the downscaled preview proxy, which are not part of the
+   * command progress */
+  bool preview;
+};
+
+/*!
+ * Everything the result of a position independent tile-parallel plugin
+ * depends on: the content of the window, the plugin with its properties and
+ * where the window and the rois of the path are relative to the tile. The
+ * brush position itself is left out, so the same stroke over the same
+ * pixels hits the cache anywhere on the canvas.
+ * */
+struct FilterCacheKey {
+  uint64_t content_hash;
+  uint64_t properties_hash;
+  /* hash of the rois of the path positions, relative to the tile */
+  uint64_t rois_hash;
+  /* plugin index, thickness, window and roi relative to the tile */
+  std::array<int32_t, 10> layout;
+
+  bool operator==(const FilterCacheKey& other) const = default;
+};
+
+struct FilterCacheKeyHash {
+  size_t operator()(const FilterCacheKey& key) const;
+};
+
+/* RGBA pixels of the roi a tile-parallel plugin produced in one tile */
+using FilterResult = std::vector<uint8_t>;
+
+/*!
+ * Results of tile-parallel plugins with CAPABILITY::POSITION_INDEPENDENT,
+ * kept under a memory budget and evicted least recently used first.
+ * Applying such a plugin with the same properties to an unchanged part of a
+ * tile again, e.g. after undoing it or anywhere else on the canvas, takes
+ * the pixels from here without calling the plugin. Brushes depend on where
+ * they are applied, so their results are not cached. Cached results are
+ * shared, so they are never changed in place. Contents are compared by a
+ * 64-bit hash only.
+ * */
+class FilterResultCache {
+ private:
+  using Entry =
+      std::pair<FilterCacheKey, std::shared_ptr<const FilterResult>>;
+
+  static std::mutex cache_mutex;
+  /* the most recently used entries go first */
+  static std::list<Entry> entries;
+  static std::unordered_map<FilterCacheKey, std::list<Entry>::iterator,
+                            FilterCacheKeyHash>
+      entries_index;
+  static size_t budget;
+  /* bytes of pixels in the entries */
+  static size_t size;
+  static size_t hits;
+  static size_t misses;
+
+  static void evict(size_t budget);
+
+ public:
+  /* returns nullptr on a miss */
+  static std::shared_ptr<const FilterResult> find(const FilterCacheKey& key);
+  static void insert(const FilterCacheKey& key,
+                     std::shared_ptr<const FilterResult> result);
+
+  /* 0 disables caching */
+  static void set_budget(size_t bytes);
+  static void clear();
+
+  static size_t get_size();
+  static size_t get_hits();
+  static size_t get_misses();
+
+  FilterResultCache() = delete;
+};
+
+/*!
+ * Applies plugin on a worker thread against a copy-on-write snapshot of the
+ * canvas, so the UI keeps running while a heavy filter works. Mouse events
+ * of the application are queued as commands for the worker. When the worker
+ * is done it sends PluginTaskEvent and the UI thread calls finish(), which
+ * moves the changed tiles into the canvas at once.
+ *
+ * Tile parallel plugins are previewed when the worker falls behind: before
+ * a command runs at full resolution, every command queued after it is
+ * applied to a copy of the canvas downscaled PREVIEW_SCALE times, and the
+ * upscaled result is shown in place of the canvas until finish(). Results
+ * of the commands which ran at full resolution are shown as they are.
+ *
+ * From start() until finish() the plugin belongs to the worker, which sets
+ * the preview scale on it around previews, so the UI thread neither applies
+ * it nor writes its properties meanwhile.
+ * */
+class PluginTask {
+ private:
+  enum COMMAND_TYPE { START, APPLY, STOP };
+
+  struct Command {
+    COMMAND_TYPE type;
+    std::vector<Position> path;
+  };
+
+  /* upscaled preview of a command, in canvas coordinates */
+  struct PreviewPatch {
+    Region region;
+    std::vector<uint8_t> pixels;
+  };
+
+  static const int PREVIEW_SCALE = 4;
+
+  static std::thread worker;
+  static std::mutex commands_mutex;
+  static std::condition_variable commands_condition;
+  static std::deque<Command> commands;
+
+  static PluginCall call;
+  static const Image* target;
+  static std::unique_ptr<Image> base;
+  static std::unique_ptr<Image> result;
+
+  static std::atomic<bool> cancel_requested;
+  static std::atomic<size_t> commands_queued;
+  static std::atomic<size_t> commands_done;
+  static std::atomic<float> command_progress;
+
+  /* the proxy is read and written by the worker only, its tiles are
+   * downscaled from the result when a preview first reaches them */
+  static bool preview_enabled;
+  static size_t commands_previewed;
+  static std::unique_ptr<Image> proxy;
+  static std::vector<bool> proxy_tiles_ready;
+
+  /* patches are handed over to the UI thread, which owns the preview */
+  static std::mutex preview_mutex;
+  static std::vector<PreviewPatch> preview_patches;
+  static std::unique_ptr<Image> preview;
+
+  static void push(Command command);
+  static void worker_loop();
+
+  static void run_preview(const Command& command);
+  static void prepare_proxy(Region proxy_region);
+  static void publish_preview(Region proxy_region);
+  /* shows the full resolution result of command and makes the proxy tiles
+   * under it be downscaled again */
+  static void publish_result(const Command& command);
+  static void reset_preview();
+
+ public:
+  static void start(Image& canvas, const PluginCall& plugin_call,
+                    Position pos);
+  static void apply(const std::vector<Position>& path);
+  static void stop(Position pos);
+
+  /* asks the worker to stop, the result is dropped in finish() */
+  static void cancel();
+  static bool is_cancel_requested();
+
+  /* commits the result into canvas, must be called on PluginTaskEvent */
+  static void finish(Image& canvas);
+  static void deinit();
+
+  /* true from start() until finish() */
+  static bool is_running();
+  static bool is_running_on(const Image& canvas);
+
+  /* upscaled preview to be drawn instead of canvas, nullptr while there is
+   * nothing to show yet, must be called on the UI thread */
+  static Image* get_preview(const Image& canvas);
+
+  /* fraction of the queued work done so far */
+  static float get_progress();
+  static void report_command_progress(float fraction);
+
+  PluginTask() = delete;
+};
+
+/*!
+ * Properties of a loaded plugin which the editor fills in itself. They are
+ * looked up in the plugin property map once, when the plugin is loaded, and
+ * elements of the map never move, so the pointers stay valid while the
+ * plugin is loaded. nullptr means the plugin has no such property.
+ * */
+struct PluginPropertySlots {
+  PluginAPI::Property* primary_color = nullptr;
+  PluginAPI::Property* thickness = nullptr;
+  /* InstrumentManager::properties_version the slots were written at */
+  uint64_t synced_version = 0;
+};
+
+/*!
+ * Filter chain listed in the plugin toolbar. Stages are referred to by
+ * plugin names, so saved chains survive plugins being added or removed.
+ * */
+struct FilterChainEntry {
+  std::vector<std::string> stage_names;
+  /* plugin indices of the stages, filled in when the chain is loaded */
+  std::vector<int> stages;
+  FilterChain chain;
+};
+
 class InstrumentManager {
  private:
   static bool application_started;
@@ -115,28 +416,139 @@ class InstrumentManager {
   static int current_instrument;
 
   static bool plugin_active;
+  static bool plugin_async;
+  static bool plugin_isolation;
 
   static std::vector<std::unique_ptr<AbstractInstrument>> instruments;
+  /* both are nullptr for plugins which are not loaded yet */
   static std::vector<void*> handles;
   static std::vector<PluginAPI::Plugin*> plugins;
+  static std::vector<std::unique_ptr<RemotePlugin>> remote_plugins;
+  /* filters built into the editor, listed after the external plugins */
+  static std::vector<std::unique_ptr<PluginAPI::Plugin>> native_filters;
+  /* nullptr for plugins which are not filter chains */
+  static std::vector<std::unique_ptr<FilterChainEntry>> filter_chains;
+  static std::vector<PluginPropertySlots> property_slots;
+  /* incremented when the color or the thickness actually changes */
+  static uint64_t properties_version;
+  /* hash of the properties the current plugin is applied with */
+  static uint64_t plugin_properties_hash;
+
+  /* guards plugins_info, the plugin vectors and manifest_dirty while the
+   * prewarm thread runs: the UI thread takes it to grow the vectors and to
+   * read what the prewarm thread writes, the prewarm thread for every
+   * access */
+  static std::mutex plugins_mutex;
+  /* set while a thread loads the plugin without holding plugins_mutex,
+   * others wait for plugin_loaded instead of loading it again */
+  static std::vector<bool> plugins_loading;
+  static std::condition_variable plugin_loaded;
+  static std::thread prewarm_thread;
+  static std::atomic<bool> prewarm_stop;
+  static bool manifest_dirty;
 
   static uint8_t thickness;
   static Color color;
 
+  static SplineInterpolator spline;
+  static std::vector<Position> curve_points;
+
+  static void apply_instrument(Image& canvas,
+                               const std::vector<Position>& points);
+
+  /* builds plugins_info from the manifest cache, scanning only plugin
+   * directories whose library changed since the cache was written */
   static void get_plugins();
-  static void load_plugins();
+  static std::vector<PluginInfo> read_plugin_manifest();
+  static void save_plugin_manifest();
+
+  /* dlopens and initializes plugin on first use, returns false if the
+   * plugin can not be loaded */
+  static bool load_plugin(int index);
+  /* both initialize the plugin without holding plugins_mutex, then
+   * publish it under the lock */
+  static bool load_local_plugin(int index, const std::string& lib_path);
+  static bool load_remote_plugin(int index, const std::string& lib_path);
+  /* must be called with plugins_mutex held */
+  static void update_plugin_version(int index, uint32_t api_version);
+  static void prewarm_plugins();
+
+  static void resolve_property_slots(int index);
+
+  /* writes color and thickness into the plugin if they changed since the
+   * last time, only between applications, as a running PluginTask may be
+   * reading the properties */
+  static void sync_plugin_properties(int index);
+  static uint64_t hash_plugin_properties(int index);
+  static void add_native_filter(std::unique_ptr<PluginAPI::Plugin> filter,
+                                const char* name, const char* icon_path);
+
+  /* reads saved chains, which are listed after the native filters */
+  static void load_filter_chains();
+  static int add_filter_chain(const std::string& name,
+                              const std::vector<std::string>& stage_names);
+  /* loads stages of the chain, chains of chains are not supported */
+  static bool load_filter_chain(int index);
+  /* must be called with plugins_mutex held */
+  static int find_plugin(const std::string& name);
+
+  static PluginCall get_plugin_call();
+
+  /* flattens canvas for the plugin, right into shared memory if the plugin
+   * runs in another process */
+  static PluginAPI::Canvas lock_plugin_canvas(const PluginCall& call,
+                                              Image& canvas);
+  static void unlock_plugin_canvas(const PluginCall& call, Image& canvas,
+                                   PluginAPI::Canvas plugin_canvas);
+  static size_t get_buffer_size(Region region);
+
+  /* plugin dispatch, called on the UI thread or on the PluginTask worker */
+  static void run_plugin_start(const PluginCall& call, Image& canvas,
+                               Position pos);
+  static void run_plugin_apply(const PluginCall& call, Image& canvas,
+                               const std::vector<Position>& path);
+  static void run_plugin_stop(const PluginCall& call, Image& canvas,
+                              Position pos);
+
+  /* area of the canvas the plugin brush changes when applied at pos */
+  static Region get_plugin_footprint(const PluginCall& call, Position pos);
+
+  using PluginRegionMethod = void (PluginAPI::PluginV2::*)(
+      PluginAPI::CanvasView, PluginAPI::Rect, PluginAPI::Position);
+
+  /* locks only the window around the path footprint and writes back only
+   * the footprint */
+  static void apply_plugin_region(const PluginCall& call, Image& canvas,
+                                  const std::vector<Position>& path,
+                                  PluginRegionMethod method);
+
+  /* splits footprint of the whole path into image tiles and runs the plugin
+   * on each of them in parallel, every task working on its own copy of the
+   * part of the tile the path touches and the halo around it. Halos show
+   * neighbouring tiles as they were before the path. */
+  static void apply_plugin_tiles(const PluginCall& call, Image& canvas,
+                                 const std::vector<Position>& path);
 
  public:
   static std::vector<PluginInfo> plugins_info;
 
-  static void init();
+  /*!
+   * @param prewarm_plugins load plugins on a background thread right away
+   * instead of waiting for them to be selected
+   * @param isolate_plugins run plugins in plugin_host processes instead of
+   * loading them into the editor
+   * */
+  static void init(bool prewarm_plugins = false, bool isolate_plugins = false);
   static void deinit();
 
-  static void start_applying(Image& canvas, Position pos);
+  /* returns false without starting anything while a PluginTask still owns
+   * the plugins of the previous application */
+  static bool start_applying(Image& canvas, Position pos);
 
   static void stop_applying(Image& canvas, Position pos);
 
   static void apply(Image& canvas, Position pos);
+  static void apply(Image& canvas, const std::vector<Position>& path);
 
   static bool is_applying();
 
@@ -147,7 +559,27 @@ class InstrumentManager {
   static void enable_plugin();
   static void disable_plugin();
 
+  /* loads plugin if needed and makes it the current instrument */
+  static void select_plugin(int index);
+
+  /* plugins run on a worker thread when enabled, see PluginTask */
+  static void set_plugin_async(bool async);
+
+  /*!
+   * Adds chain applying plugins one after another in a single pass
+   * @param stages plugin indices in the order of application
+   * @return plugin index of the chain
+   * */
+  static int create_filter_chain(const std::string& name,
+                                 const std::vector<int>& stages);
+
+  /* saves chain so that it is loaded on the next start */
+  static bool save_filter_chain(int index);
+  static bool is_filter_chain(int index);
+
   static Color get_color();
+
+  friend class PluginTask;
 };
 
 #endif
@@ -13,26 +13,43 @@ CREATE(window, RectWindow, Size(1920, 1080), Position(0, 0),
 CREATE(toolbar_listener, ToolbarListener);
 
 CREATE(pencil_button_sprite, Sprite,
-       Texture("icons/pencil.png", EDITOR_BUTTON_SIZE), Position(15, 910));
+       Texture(ResourceManager::get_icon("icons/pencil.png"),
+               EDITOR_BUTTON_SIZE),
+       Position(15, 910));
 CREATE(eraser_button_sprite, Sprite,
-       Texture("icons/eraser.png", EDITOR_BUTTON_SIZE), Position(15, 980));
+       Texture(ResourceManager::get_icon("icons/eraser.png"),
+               EDITOR_BUTTON_SIZE),
+       Position(15, 980));
 CREATE(save_button_sprite, Sprite,
-       Texture("icons/save.png", EDITOR_BUTTON_SIZE), Position(1515, 15));
+       Texture(ResourceManager::get_icon("icons/save.png"), EDITOR_BUTTON_SIZE),
+       Position(1515, 15));
 CREATE(brush_button_sprite, Sprite,
-       Texture("icons/brush.png", EDITOR_BUTTON_SIZE), Position(85, 910));
+       Texture(ResourceManager::get_icon("icons/brush.png"),
+               EDITOR_BUTTON_SIZE),
+       Position(85, 910));
 CREATE(dropper_button_sprite, Sprite,
-       Texture("icons/dropper.png", EDITOR_BUTTON_SIZE), Position(85, 980));
-CREATE(spray_button_sprite, Sprite, Texture("icons/spray.png", Size(50, 50)),
+       Texture(ResourceManager::get_icon("icons/dropper.png"),
+               EDITOR_BUTTON_SIZE),
+       Position(85, 980));
+CREATE(spray_button_sprite, Sprite,
+       Texture(ResourceManager::get_icon("icons/spray.png"), Size(50, 50)),
        Position(155, 910));
 CREATE(clear_button_sprite, Sprite,
-       Texture("icons/clear.png", EDITOR_BUTTON_SIZE), Position(155, 980));
+       Texture(ResourceManager::get_icon("icons/clear.png"),
+               EDITOR_BUTTON_SIZE),
+       Position(155, 980));
 CREATE(rect_button_sprite, Sprite,
-       Texture("icons/rectangular.png", EDITOR_BUTTON_SIZE),
+       Texture(ResourceManager::get_icon("icons/rectangular.png"),
+               EDITOR_BUTTON_SIZE),
        Position(225, 910));
 CREATE(ellipse_button_sprite, Sprite,
-       Texture("icons/ellipse.png", EDITOR_BUTTON_SIZE), Position(225, 980));
+       Texture(ResourceManager::get_icon("icons/ellipse.png"),
+               EDITOR_BUTTON_SIZE),
+       Position(225, 980));
 CREATE(open_button_sprite, Sprite,
-       Texture("icons/open_file.png", EDITOR_BUTTON_SIZE), Position(1585, 15));
+       Texture(ResourceManager::get_icon("icons/open_file.png"),
+               EDITOR_BUTTON_SIZE),
+       Position(1585, 15));
 
 CREATE(pencil_button_outline, RectWindow, EDITOR_BUTTON_OUTLINE_SIZE,
        Position(10, 905), OUTLINE_COLOR);
@@ -1,6 +1,7 @@
 #include <bits/stdint-uintn.h>
 #include <unistd.h>
 
+#include <cstdlib>
 #include <iostream>
 #include <memory>
 
@@ -15,9 +16,12 @@ int main() {
 
 #include "layouts/main_layout.hpp"
 
-  InstrumentManager::init();
+  /* with ISOLATE_PLUGINS set plugins run in plugin_host processes, so a
+   * crashing plugin does not take the editor down with it */
+  InstrumentManager::init(true, getenv("ISOLATE_PLUGINS") != nullptr);
   App::init(Size(1920, 1080), "Test application");
   App::set_root_window(root_window);
+  App::set_render_stats(getenv("RENDER_STATS") != nullptr);
   App::run();
   App::deinit();
 
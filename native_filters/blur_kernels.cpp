@@ -0,0 +1,303 @@
+#include "blur_kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLUR_KERNELS_X86
+#endif
+
+/* All passes keep exact integer window sums and round sum / window_size the
+ * same way (float multiply, round half to even), so SIMD and scalar versions
+ * give identical results. Sums never exceed 255 * 2^16, which float holds
+ * exactly. */
+
+static inline size_t clamp_index(ptrdiff_t index, size_t size) {
+  return std::clamp<ptrdiff_t>(index, 0, size - 1);
+}
+
+static inline uint8_t average(int32_t sum, float inv_size) {
+  return std::lrint(sum * inv_size);
+}
+
+static void add_rows_scalar(int32_t* sums, const uint8_t* add,
+                            const uint8_t* sub, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    sums[i] += add[i] - (sub ? sub[i] : 0);
+  }
+}
+
+static void average_row_scalar(const int32_t* sums, float inv_size,
+                               uint8_t* dst, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    dst[i] = average(sums[i], inv_size);
+  }
+}
+
+#ifdef BLUR_KERNELS_X86
+
+static inline __m128i load_pixel_sse2(const uint8_t* pixel) {
+  int32_t value = 0;
+  memcpy(&value, pixel, 4);
+  __m128i zero = _mm_setzero_si128();
+  return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(value), zero),
+                            zero);
+}
+
+static inline __m128i average_lanes_sse2(__m128i sums, __m128 inv_size) {
+  return _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sums), inv_size));
+}
+
+/* one pixel per register: the window slides sequentially along the row,
+ * so the four channels are the only independent lanes here */
+static void box_blur_row_sse2(const uint8_t* src, uint8_t* dst, size_t width,
+                              int radius, float inv_size) {
+  __m128 inv = _mm_set1_ps(inv_size);
+  __m128i sums = _mm_setzero_si128();
+
+  for (ptrdiff_t k = -radius; k <= radius; ++k) {
+    sums =
+        _mm_add_epi32(sums, load_pixel_sse2(src + clamp_index(k, width) * 4));
+  }
+
+  for (size_t x = 0; x < width; ++x) {
+    __m128i value = average_lanes_sse2(sums, inv);
+    value = _mm_packus_epi16(_mm_packs_epi32(value, value), value);
+    int32_t pixel = _mm_cvtsi128_si32(value);
+    memcpy(dst + x * 4, &pixel, 4);
+
+    size_t add = clamp_index(ptrdiff_t(x) + radius + 1, width);
+    size_t sub = clamp_index(ptrdiff_t(x) - radius, width);
+    sums = _mm_add_epi32(sums, _mm_sub_epi32(load_pixel_sse2(src + add * 4),
+                                             load_pixel_sse2(src + sub * 4)));
+  }
+}
+
+static void add_rows_sse2(int32_t* sums, const uint8_t* add,
+                          const uint8_t* sub, size_t count) {
+  __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    __m128i add_bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(add + i));
+    __m128i sub_bytes =
+        sub ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(sub + i))
+            : zero;
+    /* differences of bytes fit into signed 16-bit lanes */
+    __m128i diff[2] = {
+        _mm_sub_epi16(_mm_unpacklo_epi8(add_bytes, zero),
+                      _mm_unpacklo_epi8(sub_bytes, zero)),
+        _mm_sub_epi16(_mm_unpackhi_epi8(add_bytes, zero),
+                      _mm_unpackhi_epi8(sub_bytes, zero))};
+
+    for (int half = 0; half < 2; ++half) {
+      __m128i sign = _mm_srai_epi16(diff[half], 15);
+      __m128i* lanes = reinterpret_cast<__m128i*>(sums + i + half * 8);
+      _mm_storeu_si128(lanes,
+                       _mm_add_epi32(_mm_loadu_si128(lanes),
+                                     _mm_unpacklo_epi16(diff[half], sign)));
+      _mm_storeu_si128(lanes + 1,
+                       _mm_add_epi32(_mm_loadu_si128(lanes + 1),
+                                     _mm_unpackhi_epi16(diff[half], sign)));
+    }
+  }
+
+  add_rows_scalar(sums + i, add + i, sub ? sub + i : nullptr, count - i);
+}
+
+static void average_row_sse2(const int32_t* sums, float inv_size,
+                             uint8_t* dst, size_t count) {
+  __m128 inv = _mm_set1_ps(inv_size);
+  size_t i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    const __m128i* lanes = reinterpret_cast<const __m128i*>(sums + i);
+    __m128i lo = _mm_packs_epi32(
+        average_lanes_sse2(_mm_loadu_si128(lanes), inv),
+        average_lanes_sse2(_mm_loadu_si128(lanes + 1), inv));
+    __m128i hi = _mm_packs_epi32(
+        average_lanes_sse2(_mm_loadu_si128(lanes + 2), inv),
+        average_lanes_sse2(_mm_loadu_si128(lanes + 3), inv));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_packus_epi16(lo, hi));
+  }
+
+  average_row_scalar(sums + i, inv_size, dst + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void add_rows_avx2(int32_t* sums,
+                                                          const uint8_t* add,
+                                                          const uint8_t* sub,
+                                                          size_t count) {
+  size_t i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m256i* lanes = reinterpret_cast<__m256i*>(sums + i);
+    __m256i value = _mm256_cvtepu8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(add + i)));
+    if (sub) {
+      value = _mm256_sub_epi32(
+          value, _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+                     reinterpret_cast<const __m128i*>(sub + i))));
+    }
+    _mm256_storeu_si256(lanes,
+                        _mm256_add_epi32(_mm256_loadu_si256(lanes), value));
+  }
+
+  add_rows_scalar(sums + i, add + i, sub ? sub + i : nullptr, count - i);
+}
+
+__attribute__((target("avx2"))) static void average_row_avx2(
+    const int32_t* sums, float inv_size, uint8_t* dst, size_t count) {
+  __m256 inv = _mm256_set1_ps(inv_size);
+  size_t i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    const __m256i* lanes = reinterpret_cast<const __m256i*>(sums + i);
+    __m256i lo = _mm256_cvtps_epi32(
+        _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256(lanes)), inv));
+    __m256i hi = _mm256_cvtps_epi32(
+        _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256(lanes + 1)), inv));
+    /* pack works inside 128-bit lanes, permute restores the order */
+    __m256i words =
+        _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_packus_epi16(_mm256_castsi256_si128(words),
+                                      _mm256_extracti128_si256(words, 1)));
+  }
+
+  average_row_sse2(sums + i, inv_size, dst + i, count - i);
+}
+
+static const bool HAS_AVX2 = __builtin_cpu_supports("avx2");
+
+static void box_blur_row(const uint8_t* src, uint8_t* dst, size_t width,
+                         int radius, float inv_size) {
+  box_blur_row_sse2(src, dst, width, radius, inv_size);
+}
+
+static void add_rows(int32_t* sums, const uint8_t* add, const uint8_t* sub,
+                     size_t count) {
+  if (HAS_AVX2) {
+    add_rows_avx2(sums, add, sub, count);
+  } else {
+    add_rows_sse2(sums, add, sub, count);
+  }
+}
+
+static void average_row(const int32_t* sums, float inv_size, uint8_t* dst,
+                        size_t count) {
+  if (HAS_AVX2) {
+    average_row_avx2(sums, inv_size, dst, count);
+  } else {
+    average_row_sse2(sums, inv_size, dst, count);
+  }
+}
+
+#else
+
+static void box_blur_row(const uint8_t* src, uint8_t* dst, size_t width,
+                         int radius, float inv_size) {
+  int32_t sums[4] = {};
+
+  for (ptrdiff_t k = -radius; k <= radius; ++k) {
+    const uint8_t* pixel = src + clamp_index(k, width) * 4;
+    for (int channel = 0; channel < 4; ++channel) {
+      sums[channel] += pixel[channel];
+    }
+  }
+
+  for (size_t x = 0; x < width; ++x) {
+    for (int channel = 0; channel < 4; ++channel) {
+      dst[x * 4 + channel] = average(sums[channel], inv_size);
+    }
+
+    const uint8_t* add =
+        src + clamp_index(ptrdiff_t(x) + radius + 1, width) * 4;
+    const uint8_t* sub = src + clamp_index(ptrdiff_t(x) - radius, width) * 4;
+    for (int channel = 0; channel < 4; ++channel) {
+      sums[channel] += add[channel] - sub[channel];
+    }
+  }
+}
+
+static void add_rows(int32_t* sums, const uint8_t* add, const uint8_t* sub,
+                     size_t count) {
+  add_rows_scalar(sums, add, sub, count);
+}
+
+static void average_row(const int32_t* sums, float inv_size, uint8_t* dst,
+                        size_t count) {
+  average_row_scalar(sums, inv_size, dst, count);
+}
+
+#endif
+
+void box_blur_horizontal(const uint8_t* src, size_t src_stride, uint8_t* dst,
+                         size_t dst_stride, size_t width, size_t height,
+                         int radius) {
+  if (width == 0) {
+    return;
+  }
+
+  float inv_size = 1.0f / (2 * radius + 1);
+  for (size_t y = 0; y < height; ++y) {
+    box_blur_row(src + y * src_stride, dst + y * dst_stride, width, radius,
+                 inv_size);
+  }
+}
+
+void box_blur_vertical(const uint8_t* src, size_t src_stride, uint8_t* dst,
+                       size_t dst_stride, size_t width, size_t height,
+                       int radius) {
+  if (width == 0 || height == 0) {
+    return;
+  }
+
+  size_t count = width * 4;
+  /* one running sum per channel of the row */
+  thread_local std::vector<int32_t> sums;
+  sums.assign(count, 0);
+
+  for (ptrdiff_t k = -radius; k <= radius; ++k) {
+    add_rows(sums.data(), src + clamp_index(k, height) * src_stride, nullptr,
+             count);
+  }
+
+  float inv_size = 1.0f / (2 * radius + 1);
+  for (size_t y = 0; y < height; ++y) {
+    average_row(sums.data(), inv_size, dst + y * dst_stride, count);
+
+    if (y + 1 < height) {
+      size_t add = clamp_index(ptrdiff_t(y) + radius + 1, height);
+      size_t sub = clamp_index(ptrdiff_t(y) - radius, height);
+      add_rows(sums.data(), src + add * src_stride, src + sub * src_stride,
+               count);
+    }
+  }
+}
+
+void gaussian_box_radii(double sigma, int passes, int* radii) {
+  /* widths of passes boxes whose combined variance is the closest to
+   * sigma^2, using two neighbouring odd widths */
+  double variance = 12 * sigma * sigma;
+  int lower = std::sqrt(variance / passes + 1);
+  if (lower % 2 == 0) {
+    --lower;
+  }
+  lower = std::max(lower, 1);
+
+  double lower_count =
+      (variance - passes * lower * lower - 4.0 * passes * lower - 3 * passes) /
+      (-4.0 * lower - 4);
+  int rounded_count = std::lround(lower_count);
+
+  for (int i = 0; i < passes; ++i) {
+    int width = i < rounded_count ? lower : lower + 2;
+    radii[i] = (width - 1) / 2;
+  }
+}
@@ -0,0 +1,47 @@
+#ifndef BLUR_KERNELS_HPP
+#define BLUR_KERNELS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/*!
+ * Sliding-window box blur passes over RGBA buffers, O(1) per pixel
+ * regardless of the radius. Pixels outside of the buffer are taken equal to
+ * the nearest edge pixel. The vertical pass keeps one running sum per
+ * channel of the whole row and is vectorized across the row (AVX2 when the
+ * CPU supports it, SSE2 otherwise); the horizontal pass keeps the four
+ * channel sums of one pixel in a SSE2 register. Plain loops are used on
+ * other architectures.
+ * */
+
+/*!
+ * Averages every pixel with radius pixels to the left and to the right
+ * @param src source rows, may not alias dst
+ * @param src_stride distance between source rows in bytes
+ * @param dst destination rows
+ * @param dst_stride distance between destination rows in bytes
+ * @param width pixels in a row
+ * @param height number of rows
+ * @param radius half of the window size, 0 copies the rows
+ * */
+void box_blur_horizontal(const uint8_t* src, size_t src_stride, uint8_t* dst,
+                         size_t dst_stride, size_t width, size_t height,
+                         int radius);
+
+/*!
+ * Averages every pixel with radius pixels above and below, parameters are
+ * the same as in box_blur_horizontal()
+ * */
+void box_blur_vertical(const uint8_t* src, size_t src_stride, uint8_t* dst,
+                       size_t dst_stride, size_t width, size_t height,
+                       int radius);
+
+/*!
+ * Radii of passes box blurs which together approximate Gaussian blur
+ * @param sigma standard deviation of the Gaussian
+ * @param passes number of box passes
+ * @param radii receives passes radii
+ * */
+void gaussian_box_radii(double sigma, int passes, int* radii);
+
+#endif
@@ -0,0 +1,138 @@
+#include "native_filters.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "blur_kernels.hpp"
+
+const int MAX_BLUR_RADIUS = 64;
+const int DEFAULT_BLUR_RADIUS = 3;
+const double MAX_BLUR_SIGMA = 32;
+const double DEFAULT_BLUR_SIGMA = 2;
+
+bool NativeBlurFilter::deinit() { return true; }
+
+void NativeBlurFilter::start_apply_region(PluginAPI::CanvasView canvas,
+                                          PluginAPI::Rect roi,
+                                          PluginAPI::Position pos) {
+  apply_region(canvas, roi, pos);
+}
+
+void NativeBlurFilter::apply_region(PluginAPI::CanvasView canvas,
+                                    PluginAPI::Rect roi,
+                                    PluginAPI::Position /*pos*/) {
+  int radii[MAX_PASSES] = {};
+  int passes_count = get_pass_radii(radii);
+
+  blur(canvas, roi, radii, passes_count);
+}
+
+void NativeBlurFilter::stop_apply_region(PluginAPI::CanvasView /*canvas*/,
+                                         PluginAPI::Rect /*roi*/,
+                                         PluginAPI::Position /*pos*/) {}
+
+uint32_t NativeBlurFilter::get_capabilities() {
+  return PluginAPI::CAPABILITY::TILE_PARALLEL |
+         PluginAPI::CAPABILITY::POSITION_INDEPENDENT;
+}
+
+void NativeBlurFilter::set_preview_scale(double scale) {
+  preview_scale = scale;
+}
+
+int64_t NativeBlurFilter::get_halo() {
+  int radii[MAX_PASSES] = {};
+  int passes_count = get_pass_radii(radii);
+
+  /* every pass reads radius pixels further from roi than the previous one */
+  int64_t halo = 0;
+  for (int i = 0; i < passes_count; ++i) {
+    halo += radii[i];
+  }
+
+  return halo;
+}
+
+void NativeBlurFilter::blur(PluginAPI::CanvasView canvas, PluginAPI::Rect roi,
+                            const int* radii, int passes_count) {
+  int64_t halo = 0;
+  for (int i = 0; i < passes_count; ++i) {
+    halo += radii[i];
+  }
+
+  /* only the part of the window roi depends on is processed */
+  int64_t left = std::max(roi.x - halo, canvas.x);
+  int64_t top = std::max(roi.y - halo, canvas.y);
+  int64_t right = std::min<int64_t>(roi.x + roi.width + halo,
+                                    canvas.x + canvas.width);
+  int64_t bottom = std::min<int64_t>(roi.y + roi.height + halo,
+                                     canvas.y + canvas.height);
+  if (right <= left || bottom <= top || roi.width <= 0 || roi.height <= 0) {
+    return;
+  }
+
+  size_t width = right - left;
+  size_t height = bottom - top;
+  size_t stride = width * 4;
+
+  /* passes ping-pong between two buffers, the result is in pixels */
+  thread_local std::vector<uint8_t> pixels;
+  thread_local std::vector<uint8_t> temporary;
+  pixels.resize(stride * height);
+  temporary.resize(stride * height);
+
+  for (size_t y = 0; y < height; ++y) {
+    memcpy(pixels.data() + y * stride, canvas.at(left, top + y), stride);
+  }
+
+  for (int i = 0; i < passes_count; ++i) {
+    box_blur_horizontal(pixels.data(), stride, temporary.data(), stride, width,
+                        height, radii[i]);
+    box_blur_vertical(temporary.data(), stride, pixels.data(), stride, width,
+                      height, radii[i]);
+  }
+
+  for (int64_t y = roi.y; y < roi.y + roi.height; ++y) {
+    memcpy(canvas.at(roi.x, y),
+           pixels.data() + (y - top) * stride + (roi.x - left) * 4,
+           roi.width * 4);
+  }
+}
+
+bool BoxBlurFilter::init() {
+  PluginAPI::Property radius = {};
+  radius.display_type = PluginAPI::Property::SLIDER;
+  radius.label = "Radius";
+  radius.int_value = DEFAULT_BLUR_RADIUS;
+
+  properties[BLUR_RADIUS] = radius;
+  return true;
+}
+
+int BoxBlurFilter::get_pass_radii(int* radii) {
+  int radius =
+      std::clamp(properties.at(BLUR_RADIUS).int_value, 0, MAX_BLUR_RADIUS);
+
+  radii[0] = std::lround(radius * preview_scale);
+  return 1;
+}
+
+bool GaussianBlurFilter::init() {
+  PluginAPI::Property sigma = {};
+  sigma.display_type = PluginAPI::Property::SLIDER;
+  sigma.label = "Sigma";
+  sigma.double_value = DEFAULT_BLUR_SIGMA;
+
+  properties[BLUR_SIGMA] = sigma;
+  return true;
+}
+
+int GaussianBlurFilter::get_pass_radii(int* radii) {
+  double sigma =
+      std::clamp(properties.at(BLUR_SIGMA).double_value, 0.0, MAX_BLUR_SIGMA);
+
+  gaussian_box_radii(sigma * preview_scale, MAX_PASSES, radii);
+  return MAX_PASSES;
+}
@@ -0,0 +1,79 @@
+#ifndef NATIVE_FILTERS_HPP
+#define NATIVE_FILTERS_HPP
+
+#include <cstdint>
+
+#include "../plugin_api/api.hpp"
+
+/* own properties of the native filters, numbered after the common ones */
+const PluginAPI::TYPE::Type BLUR_RADIUS =
+    PluginAPI::TYPE::Type(PluginAPI::TYPE::COUNT);
+const PluginAPI::TYPE::Type BLUR_SIGMA =
+    PluginAPI::TYPE::Type(PluginAPI::TYPE::COUNT + 1);
+
+/*!
+ * Blur filters built into the editor. They implement plugin API v2 just like
+ * external plugins, so they are listed in the same plugin toolbar and applied
+ * tile-parallel, and serve as a reference and a benchmark baseline for blur
+ * plugins. Every press or move of the mouse blurs the brush footprint (roi)
+ * with a sequence of box passes, see blur_kernels.hpp.
+ * */
+class NativeBlurFilter : public PluginAPI::PluginV2 {
+ public:
+  static const int MAX_PASSES = 3;
+
+  bool deinit() override;
+
+  void start_apply_region(PluginAPI::CanvasView canvas, PluginAPI::Rect roi,
+                          PluginAPI::Position pos) override;
+  void apply_region(PluginAPI::CanvasView canvas, PluginAPI::Rect roi,
+                    PluginAPI::Position pos) override;
+  void stop_apply_region(PluginAPI::CanvasView canvas, PluginAPI::Rect roi,
+                         PluginAPI::Position pos) override;
+
+  uint32_t get_capabilities() override;
+  int64_t get_halo() override;
+  void set_preview_scale(double scale) override;
+
+  /*!
+   * Blurs roi of the canvas with box passes of the given radii. Pixels of the
+   * window around roi are read, pixels outside of the window are taken equal
+   * to the nearest window pixel.
+   * @param radii radius of every pass, horizontal and vertical
+   * @param passes_count number of passes, at most MAX_PASSES
+   * */
+  static void blur(PluginAPI::CanvasView canvas, PluginAPI::Rect roi,
+                   const int* radii, int passes_count);
+
+ protected:
+  /* radii are multiplied by it while the editor builds a preview */
+  double preview_scale = 1;
+
+  /* fills radii with the current passes, returns their number */
+  virtual int get_pass_radii(int* radii) = 0;
+};
+
+/*!
+ * Single box pass, radius is the BLUR_RADIUS property
+ * */
+class BoxBlurFilter : public NativeBlurFilter {
+ protected:
+  int get_pass_radii(int* radii) override;
+
+ public:
+  bool init() override;
+};
+
+/*!
+ * Gaussian blur with the BLUR_SIGMA standard deviation approximated by three
+ * box passes
+ * */
+class GaussianBlurFilter : public NativeBlurFilter {
+ protected:
+  int get_pass_radii(int* radii) override;
+
+ public:
+  bool init() override;
+};
+
+#endif
@@ -10,6 +10,13 @@
 
 namespace PluginAPI {
 
+/* Версия API, описанная в этом файле. Плагины, реализующие PluginV2,
+ * должны сообщить её редактору через get_plugin_api_version(),
+ * плагины без этой функции считаются плагинами версии 1 */
+constexpr uint32_t API_VERSION = 2;
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
 /*  Структура используется для передачи плагину доступа к вашему
  *  канвасу в момент применения плагина. Не храните в ней владеющий
  *  указатель на массив пикселей.
@@ -30,6 +37,67 @@ struct Position {
 
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
+/* Прямоугольник в координатах канваса */
+struct Rect {
+    int64_t x;
+    int64_t y;
+    int64_t width;
+    int64_t height;
+};
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/* Формат пикселя в окне канваса. Сейчас редактор передаёт только RGBA8888:
+ * четыре байта на пиксель в порядке r, g, b, a */
+enum PIXEL_FORMAT : uint32_t { RGBA8888 = 0 };
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*  Окно канваса, передаваемое плагинам версии 2. Окно покрывает
+ *  прямоугольник (x, y, width, height) канваса размера
+ *  canvas_width x canvas_height, pixels указывает на его левый верхний
+ *  пиксель, а соседние строки отстоят друг от друга на stride байт.
+ *  Окно содержит область применения и пиксели вокруг неё, которые
+ *  можно читать, но не следует изменять.
+ */
+struct CanvasView {
+    uint8_t* pixels;
+
+    size_t height;
+    size_t width;
+    size_t stride;
+
+    int64_t x;
+    int64_t y;
+
+    size_t canvas_height;
+    size_t canvas_width;
+
+    /* Поле добавлено последним, чтобы не сдвигать остальные поля */
+    PIXEL_FORMAT format;
+
+    /* Адрес пикселя по координатам канваса, точка должна лежать в окне */
+    uint8_t* at(int64_t canvas_x, int64_t canvas_y) const {
+        return pixels + (canvas_y - y) * stride + (canvas_x - x) * 4;
+    }
+
+    /* Окно на часть этого окна без копирования пикселей, rect задаётся
+     * в координатах канваса и должен лежать в окне */
+    CanvasView crop(Rect rect) const {
+        CanvasView view = *this;
+
+        view.pixels = at(rect.x, rect.y);
+        view.x = rect.x;
+        view.y = rect.y;
+        view.width = rect.width;
+        view.height = rect.height;
+
+        return view;
+    }
+};
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
 struct Property {
     /* если вашему плагину требуются собственные свойства, то вы
        должны нумеровать их начиная с COUNT, в противном случае,
@@ -126,6 +194,86 @@ class Plugin {
 
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
+/* Флаги возможностей плагина, возвращаемые PluginV2::get_capabilities() */
+namespace CAPABILITY {
+/* apply_region() можно вызывать одновременно из нескольких потоков для
+ * непересекающихся roi. Каждый вызов получает собственное окно, в котором
+ * вокруг roi доступно не меньше get_halo() пикселей (в пределах канваса).
+ * Такой плагин не должен изменять своё состояние в apply_region() */
+constexpr uint32_t TILE_PARALLEL = 1 << 0;
+/* Результат apply_region() зависит только от пикселей окна, положения roi
+ * в нём и свойств плагина, но не от pos, как у фильтров. Только такие
+ * результаты редактор может переиспользовать для других позиций кисти */
+constexpr uint32_t POSITION_INDEPENDENT = 1 << 1;
+};  // namespace CAPABILITY
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/* Плагин версии 2 получает вместо всего канваса окно вокруг области,
+ * которую затрагивает кисть (roi), и должен изменять пиксели только
+ * внутри roi. Остальные пиксели окна редактор не восстанавливает: у
+ * плагина без TILE_PARALLEL их изменения попадут в канвас, а у плагина с
+ * TILE_PARALLEL будут отброшены. Методы версии 1 реализованы через методы
+ * версии 2, поэтому такой плагин работает и в редакторах, знающих только
+ * версию 1 */
+class PluginV2 : public Plugin {
+   public:
+    virtual void start_apply_region(CanvasView canvas, Rect roi,
+                                    Position pos) = 0;
+
+    virtual void apply_region(CanvasView canvas, Rect roi, Position pos) = 0;
+
+    virtual void stop_apply_region(CanvasView canvas, Rect roi,
+                                   Position pos) = 0;
+
+    /* Комбинация флагов CAPABILITY */
+    virtual uint32_t get_capabilities() { return 0; }
+
+    /* Сколько пикселей вокруг roi плагин читает при текущих значениях
+     * свойств, например радиус размытия */
+    virtual int64_t get_halo() { return 0; }
+
+    /* Редактор может сначала применить плагин к уменьшенной копии канваса,
+     * чтобы быстро показать предварительный результат. Перед этим он
+     * вызывает set_preview_scale() с коэффициентом уменьшения (например,
+     * 0.25), а после -- с 1. Плагин должен умножать на него все свойства,
+     * измеряемые в пикселях, включая THICKNESS. Вызывается только для
+     * плагинов с TILE_PARALLEL и никогда во время apply_region() */
+    virtual void set_preview_scale(double /*scale*/) {}
+
+    void start_apply(Canvas canvas, Position pos) override {
+        start_apply_region(full_view(canvas), full_rect(canvas), pos);
+    }
+
+    void apply(Canvas canvas, Position pos) override {
+        apply_region(full_view(canvas), full_rect(canvas), pos);
+    }
+
+    void stop_apply(Canvas canvas, Position pos) override {
+        stop_apply_region(full_view(canvas), full_rect(canvas), pos);
+    }
+
+   private:
+    static CanvasView full_view(Canvas canvas) {
+        CanvasView view = {};
+
+        view.pixels = canvas.pixels;
+        view.height = view.canvas_height = canvas.height;
+        view.width = view.canvas_width = canvas.width;
+        view.stride = canvas.width * 4;
+        view.format = RGBA8888;
+
+        return view;
+    }
+
+    static Rect full_rect(Canvas canvas) {
+        return {0, 0, static_cast<int64_t>(canvas.width),
+                static_cast<int64_t>(canvas.height)};
+    }
+};
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
 /* Функция для создания в статической области памяти объекта плагина.
  * Удобно использовать для определения функции get()
  */
@@ -144,6 +292,17 @@ PluginAPI::Plugin* get_instance() {
  * для доступа к объекту плагина */
 extern "C" PluginAPI::Plugin* get_plugin();
 
+/* Необязательная функция, возвращающая версию API плагина. Если её нет,
+ * плагин считается плагином версии 1. Плагин версии 2 должен вернуть
+ * объект PluginV2 из get_plugin() и определить эту функцию с помощью
+ * PLUGIN_API_EXPORT_VERSION */
+extern "C" uint32_t get_plugin_api_version();
+
+#define PLUGIN_API_EXPORT_VERSION                    \
+    extern "C" uint32_t get_plugin_api_version() {   \
+        return PluginAPI::API_VERSION;               \
+    }
+
 ////////////////////////////////////////////////////////////////////////////////
 /*============================================================================*/
 
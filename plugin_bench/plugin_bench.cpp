@@ -0,0 +1,419 @@
+/*!
+ * Headless plugin benchmark. Loads every plugin library from the plugins
+ * directory together with the native filters, applies strokes of
+ * start_apply(), apply() and stop_apply() calls to a synthetic canvas and
+ * prints JSON with the throughput, call latency percentiles and peak memory
+ * of every plugin. Plugins are driven through the API v1 interface, so every
+ * call gets the whole canvas, and the throughput is the number of canvas
+ * pixels handed to the plugin per second. Exits with 1 if some plugin can
+ * not be loaded.
+ *
+ * usage: plugin_bench [--plugins <directory>] [--width <pixels>]
+ *                     [--height <pixels>] [--strokes <count>]
+ *                     [--moves <count>] [--thickness <pixels>]
+ *                     [--output <file>]
+ * */
+
+#include <dlfcn.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../native_filters/native_filters.hpp"
+#include "../plugin_api/api.hpp"
+
+const uint32_t BENCH_COLOR = 0xFF3366CC;
+const unsigned BENCH_SEED = 1;
+const long MAX_CANVAS_SIZE = 1 << 15;
+const long MAX_CALLS = 1 << 20;
+
+struct BenchConfig {
+  std::string plugins_path = "plugins";
+  std::string output_path;
+  size_t width = 1920;
+  size_t height = 1080;
+  int strokes = 10;
+  int moves = 20;
+  int thickness = 10;
+};
+
+struct BenchResult {
+  std::string name;
+  std::string library;
+  std::string error;
+  uint32_t api_version = 0;
+  size_t calls = 0;
+  double seconds = 0;
+  /* latency of a single call in microseconds, sorted */
+  std::vector<double> latencies;
+  long peak_memory_kb = 0;
+};
+
+static void print_usage() {
+  fprintf(stderr,
+          "usage: plugin_bench [--plugins <directory>] [--width <pixels>]\n"
+          "                    [--height <pixels>] [--strokes <count>]\n"
+          "                    [--moves <count>] [--thickness <pixels>]\n"
+          "                    [--output <file>]\n");
+}
+
+static bool parse_number(const char* text, long min, long max, long& value) {
+  char* end = nullptr;
+  value = strtol(text, &end, 10);
+  return *text && !*end && value >= min && value <= max;
+}
+
+static bool parse_args(int argc, char** argv, BenchConfig& config) {
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 == argc) return false;
+
+    const char* option = argv[i];
+    const char* value = argv[++i];
+    long number = 0;
+
+    if (!strcmp(option, "--plugins")) {
+      config.plugins_path = value;
+    } else if (!strcmp(option, "--output")) {
+      config.output_path = value;
+    } else if (!strcmp(option, "--width") &&
+               parse_number(value, 1, MAX_CANVAS_SIZE, number)) {
+      config.width = number;
+    } else if (!strcmp(option, "--height") &&
+               parse_number(value, 1, MAX_CANVAS_SIZE, number)) {
+      config.height = number;
+    } else if (!strcmp(option, "--strokes") &&
+               parse_number(value, 1, MAX_CALLS, number)) {
+      config.strokes = number;
+    } else if (!strcmp(option, "--moves") &&
+               parse_number(value, 0, MAX_CALLS, number)) {
+      config.moves = number;
+    } else if (!strcmp(option, "--thickness") &&
+               parse_number(value, 1, UINT8_MAX, number)) {
+      config.thickness = number;
+    } else {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* peak resident memory since the last reset_peak_memory() */
+static long get_peak_memory_kb() {
+  FILE* status = fopen("/proc/self/status", "r");
+  if (status) {
+    char line[256] = {};
+    long peak = -1;
+
+    while (fgets(line, sizeof(line), status)) {
+      if (sscanf(line, "VmHWM: %ld", &peak) == 1) break;
+    }
+
+    fclose(status);
+    if (peak >= 0) return peak;
+  }
+
+  /* without procfs only the peak of the whole run is known */
+  rusage usage = {};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static void reset_peak_memory() {
+  FILE* clear_refs = fopen("/proc/self/clear_refs", "w");
+  if (!clear_refs) return;
+
+  fputs("5", clear_refs);
+  fclose(clear_refs);
+}
+
+/* gradient with noise, so that filters can not take shortcuts on flat
+ * areas */
+static void fill_canvas(std::vector<uint8_t>& pixels, size_t width,
+                        size_t height) {
+  std::minstd_rand randomizer(BENCH_SEED);
+
+  for (size_t y = 0; y < height; ++y) {
+    for (size_t x = 0; x < width; ++x) {
+      uint8_t* pixel = pixels.data() + (y * width + x) * 4;
+      uint8_t noise = randomizer() & 0x3F;
+
+      pixel[0] = x * 255 / width ^ noise;
+      pixel[1] = y * 255 / height ^ noise;
+      pixel[2] = (x + y) & 0xFF;
+      pixel[3] = 255;
+    }
+  }
+}
+
+static void set_properties(PluginAPI::Plugin* plugin,
+                           const BenchConfig& config) {
+  for (auto& property : plugin->properties) {
+    if (property.first == PluginAPI::TYPE::PRIMARY_COLOR) {
+      property.second.int_value = BENCH_COLOR;
+    } else if (property.first == PluginAPI::TYPE::THICKNESS) {
+      property.second.int_value = config.thickness;
+    }
+  }
+}
+
+template <typename Call>
+static void time_call(BenchResult& result, Call call) {
+  auto start = std::chrono::steady_clock::now();
+  call();
+  std::chrono::duration<double> duration =
+      std::chrono::steady_clock::now() - start;
+
+  result.seconds += duration.count();
+  result.latencies.push_back(duration.count() * 1e6);
+  ++result.calls;
+}
+
+static void run_strokes(PluginAPI::Plugin* plugin, const BenchConfig& config,
+                        int strokes, BenchResult* result) {
+  std::vector<uint8_t> pixels(config.width * config.height * 4);
+  fill_canvas(pixels, config.width, config.height);
+
+  PluginAPI::Canvas canvas = {pixels.data(), config.height, config.width};
+  std::minstd_rand randomizer(BENCH_SEED);
+
+  auto random_position = [&]() {
+    return PluginAPI::Position{
+        static_cast<int64_t>(randomizer() % config.width),
+        static_cast<int64_t>(randomizer() % config.height)};
+  };
+
+  /* results of the warm-up stroke are not recorded */
+  BenchResult warm_up;
+  BenchResult& target = result ? *result : warm_up;
+
+  for (int stroke = 0; stroke < strokes; ++stroke) {
+    PluginAPI::Position pos = random_position();
+    time_call(target, [&]() { plugin->start_apply(canvas, pos); });
+
+    for (int move = 0; move < config.moves; ++move) {
+      pos = random_position();
+      time_call(target, [&]() { plugin->apply(canvas, pos); });
+    }
+
+    time_call(target, [&]() { plugin->stop_apply(canvas, pos); });
+  }
+}
+
+static void bench_plugin(PluginAPI::Plugin* plugin, const BenchConfig& config,
+                         BenchResult& result) {
+  set_properties(plugin, config);
+  run_strokes(plugin, config, 1, nullptr);
+
+  reset_peak_memory();
+  run_strokes(plugin, config, config.strokes, &result);
+  result.peak_memory_kb = get_peak_memory_kb();
+
+  std::sort(result.latencies.begin(), result.latencies.end());
+}
+
+static BenchResult bench_library(const std::filesystem::path& plugin_path,
+                                 const BenchConfig& config) {
+  BenchResult result;
+  result.name = plugin_path.filename().string();
+
+  std::error_code error;
+  for (auto& plugin_asset :
+       std::filesystem::directory_iterator(plugin_path, error)) {
+    if (plugin_asset.path().filename().string().ends_with(".so")) {
+      result.library = plugin_asset.path().string();
+    }
+  }
+
+  if (result.library.empty()) {
+    result.error = "no plugin library";
+    return result;
+  }
+
+  void* handle = dlopen(result.library.data(), RTLD_NOW);
+  if (!handle) {
+    result.error = dlerror();
+    return result;
+  }
+
+  PluginAPI::Plugin* (*get_plugin)() =
+      reinterpret_cast<PluginAPI::Plugin* (*)()>(dlsym(handle, "get_plugin"));
+  if (!get_plugin) {
+    result.error = "no get_plugin()";
+    dlclose(handle);
+    return result;
+  }
+
+  result.api_version = 1;
+  uint32_t (*get_plugin_api_version)() = reinterpret_cast<uint32_t (*)()>(
+      dlsym(handle, "get_plugin_api_version"));
+  if (get_plugin_api_version) {
+    result.api_version = get_plugin_api_version();
+  }
+
+  auto plugin = get_plugin();
+  plugin->init();
+  bench_plugin(plugin, config, result);
+  plugin->deinit();
+
+  dlclose(handle);
+  return result;
+}
+
+static BenchResult bench_native(std::unique_ptr<PluginAPI::Plugin> plugin,
+                                const char* name, const BenchConfig& config) {
+  BenchResult result;
+  result.name = name;
+  result.api_version = PluginAPI::API_VERSION;
+
+  plugin->init();
+  bench_plugin(plugin.get(), config, result);
+  plugin->deinit();
+
+  return result;
+}
+
+static void print_string(FILE* output, const std::string& text) {
+  fputc('"', output);
+
+  for (unsigned char symbol : text) {
+    if (symbol == '"' || symbol == '\\') {
+      fprintf(output, "\\%c", symbol);
+    } else if (symbol < 0x20) {
+      fprintf(output, "\\u%04x", symbol);
+    } else {
+      fputc(symbol, output);
+    }
+  }
+
+  fputc('"', output);
+}
+
+/* nearest-rank percentile of sorted values */
+static double get_percentile(const std::vector<double>& values,
+                             double percentile) {
+  if (values.empty()) return 0;
+
+  size_t rank = std::ceil(percentile / 100 * values.size());
+  return values[std::clamp<size_t>(rank, 1, values.size()) - 1];
+}
+
+static void print_result(FILE* output, const BenchResult& result,
+                         const BenchConfig& config) {
+  fprintf(output, "    {\n      \"name\": ");
+  print_string(output, result.name);
+  fprintf(output, ",\n      \"library\": ");
+  if (result.library.empty()) {
+    fprintf(output, "null");
+  } else {
+    print_string(output, result.library);
+  }
+
+  if (!result.error.empty()) {
+    fprintf(output, ",\n      \"error\": ");
+    print_string(output, result.error);
+    fprintf(output, "\n    }");
+    return;
+  }
+
+  double total = 0;
+  for (double latency : result.latencies) {
+    total += latency;
+  }
+
+  double pixels = static_cast<double>(config.width) * config.height;
+  double throughput =
+      result.seconds > 0 ? pixels * result.calls / result.seconds / 1e6 : 0;
+
+  fprintf(output,
+          ",\n      \"api_version\": %u,\n      \"calls\": %zu,\n"
+          "      \"seconds\": %.6f,\n"
+          "      \"megapixels_per_second\": %.3f,\n"
+          "      \"latency_us\": {\"mean\": %.3f, \"p50\": %.3f, "
+          "\"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n"
+          "      \"peak_memory_kb\": %ld\n    }",
+          result.api_version, result.calls, result.seconds, throughput,
+          result.calls ? total / result.calls : 0,
+          get_percentile(result.latencies, 50),
+          get_percentile(result.latencies, 90),
+          get_percentile(result.latencies, 99),
+          result.latencies.empty() ? 0 : result.latencies.back(),
+          result.peak_memory_kb);
+}
+
+int main(int argc, char** argv) {
+  BenchConfig config;
+  if (!parse_args(argc, argv, config)) {
+    print_usage();
+    return 1;
+  }
+
+  std::vector<std::filesystem::path> plugin_paths;
+  std::error_code error;
+  for (auto& plugin_entry :
+       std::filesystem::directory_iterator(config.plugins_path, error)) {
+    if (plugin_entry.is_directory()) {
+      plugin_paths.push_back(plugin_entry.path());
+    }
+  }
+
+  if (error) {
+    fprintf(stderr, "plugin_bench: can not read %s: %s\n",
+            config.plugins_path.data(), error.message().data());
+  }
+
+  /* directory order is unspecified, reports should be comparable */
+  std::sort(plugin_paths.begin(), plugin_paths.end());
+
+  std::vector<BenchResult> results;
+  for (auto& plugin_path : plugin_paths) {
+    results.push_back(bench_library(plugin_path, config));
+  }
+
+  /* native filters are the baseline for blur plugins */
+  results.push_back(bench_native(std::make_unique<BoxBlurFilter>(),
+                                 "Box blur (native)", config));
+  results.push_back(bench_native(std::make_unique<GaussianBlurFilter>(),
+                                 "Gaussian blur (native)", config));
+
+  FILE* output = stdout;
+  if (!config.output_path.empty()) {
+    output = fopen(config.output_path.data(), "w");
+    if (!output) {
+      fprintf(stderr, "plugin_bench: can not write %s\n",
+              config.output_path.data());
+      return 1;
+    }
+  }
+
+  fprintf(output,
+          "{\n  \"width\": %zu,\n  \"height\": %zu,\n  \"strokes\": %d,\n"
+          "  \"moves\": %d,\n  \"thickness\": %d,\n  \"plugins\": [\n",
+          config.width, config.height, config.strokes, config.moves,
+          config.thickness);
+
+  bool failed = false;
+  for (size_t i = 0; i < results.size(); ++i) {
+    print_result(output, results[i], config);
+    fprintf(output, i + 1 < results.size() ? ",\n" : "\n");
+    failed |= !results[i].error.empty();
+  }
+
+  fprintf(output, "  ]\n}\n");
+
+  if (output != stdout) {
+    fclose(output);
+  }
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,181 @@
+/*!
+ * Plugin host process. Loads one plugin library and applies it to canvases
+ * placed by the editor into shared memory.
+ *
+ * usage: plugin_host <library path> <socket descriptor>
+ * */
+
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "plugin_protocol.hpp"
+
+static uint8_t* memory = nullptr;
+static size_t memory_size = 0;
+
+static void map_memory(int memfd, size_t size) {
+  if (memory) munmap(memory, memory_size);
+
+  memory = static_cast<uint8_t*>(
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0));
+  memory_size = size;
+  close(memfd);
+
+  if (memory == MAP_FAILED) {
+    memory = nullptr;
+    memory_size = 0;
+  }
+}
+
+static bool is_mapped(const HostCommand& command, size_t size) {
+  return memory && command.offset + size <= memory_size;
+}
+
+static PluginAPI::Canvas get_canvas(const HostCommand& command) {
+  PluginAPI::Canvas canvas = {};
+
+  canvas.pixels = memory + command.offset;
+  canvas.width = command.width;
+  canvas.height = command.height;
+
+  return canvas;
+}
+
+static PluginAPI::CanvasView get_view(const HostCommand& command) {
+  PluginAPI::CanvasView view = {};
+
+  view.pixels = memory + command.offset;
+  view.width = command.width;
+  view.height = command.height;
+  view.stride = command.stride;
+  view.x = command.x;
+  view.y = command.y;
+  view.canvas_width = command.canvas_width;
+  view.canvas_height = command.canvas_height;
+  view.format = PluginAPI::RGBA8888;
+
+  return view;
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s <library path> <socket descriptor>\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  int socket = atoi(argv[2]);
+
+  void* handle = dlopen(argv[1], RTLD_NOW);
+  if (!handle) {
+    fprintf(stderr, "plugin_host: %s\n", dlerror());
+    return EXIT_FAILURE;
+  }
+
+  auto get_plugin = reinterpret_cast<PluginAPI::Plugin* (*)()>(
+      dlsym(handle, "get_plugin"));
+  auto get_plugin_api_version = reinterpret_cast<uint32_t (*)()>(
+      dlsym(handle, "get_plugin_api_version"));
+  if (!get_plugin) return EXIT_FAILURE;
+
+  PluginAPI::Plugin* plugin = get_plugin();
+  uint32_t api_version = get_plugin_api_version ? get_plugin_api_version() : 1;
+  PluginAPI::PluginV2* plugin_v2 =
+      api_version >= 2 ? static_cast<PluginAPI::PluginV2*>(plugin) : nullptr;
+
+  HostCommand command = {};
+  int memfd = -1;
+
+  while (receive_message(socket, &command, sizeof(command), &memfd)) {
+    HostReply reply = {};
+    reply.success = true;
+
+    unpack_properties(command.properties, command.properties_count,
+                      plugin->properties);
+
+    size_t canvas_size = command.width * command.height * 4;
+    size_t view_size =
+        command.height ? (command.height - 1) * command.stride +
+                             command.width * 4
+                       : 0;
+
+    switch (command.type) {
+      case MAP_MEMORY: {
+        map_memory(memfd, command.memory_size);
+        reply.success = memory != nullptr;
+        break;
+      }
+
+      case INIT_PLUGIN: {
+        reply.success = plugin->init();
+        reply.api_version = api_version;
+
+        if (plugin_v2) {
+          reply.capabilities = plugin_v2->get_capabilities();
+          reply.halo = plugin_v2->get_halo();
+        }
+
+        pack_properties(plugin->properties, reply.properties,
+                        &reply.properties_count);
+        break;
+      }
+
+      case DEINIT_PLUGIN: {
+        reply.success = plugin->deinit();
+        send_message(socket, &reply, sizeof(reply));
+        return EXIT_SUCCESS;
+      }
+
+      case START_APPLY:
+      case APPLY:
+      case STOP_APPLY: {
+        if (!is_mapped(command, canvas_size)) {
+          reply.success = false;
+          break;
+        }
+
+        auto canvas = get_canvas(command);
+        if (command.type == START_APPLY) {
+          plugin->start_apply(canvas, command.pos);
+        } else if (command.type == APPLY) {
+          plugin->apply(canvas, command.pos);
+        } else {
+          plugin->stop_apply(canvas, command.pos);
+        }
+        break;
+      }
+
+      case START_APPLY_REGION:
+      case APPLY_REGION:
+      case STOP_APPLY_REGION: {
+        if (!plugin_v2 || !is_mapped(command, view_size)) {
+          reply.success = false;
+          break;
+        }
+
+        auto view = get_view(command);
+        if (command.type == START_APPLY_REGION) {
+          plugin_v2->start_apply_region(view, command.roi, command.pos);
+        } else if (command.type == APPLY_REGION) {
+          plugin_v2->apply_region(view, command.roi, command.pos);
+        } else {
+          plugin_v2->stop_apply_region(view, command.roi, command.pos);
+        }
+        break;
+      }
+
+      case GET_HALO: {
+        reply.halo = plugin_v2 ? plugin_v2->get_halo() : 0;
+        break;
+      }
+    }
+
+    if (!send_message(socket, &reply, sizeof(reply))) break;
+  }
+
+  return EXIT_SUCCESS;
+}
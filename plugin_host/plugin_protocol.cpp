@@ -0,0 +1,82 @@
+#include "plugin_protocol.hpp"
+
+#include <sys/socket.h>
+
+#include <cstring>
+
+bool send_message(int socket, const void* message, size_t size, int fd) {
+  iovec data = {const_cast<void*>(message), size};
+
+  msghdr header = {};
+  header.msg_iov = &data;
+  header.msg_iovlen = 1;
+
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+  if (fd >= 0) {
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+
+    cmsghdr* control_header = CMSG_FIRSTHDR(&header);
+    control_header->cmsg_level = SOL_SOCKET;
+    control_header->cmsg_type = SCM_RIGHTS;
+    control_header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(control_header), &fd, sizeof(int));
+  }
+
+  /* messages are small and the socket is a SOCK_SEQPACKET pair, so one
+   * call either delivers the whole message or fails */
+  return sendmsg(socket, &header, MSG_NOSIGNAL) == static_cast<ssize_t>(size);
+}
+
+bool receive_message(int socket, void* message, size_t size, int* fd) {
+  iovec data = {message, size};
+
+  msghdr header = {};
+  header.msg_iov = &data;
+  header.msg_iovlen = 1;
+
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+  header.msg_control = control;
+  header.msg_controllen = sizeof(control);
+
+  ssize_t received = recvmsg(socket, &header, MSG_CMSG_CLOEXEC);
+
+  if (fd) {
+    *fd = -1;
+
+    cmsghdr* control_header = CMSG_FIRSTHDR(&header);
+    if (control_header && control_header->cmsg_type == SCM_RIGHTS) {
+      memcpy(fd, CMSG_DATA(control_header), sizeof(int));
+    }
+  }
+
+  return received == static_cast<ssize_t>(size);
+}
+
+void pack_properties(const PluginAPI::Plugin::PropertyMap& properties,
+                     RemoteProperty* packed, uint32_t* count) {
+  *count = 0;
+
+  /* pointer values make no sense in another process, they are sent only to
+   * keep the value union intact */
+  for (auto& property : properties) {
+    if (*count == MAX_REMOTE_PROPERTIES) break;
+
+    packed[*count].type = property.first;
+    packed[*count].display_type = property.second.display_type;
+    memcpy(&packed[*count].value, &property.second.double_value,
+           sizeof(uint64_t));
+    ++*count;
+  }
+}
+
+void unpack_properties(const RemoteProperty* packed, uint32_t count,
+                       PluginAPI::Plugin::PropertyMap& properties) {
+  for (uint32_t i = 0; i < count && i < MAX_REMOTE_PROPERTIES; ++i) {
+    auto& property = properties[PluginAPI::TYPE::Type(packed[i].type)];
+
+    property.display_type =
+        static_cast<PluginAPI::Property::DISPLAY_TYPE>(packed[i].display_type);
+    memcpy(&property.double_value, &packed[i].value, sizeof(uint64_t));
+  }
+}
@@ -0,0 +1,96 @@
+#ifndef PLUGIN_PROTOCOL_HPP
+#define PLUGIN_PROTOCOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "../plugin_api/api.hpp"
+
+/*!
+ * Messages exchanged between the editor and a plugin host process over a
+ * Unix socket. Pixels are never sent through the socket: both processes map
+ * the same memfd segment and messages only carry offsets into it.
+ * */
+
+const size_t MAX_REMOTE_PROPERTIES = 16;
+
+enum HOST_COMMAND {
+  /* carries memfd of the new shared segment as SCM_RIGHTS */
+  MAP_MEMORY,
+  INIT_PLUGIN,
+  DEINIT_PLUGIN,
+  START_APPLY,
+  APPLY,
+  STOP_APPLY,
+  START_APPLY_REGION,
+  APPLY_REGION,
+  STOP_APPLY_REGION,
+  GET_HALO
+};
+
+struct RemoteProperty {
+  int32_t type;
+  int32_t display_type;
+  /* raw bytes of the Property value union */
+  uint64_t value;
+};
+
+struct HostCommand {
+  uint32_t type;
+
+  /* MAP_MEMORY */
+  uint64_t memory_size;
+
+  /* canvas or canvas view, pixels start at offset in the shared segment */
+  uint64_t offset;
+  uint64_t width;
+  uint64_t height;
+  uint64_t stride;
+  int64_t x;
+  int64_t y;
+  uint64_t canvas_width;
+  uint64_t canvas_height;
+
+  PluginAPI::Rect roi;
+  PluginAPI::Position pos;
+
+  uint32_t properties_count;
+  RemoteProperty properties[MAX_REMOTE_PROPERTIES];
+};
+
+struct HostReply {
+  bool success;
+
+  /* INIT_PLUGIN */
+  uint32_t api_version;
+  uint32_t capabilities;
+
+  /* INIT_PLUGIN and GET_HALO */
+  int64_t halo;
+
+  /* INIT_PLUGIN */
+  uint32_t properties_count;
+  RemoteProperty properties[MAX_REMOTE_PROPERTIES];
+};
+
+/*!
+ * Sends whole message, optionally attaching file descriptor
+ * @param fd descriptor to pass to the other process, -1 for none
+ * @return false if the other process is gone
+ * */
+bool send_message(int socket, const void* message, size_t size, int fd = -1);
+
+/*!
+ * Receives whole message
+ * @param fd receives attached descriptor or -1, may be nullptr
+ * @return false if the other process is gone
+ * */
+bool receive_message(int socket, void* message, size_t size,
+                     int* fd = nullptr);
+
+void pack_properties(const PluginAPI::Plugin::PropertyMap& properties,
+                     RemoteProperty* packed, uint32_t* count);
+void unpack_properties(const RemoteProperty* packed, uint32_t count,
+                       PluginAPI::Plugin::PropertyMap& properties);
+
+#endif
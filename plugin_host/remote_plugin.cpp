@@ -0,0 +1,458 @@
+#include "remote_plugin.hpp"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+const char* PLUGIN_HOST_NAME = "plugin_host";
+const size_t PLUGIN_MEMORY_GRANULARITY = 1 << 20;
+/* seconds, generous enough for a heavy filter over a whole canvas */
+const time_t PLUGIN_REPLY_TIMEOUT = 10;
+
+RemotePlugin::RemotePlugin(std::string lib_path, size_t max_processes)
+    : lib_path(std::move(lib_path)),
+      max_processes(std::max<size_t>(max_processes, 1)),
+      starting_count(0),
+      initialized(false),
+      api_version(0),
+      capabilities(0) {}
+
+RemotePlugin::~RemotePlugin() {
+  for (auto& process : processes) {
+    stop_process(*process);
+  }
+}
+
+uint32_t RemotePlugin::get_api_version() const { return api_version; }
+
+/*---------------------------------------*/
+/*               Processes               */
+/*---------------------------------------*/
+
+std::unique_ptr<RemotePlugin::Process> RemotePlugin::spawn_process() {
+  /* host binary is installed next to the editor */
+  std::error_code error;
+  auto host_path =
+      std::filesystem::read_symlink("/proc/self/exe", error).parent_path() /
+      PLUGIN_HOST_NAME;
+  if (error) return nullptr;
+
+  /* hosts may be started from several threads at once, so both ends are
+   * created close-on-exec and no other host inherits them */
+  int sockets[2] = {};
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets)) {
+    return nullptr;
+  }
+
+  /* a host stuck in the plugin does not block its caller forever */
+  timeval reply_timeout = {PLUGIN_REPLY_TIMEOUT, 0};
+  setsockopt(sockets[0], SOL_SOCKET, SO_RCVTIMEO, &reply_timeout,
+             sizeof(reply_timeout));
+
+  /* only async-signal-safe calls are allowed between fork and exec, so the
+   * arguments are prepared beforehand */
+  std::string host_path_arg = host_path.string();
+  std::string socket_arg = std::to_string(sockets[1]);
+  char* argv[] = {host_path_arg.data(), lib_path.data(), socket_arg.data(),
+                  nullptr};
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    fcntl(sockets[1], F_SETFD, 0);
+    execv(argv[0], argv);
+    _exit(127);
+  }
+
+  close(sockets[1]);
+  if (pid < 0) {
+    close(sockets[0]);
+    return nullptr;
+  }
+
+  auto process = std::make_unique<Process>();
+  process->pid = pid;
+  process->socket = sockets[0];
+  process->memory = nullptr;
+  process->memory_size = 0;
+  process->busy = false;
+
+  return process;
+}
+
+bool RemotePlugin::init_process(Process& process) {
+  /* processes started later get the properties set by the editor */
+  HostCommand command = {};
+  command.type = INIT_PLUGIN;
+  pack_properties(properties, command.properties, &command.properties_count);
+
+  HostReply reply = {};
+  if (!call(process, command, reply)) return false;
+
+  if (!reply.success) {
+    kill_process(process);
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(processes_mutex);
+  if (!initialized) {
+    initialized = true;
+    api_version = reply.api_version;
+    capabilities = reply.capabilities;
+    unpack_properties(reply.properties, reply.properties_count, properties);
+  }
+
+  return true;
+}
+
+void RemotePlugin::stop_process(Process& process) {
+  if (process.socket >= 0) {
+    close(process.socket);
+    process.socket = -1;
+  }
+
+  if (process.pid > 0) {
+    /* closed socket makes a healthy host exit on its own */
+    kill(process.pid, SIGKILL);
+    waitpid(process.pid, nullptr, 0);
+    process.pid = -1;
+  }
+
+  if (process.memory) {
+    munmap(process.memory, process.memory_size);
+    process.memory = nullptr;
+    process.memory_size = 0;
+  }
+}
+
+void RemotePlugin::kill_process(Process& process) {
+  if (process.socket < 0) return;
+
+  /* the host is reaped by stop_process() */
+  kill(process.pid, SIGKILL);
+  close(process.socket);
+  process.socket = -1;
+}
+
+bool RemotePlugin::map_memory(Process& process, size_t size) {
+  if (size <= process.memory_size) return true;
+
+  size = (size + PLUGIN_MEMORY_GRANULARITY - 1) / PLUGIN_MEMORY_GRANULARITY *
+         PLUGIN_MEMORY_GRANULARITY;
+
+  int memfd = memfd_create("plugin canvas", MFD_CLOEXEC);
+  if (memfd < 0) return false;
+
+  uint8_t* memory = nullptr;
+  if (!ftruncate(memfd, size)) {
+    memory = static_cast<uint8_t*>(
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0));
+  }
+
+  if (!memory || memory == MAP_FAILED) {
+    close(memfd);
+    return false;
+  }
+
+  HostCommand command = {};
+  command.type = MAP_MEMORY;
+  command.memory_size = size;
+
+  HostReply reply = {};
+  bool mapped = send_message(process.socket, &command, sizeof(command), memfd) &&
+                receive_message(process.socket, &reply, sizeof(reply)) &&
+                reply.success;
+  close(memfd);
+
+  if (!mapped) {
+    munmap(memory, size);
+    kill_process(process);
+    return false;
+  }
+
+  /* find_process() looks at the memory of processes owned by others */
+  std::lock_guard<std::mutex> lock(processes_mutex);
+  if (process.memory) munmap(process.memory, process.memory_size);
+  process.memory = memory;
+  process.memory_size = size;
+
+  return true;
+}
+
+RemotePlugin::Process* RemotePlugin::acquire(size_t size) {
+  std::unique_lock<std::mutex> lock(processes_mutex);
+  Process* process = nullptr;
+  bool started = false;
+
+  while (!process) {
+    for (auto& candidate : processes) {
+      if (!candidate->busy) {
+        process = candidate.get();
+        break;
+      }
+    }
+
+    if (!process && processes.size() + starting_count < max_processes) {
+      /* the slot is reserved, so other callers and interrupt() do not wait
+       * for the host to start */
+      ++starting_count;
+      lock.unlock();
+      auto new_process = spawn_process();
+      lock.lock();
+      --starting_count;
+
+      if (!new_process) {
+        lock.unlock();
+        process_released.notify_one();
+        return nullptr;
+      }
+
+      processes.push_back(std::move(new_process));
+      process = processes.back().get();
+      started = true;
+    }
+
+    if (!process) {
+      process_released.wait(lock);
+    }
+  }
+
+  process->busy = true;
+  lock.unlock();
+
+  /* the new process is already listed, so interrupt() can kill it while
+   * the plugin initializes */
+  if ((started && !init_process(*process)) || !map_memory(*process, size)) {
+    release(process);
+    return nullptr;
+  }
+
+  return process;
+}
+
+void RemotePlugin::release(Process* process) {
+  {
+    std::lock_guard<std::mutex> lock(processes_mutex);
+    process->busy = false;
+
+    /* dead processes are dropped, a new one is started when needed */
+    if (process->socket < 0) {
+      stop_process(*process);
+      std::erase_if(processes, [process](const std::unique_ptr<Process>& entry) {
+        return entry.get() == process;
+      });
+    }
+  }
+
+  process_released.notify_one();
+}
+
+RemotePlugin::Process* RemotePlugin::find_process(const uint8_t* pixels,
+                                                  size_t size) {
+  std::lock_guard<std::mutex> lock(processes_mutex);
+
+  for (auto& process : processes) {
+    if (process->busy && process->memory && pixels >= process->memory &&
+        pixels + size <= process->memory + process->memory_size) {
+      return process.get();
+    }
+  }
+
+  return nullptr;
+}
+
+bool RemotePlugin::call(Process& process, HostCommand& command,
+                        HostReply& reply) {
+  if (process.socket >= 0 &&
+      send_message(process.socket, &command, sizeof(command)) &&
+      receive_message(process.socket, &reply, sizeof(reply))) {
+    return true;
+  }
+
+  if (process.socket >= 0) {
+    fprintf(stderr, "Plugin process of %s stopped responding\n",
+            lib_path.data());
+    kill_process(process);
+  }
+
+  return false;
+}
+
+uint8_t* RemotePlugin::acquire_buffer(size_t size) {
+  Process* process = acquire(size);
+  return process ? process->memory : nullptr;
+}
+
+void RemotePlugin::release_buffer(const uint8_t* buffer) {
+  Process* process = find_process(buffer, 0);
+  if (process) release(process);
+}
+
+void RemotePlugin::interrupt() {
+  std::lock_guard<std::mutex> lock(processes_mutex);
+
+  /* busy processes are removed by their callers, whose calls fail now */
+  for (auto& process : processes) {
+    if (process->pid > 0) kill(process->pid, SIGKILL);
+  }
+
+  std::erase_if(processes, [this](std::unique_ptr<Process>& process) {
+    if (process->busy) return false;
+
+    stop_process(*process);
+    return true;
+  });
+}
+
+/*---------------------------------------*/
+/*              Plugin calls             */
+/*---------------------------------------*/
+
+void RemotePlugin::run_canvas_command(HOST_COMMAND type,
+                                      PluginAPI::Canvas canvas,
+                                      PluginAPI::Position pos) {
+  size_t size = canvas.width * canvas.height * 4;
+
+  Process* process = find_process(canvas.pixels, size);
+  bool staged = !process;
+  if (staged) {
+    process = acquire(size);
+    if (!process) return;
+
+    memcpy(process->memory, canvas.pixels, size);
+  }
+
+  HostCommand command = {};
+  command.type = type;
+  command.offset = staged ? 0 : canvas.pixels - process->memory;
+  command.width = canvas.width;
+  command.height = canvas.height;
+  command.pos = pos;
+  pack_properties(properties, command.properties, &command.properties_count);
+
+  HostReply reply = {};
+  bool done = call(*process, command, reply) && reply.success;
+
+  if (staged) {
+    if (done) memcpy(canvas.pixels, process->memory, size);
+    release(process);
+  }
+}
+
+void RemotePlugin::run_view_command(HOST_COMMAND type,
+                                    PluginAPI::CanvasView view,
+                                    PluginAPI::Rect roi,
+                                    PluginAPI::Position pos) {
+  size_t size =
+      view.height ? (view.height - 1) * view.stride + view.width * 4 : 0;
+
+  Process* process = find_process(view.pixels, size);
+  bool staged = !process;
+  if (staged) {
+    process = acquire(size);
+    if (!process) return;
+
+    memcpy(process->memory, view.pixels, size);
+  }
+
+  HostCommand command = {};
+  command.type = type;
+  command.offset = staged ? 0 : view.pixels - process->memory;
+  command.width = view.width;
+  command.height = view.height;
+  command.stride = view.stride;
+  command.x = view.x;
+  command.y = view.y;
+  command.canvas_width = view.canvas_width;
+  command.canvas_height = view.canvas_height;
+  command.roi = roi;
+  command.pos = pos;
+  pack_properties(properties, command.properties, &command.properties_count);
+
+  HostReply reply = {};
+  bool done = call(*process, command, reply) && reply.success;
+
+  if (staged) {
+    if (done) memcpy(view.pixels, process->memory, size);
+    release(process);
+  }
+}
+
+bool RemotePlugin::init() {
+  Process* process = acquire(0);
+  if (!process) return false;
+
+  release(process);
+  return true;
+}
+
+bool RemotePlugin::deinit() {
+  std::lock_guard<std::mutex> lock(processes_mutex);
+
+  for (auto& process : processes) {
+    HostCommand command = {};
+    command.type = DEINIT_PLUGIN;
+
+    HostReply reply = {};
+    call(*process, command, reply);
+    stop_process(*process);
+  }
+
+  processes.clear();
+  return true;
+}
+
+void RemotePlugin::start_apply(PluginAPI::Canvas canvas,
+                               PluginAPI::Position pos) {
+  run_canvas_command(START_APPLY, canvas, pos);
+}
+
+void RemotePlugin::apply(PluginAPI::Canvas canvas, PluginAPI::Position pos) {
+  run_canvas_command(APPLY, canvas, pos);
+}
+
+void RemotePlugin::stop_apply(PluginAPI::Canvas canvas,
+                              PluginAPI::Position pos) {
+  run_canvas_command(STOP_APPLY, canvas, pos);
+}
+
+void RemotePlugin::start_apply_region(PluginAPI::CanvasView canvas,
+                                      PluginAPI::Rect roi,
+                                      PluginAPI::Position pos) {
+  run_view_command(START_APPLY_REGION, canvas, roi, pos);
+}
+
+void RemotePlugin::apply_region(PluginAPI::CanvasView canvas,
+                                PluginAPI::Rect roi, PluginAPI::Position pos) {
+  run_view_command(APPLY_REGION, canvas, roi, pos);
+}
+
+void RemotePlugin::stop_apply_region(PluginAPI::CanvasView canvas,
+                                     PluginAPI::Rect roi,
+                                     PluginAPI::Position pos) {
+  run_view_command(STOP_APPLY_REGION, canvas, roi, pos);
+}
+
+uint32_t RemotePlugin::get_capabilities() { return capabilities; }
+
+int64_t RemotePlugin::get_halo() {
+  Process* process = acquire(0);
+  if (!process) return 0;
+
+  HostCommand command = {};
+  command.type = GET_HALO;
+  pack_properties(properties, command.properties, &command.properties_count);
+
+  HostReply reply = {};
+  bool done = call(*process, command, reply);
+  release(process);
+
+  return done ? reply.halo : 0;
+}
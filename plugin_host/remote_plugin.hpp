@@ -0,0 +1,114 @@
+#ifndef REMOTE_PLUGIN_HPP
+#define REMOTE_PLUGIN_HPP
+
+#include <sys/types.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../plugin_api/api.hpp"
+#include "plugin_protocol.hpp"
+
+/*!
+ * Plugin running in separate plugin_host processes, so a crashing plugin
+ * can not take the editor down. Canvases are exchanged through memfd
+ * segments mapped by both processes; a canvas placed into a buffer returned
+ * by acquire_buffer() is handed to the plugin without copying, any other
+ * canvas is copied into shared memory first. Every caller holding a buffer
+ * gets its own process, so tile-parallel plugins run in several processes
+ * at once.
+ * */
+class RemotePlugin : public PluginAPI::PluginV2 {
+ private:
+  struct Process {
+    pid_t pid;
+    int socket;
+    uint8_t* memory;
+    size_t memory_size;
+    bool busy;
+  };
+
+  std::string lib_path;
+  size_t max_processes;
+
+  std::vector<std::unique_ptr<Process>> processes;
+  /* slots reserved for processes being started without the lock */
+  size_t starting_count;
+  std::mutex processes_mutex;
+  std::condition_variable process_released;
+
+  bool initialized;
+  uint32_t api_version;
+  uint32_t capabilities;
+
+  /* starts a host, which is not initialized yet */
+  std::unique_ptr<Process> spawn_process();
+  /* sends the plugin properties to a new host and loads the plugin there */
+  bool init_process(Process& process);
+  void stop_process(Process& process);
+  /* kills a host which failed, release() drops it then */
+  void kill_process(Process& process);
+  bool map_memory(Process& process, size_t size);
+
+  Process* acquire(size_t size);
+  void release(Process* process);
+  Process* find_process(const uint8_t* pixels, size_t size);
+
+  /* sends command and waits for the reply, a process which does not answer
+   * within PLUGIN_REPLY_TIMEOUT is considered dead and is killed */
+  bool call(Process& process, HostCommand& command, HostReply& reply);
+
+  void run_canvas_command(HOST_COMMAND type, PluginAPI::Canvas canvas,
+                          PluginAPI::Position pos);
+  void run_view_command(HOST_COMMAND type, PluginAPI::CanvasView view,
+                        PluginAPI::Rect roi, PluginAPI::Position pos);
+
+ public:
+  /*!
+   * @param lib_path plugin library loaded by the host processes
+   * @param max_processes upper bound of processes running at once
+   * */
+  RemotePlugin(std::string lib_path, size_t max_processes);
+  virtual ~RemotePlugin();
+
+  uint32_t get_api_version() const;
+
+  /*!
+   * Reserves a process and returns its shared memory of at least size bytes.
+   * Returns nullptr if no plugin process can be started.
+   * */
+  uint8_t* acquire_buffer(size_t size);
+  void release_buffer(const uint8_t* buffer);
+
+  /* kills plugin processes, so calls blocked in a stuck plugin return at
+   * once; new processes are started on demand */
+  void interrupt();
+
+  virtual bool init() override;
+  virtual bool deinit() override;
+
+  virtual void start_apply(PluginAPI::Canvas canvas,
+                           PluginAPI::Position pos) override;
+  virtual void apply(PluginAPI::Canvas canvas,
+                     PluginAPI::Position pos) override;
+  virtual void stop_apply(PluginAPI::Canvas canvas,
+                          PluginAPI::Position pos) override;
+
+  virtual void start_apply_region(PluginAPI::CanvasView canvas,
+                                  PluginAPI::Rect roi,
+                                  PluginAPI::Position pos) override;
+  virtual void apply_region(PluginAPI::CanvasView canvas, PluginAPI::Rect roi,
+                            PluginAPI::Position pos) override;
+  virtual void stop_apply_region(PluginAPI::CanvasView canvas,
+                                 PluginAPI::Rect roi,
+                                 PluginAPI::Position pos) override;
+
+  virtual uint32_t get_capabilities() override;
+  virtual int64_t get_halo() override;
+};
+
+#endif
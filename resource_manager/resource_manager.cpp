@@ -0,0 +1,185 @@
+#include "resource_manager.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <numeric>
+
+std::unordered_map<std::string, TextureHandle> ResourceManager::icon_handles;
+std::vector<AtlasEntry> ResourceManager::icons;
+sf::Texture ResourceManager::atlas;
+bool ResourceManager::atlas_outdated = true;
+
+std::unordered_map<std::string, sf::Font> ResourceManager::fonts;
+std::unordered_map<std::string, sf::Font*> ResourceManager::font_aliases;
+
+std::string ResourceManager::get_canonical_path(const std::string& path) {
+  std::error_code error;
+  auto canonical_path = std::filesystem::weakly_canonical(path, error);
+
+  /* the path is kept as it is, loading it reports the error */
+  if (error) return path;
+  return canonical_path.string();
+}
+
+void ResourceManager::init() {
+  std::error_code error;
+  for (const auto& entry :
+       std::filesystem::directory_iterator(ICONS_DIRECTORY, error)) {
+    if (entry.path().extension() == ".png") {
+      get_icon(entry.path().string());
+    }
+  }
+
+  update_atlas();
+}
+
+void ResourceManager::deinit() {
+  icon_handles.clear();
+  icons.clear();
+  atlas = sf::Texture();
+  atlas_outdated = true;
+
+  font_aliases.clear();
+  fonts.clear();
+}
+
+TextureHandle ResourceManager::get_icon(const std::string& path) {
+  std::string canonical_path = get_canonical_path(path);
+
+  auto handle = icon_handles.find(canonical_path);
+  if (handle != icon_handles.end()) return handle->second;
+
+  TextureHandle new_handle = icons.size();
+  icons.push_back(AtlasEntry{canonical_path, sf::IntRect(), nullptr});
+  icon_handles.insert({canonical_path, new_handle});
+  atlas_outdated = true;
+
+  return new_handle;
+}
+
+bool ResourceManager::is_atlas_outdated() { return atlas_outdated; }
+
+void ResourceManager::update_atlas() {
+  std::vector<sf::Image> images(icons.size());
+  for (size_t i = 0; i < icons.size(); ++i) {
+    images[i].loadFromFile(icons[i].path);
+  }
+
+  /* rows of icons are filled from the highest icon to the lowest, the
+   * order does not depend on the order of requests */
+  std::vector<size_t> order(icons.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+    auto lhs_size = images[lhs].getSize();
+    auto rhs_size = images[rhs].getSize();
+    if (lhs_size.y != rhs_size.y) return lhs_size.y > rhs_size.y;
+    return icons[lhs].path < icons[rhs].path;
+  });
+
+  unsigned atlas_width = std::min(ATLAS_WIDTH, sf::Texture::getMaximumSize());
+  unsigned row_x = ATLAS_WHITE_SIZE + ATLAS_PADDING;
+  unsigned row_y = 0;
+  unsigned row_height = ATLAS_WHITE_SIZE + ATLAS_PADDING;
+
+  for (size_t icon : order) {
+    auto size = images[icon].getSize();
+    icons[icon].rect = sf::IntRect();
+    icons[icon].texture.reset();
+    if (size.x == 0 || size.y == 0) continue;
+
+    unsigned padded_width = size.x + 2 * ATLAS_PADDING;
+    unsigned padded_height = size.y + 2 * ATLAS_PADDING;
+
+    if (padded_width > atlas_width) {
+      load_separate_texture(icons[icon], images[icon]);
+      continue;
+    }
+
+    if (row_x + padded_width > atlas_width) {
+      row_y += row_height;
+      row_x = 0;
+      row_height = 0;
+    }
+
+    icons[icon].rect = sf::IntRect(row_x + ATLAS_PADDING,
+                                   row_y + ATLAS_PADDING, size.x, size.y);
+    row_x += padded_width;
+    row_height = std::max(row_height, padded_height);
+  }
+
+  unsigned atlas_height =
+      std::min(row_y + row_height, sf::Texture::getMaximumSize());
+
+  sf::Image atlas_image;
+  atlas_image.create(atlas_width, atlas_height, sf::Color::Transparent);
+
+  for (unsigned y = 0; y < ATLAS_WHITE_SIZE; ++y) {
+    for (unsigned x = 0; x < ATLAS_WHITE_SIZE; ++x) {
+      atlas_image.setPixel(x, y, sf::Color::White);
+    }
+  }
+
+  for (size_t i = 0; i < icons.size(); ++i) {
+    auto& rect = icons[i].rect;
+    if (rect.width == 0 || icons[i].texture) continue;
+
+    /* rows which do not fit under the maximum size are moved out */
+    if (static_cast<unsigned>(rect.top + rect.height) > atlas_height) {
+      load_separate_texture(icons[i], images[i]);
+      continue;
+    }
+
+    atlas_image.copy(images[i], rect.left, rect.top);
+  }
+
+  atlas.loadFromImage(atlas_image);
+  atlas_outdated = false;
+}
+
+void ResourceManager::load_separate_texture(AtlasEntry& icon,
+                                            const sf::Image& image) {
+  icon.texture = std::make_unique<sf::Texture>();
+
+  /* larger than the maximum texture size */
+  if (!icon.texture->loadFromImage(image)) {
+    icon.texture.reset();
+    icon.rect = sf::IntRect();
+    return;
+  }
+
+  auto size = image.getSize();
+  icon.rect = sf::IntRect(0, 0, size.x, size.y);
+}
+
+const sf::Texture& ResourceManager::get_atlas() { return atlas; }
+
+const sf::Texture& ResourceManager::get_icon_texture(TextureHandle handle) {
+  if (handle >= icons.size() || !icons[handle].texture) return atlas;
+  return *icons[handle].texture;
+}
+
+sf::IntRect ResourceManager::get_icon_rect(TextureHandle handle) {
+  if (handle >= icons.size()) return sf::IntRect();
+  return icons[handle].rect;
+}
+
+sf::Vector2f ResourceManager::get_white_texel() {
+  /* the center of the square, it stays white with smoothing as well */
+  return sf::Vector2f(ATLAS_WHITE_SIZE / 2.f, ATLAS_WHITE_SIZE / 2.f);
+}
+
+sf::Font& ResourceManager::get_font(const std::string& path) {
+  auto alias = font_aliases.find(path);
+  if (alias != font_aliases.end()) return *alias->second;
+
+  std::string canonical_path = get_canonical_path(path);
+
+  auto font = fonts.find(canonical_path);
+  if (font == fonts.end()) {
+    font = fonts.emplace(canonical_path, sf::Font()).first;
+    font->second.loadFromFile(canonical_path);
+  }
+
+  font_aliases.insert({path, &font->second});
+  return font->second;
+}
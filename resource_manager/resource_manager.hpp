@@ -0,0 +1,80 @@
+#ifndef RESOURCE_MANAGER_HPP
+#define RESOURCE_MANAGER_HPP
+
+#include <SFML/Graphics.hpp>
+#include <SFML/Graphics/Font.hpp>
+#include <SFML/Graphics/Texture.hpp>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../data_classes/data_classes.hpp"
+
+const char* const ICONS_DIRECTORY = "icons";
+
+/* atlas rows are packed up to this width */
+const unsigned ATLAS_WIDTH = 512;
+/* transparent pixels around every icon, so that scaled icons do not bleed */
+const unsigned ATLAS_PADDING = 1;
+/* white square in the corner of the atlas, untextured shapes sample it */
+const unsigned ATLAS_WHITE_SIZE = 2;
+
+struct AtlasEntry {
+  std::string path;
+  /* empty if the icon could not be loaded */
+  sf::IntRect rect;
+  /* icons which do not fit into the atlas get a texture of their own,
+   * nullptr for icons in the atlas */
+  std::unique_ptr<sf::Texture> texture;
+};
+
+/*!
+ * Icons and fonts shared by all windows, keyed by canonical path, so the
+ * same file is loaded once however it is spelled.
+ *
+ * Icons are packed into a single atlas texture, which lets the renderer draw
+ * a toolbar with one call. init() packs everything in ICONS_DIRECTORY and the
+ * icons requested so far. An icon requested afterwards marks the atlas
+ * outdated, and the renderer repacks it before the next sprite is drawn.
+ * Icons which do not fit into the atlas get textures of their own.
+ * */
+class ResourceManager {
+ private:
+  static std::unordered_map<std::string, TextureHandle> icon_handles;
+  static std::vector<AtlasEntry> icons;
+  static sf::Texture atlas;
+  static bool atlas_outdated;
+
+  static std::unordered_map<std::string, sf::Font> fonts;
+  /* fonts are looked up every frame, so every spelling of a path is
+   * canonicalized only once */
+  static std::unordered_map<std::string, sf::Font*> font_aliases;
+
+  static std::string get_canonical_path(const std::string& path);
+  static void load_separate_texture(AtlasEntry& icon, const sf::Image& image);
+
+ public:
+  ResourceManager() = delete;
+
+  static void init();
+  static void deinit();
+
+  /* returns the handle of the icon at path, registering it if needed */
+  static TextureHandle get_icon(const std::string& path);
+  static bool is_atlas_outdated();
+  static void update_atlas();
+
+  static const sf::Texture& get_atlas();
+  /* the atlas, or the own texture of an icon too large for it */
+  static const sf::Texture& get_icon_texture(TextureHandle handle);
+  /* rect of the icon in get_icon_texture(), empty if there is no such
+   * icon */
+  static sf::IntRect get_icon_rect(TextureHandle handle);
+  /* texture coordinates of an opaque white pixel of the atlas */
+  static sf::Vector2f get_white_texel();
+
+  static sf::Font& get_font(const std::string& path);
+};
+
+#endif
@@ -2,65 +2,198 @@
 
 #include <SFML/Window/Keyboard.hpp>
 
-OffscreenRenderData::OffscreenRenderData() {
-  sprite = new sf::Sprite();
-  texture = new sf::RenderTexture();
-}
+const int32_t WAIT_POLL_INTERVAL_MS = 5;
 
-void OffscreenRenderData::release() {
-  delete sprite;
-  delete texture;
-}
+/* frames a pooled texture survives without being used */
+const uint64_t OFFSCREEN_POOL_IDLE_FRAMES = 120;
+/* the same as sf::CircleShape has by default */
+const size_t ELLIPSE_POINT_COUNT = 30;
 
 std::stack<OffscreenRenderData> Renderer::offscreen_render_stack;
-std::vector<OffscreenRenderData> Renderer::offscreen_resources;
-std::unordered_map<const char*, sf::Texture> Renderer::textures;
+std::vector<PooledRenderTexture> Renderer::offscreen_pool;
+OffscreenPoolStats Renderer::offscreen_pool_stats = {};
+uint64_t Renderer::frame_number = 0;
+
+sf::VertexArray Renderer::batch(sf::Triangles);
+const sf::Texture* Renderer::batch_texture = nullptr;
+sf::RenderTarget* Renderer::batch_target = nullptr;
+
+RenderStats Renderer::frame_stats = {};
+RenderStats Renderer::last_frame_stats = {};
+std::unordered_map<const Image*, sf::Texture> Renderer::image_textures;
+std::unordered_map<const Window*, SubtreeCache> Renderer::subtree_caches;
+std::vector<uint8_t> Renderer::upload_buffer;
 std::stack<Position> Renderer::global_offsets;
 bool Renderer::has_delayed = false;
 
 DelayedRenderData Renderer::delayed_render = {};
 
 sf::RenderWindow Renderer::window;
-std::unordered_map<const char*, sf::Font>
-    Renderer::fonts;  // TODO resource manager
 
 void Renderer::init(Size window_size, const char* name) {
   assert(name != nullptr);
 
   window.create(sf::VideoMode(window_size.width, window_size.height), name);
+  ResourceManager::init();
   Renderer::clear();
 }
 
-void Renderer::deinit() { window.close(); }
+void Renderer::deinit() {
+  batch.clear();
+  batch_texture = nullptr;
+  batch_target = nullptr;
+
+  subtree_caches.clear();
+  offscreen_pool.clear();
+  ResourceManager::deinit();
+  window.close();
+}
 
 void Renderer::init_offscreen_target(Size target_size, Position target_pos) {
-  OffscreenRenderData target = {};
-  target.sprite->setPosition((target_pos += get_offset()));
-  target.texture->create(target_size.width, target_size.height);
-  target.sprite->setTexture(target.texture->getTexture());
+  sf::RenderTexture* texture = acquire_offscreen_texture(target_size);
+  texture->clear(sf::Color::Transparent);
 
-  offscreen_resources.push_back(target);
-  offscreen_render_stack.push(target);
+  offscreen_render_stack.push(
+      OffscreenRenderData{texture, target_pos += get_offset()});
 }
 
 void Renderer::flush_offscreen_target() {
-  auto cur_texture = offscreen_render_stack.top();
-  cur_texture.texture->display();
+  flush_batch();
+
+  auto target = offscreen_render_stack.top();
+  target.texture->display();
   offscreen_render_stack.pop();
 
-  if (offscreen_render_stack.size() > 1) {
-    offscreen_render_stack.top().texture->draw(*cur_texture.sprite);
-    offscreen_render_stack.top().texture->display();
-  } else {
-    window.draw(*cur_texture.sprite);
+  /* the texture stays intact until the next target acquires it */
+  release_offscreen_texture(target.texture);
+
+  sf::Sprite target_sprite(target.texture->getTexture());
+  target_sprite.setPosition(target.pos);
+
+  draw_unbatched(target_sprite);
+}
+
+sf::RenderTexture* Renderer::acquire_offscreen_texture(Size size) {
+  for (auto& pooled : offscreen_pool) {
+    if (pooled.in_use || pooled.size.width != size.width ||
+        pooled.size.height != size.height) {
+      continue;
+    }
+
+    pooled.in_use = true;
+    pooled.last_used_frame = frame_number;
+    ++offscreen_pool_stats.reuses;
+    return pooled.texture.get();
+  }
+
+  PooledRenderTexture pooled = {std::make_unique<sf::RenderTexture>(), size,
+                                true, frame_number};
+  pooled.texture->create(size.width, size.height);
+
+  ++offscreen_pool_stats.allocations;
+  offscreen_pool.push_back(std::move(pooled));
+  return offscreen_pool.back().texture.get();
+}
+
+void Renderer::release_offscreen_texture(const sf::RenderTexture* texture) {
+  /* subtree caches are on the stack too, but not in the pool */
+  for (auto& pooled : offscreen_pool) {
+    if (pooled.texture.get() == texture) {
+      pooled.in_use = false;
+      return;
+    }
+  }
+}
+
+void Renderer::trim_offscreen_pool() {
+  size_t pool_size = offscreen_pool.size();
+
+  std::erase_if(offscreen_pool, [](const PooledRenderTexture& pooled) {
+    return !pooled.in_use &&
+           frame_number - pooled.last_used_frame > OFFSCREEN_POOL_IDLE_FRAMES;
+  });
+
+  offscreen_pool_stats.releases += pool_size - offscreen_pool.size();
+}
+
+OffscreenPoolStats Renderer::get_offscreen_pool_stats() {
+  OffscreenPoolStats stats = offscreen_pool_stats;
+  stats.textures = offscreen_pool.size();
+  stats.bytes = 0;
+
+  for (auto& pooled : offscreen_pool) {
+    stats.bytes += static_cast<size_t>(pooled.size.width) *
+                   pooled.size.height * sizeof(Color);
+  }
+
+  return stats;
+}
+
+void Renderer::begin_cache(const Window* owner, Region region) {
+  SubtreeCache& cache = subtree_caches[owner];
+  if (!cache.texture) {
+    cache.texture = std::make_unique<sf::RenderTexture>();
+  }
+
+  /* the texture is reused while the subtree fits into it */
+  auto texture_size = cache.texture->getSize();
+  if (texture_size.x < region.width || texture_size.y < region.height) {
+    cache.texture->create(std::max<unsigned>(texture_size.x, region.width),
+                          std::max<unsigned>(texture_size.y, region.height));
   }
+
+  cache.region = region;
+  cache.texture->clear(sf::Color::Transparent);
+
+  offscreen_render_stack.push(
+      OffscreenRenderData{cache.texture.get(), Position(0, 0)});
+  global_offsets.push(Position(-region.x, -region.y));
+}
+
+void Renderer::end_cache() {
+  flush_batch();
+
+  offscreen_render_stack.top().texture->display();
+  offscreen_render_stack.pop();
+  global_offsets.pop();
+}
+
+bool Renderer::draw_cache(const Window* owner) {
+  auto cache = subtree_caches.find(owner);
+  if (cache == subtree_caches.end()) return false;
+
+  Region region = cache->second.region;
+  sf::Sprite cache_sprite(cache->second.texture->getTexture(),
+                          sf::IntRect(0, 0, region.width, region.height));
+  cache_sprite.setPosition((Position(region.x, region.y) += get_offset()));
+
+  /* blending into the transparent texture leaves it premultiplied */
+  sf::BlendMode premultiplied_alpha(sf::BlendMode::One,
+                                    sf::BlendMode::OneMinusSrcAlpha);
+
+  draw_unbatched(cache_sprite, sf::RenderStates(premultiplied_alpha));
+  return true;
+}
+
+void Renderer::release_cache(const Window* owner) {
+  subtree_caches.erase(owner);
 }
 
 void Renderer::clear() {
+  /* targets left unflushed are given back to the pool, together with
+   * whatever was batched for them */
+  if (!offscreen_render_stack.empty()) {
+    batch.clear();
+    batch_target = nullptr;
+  }
+
   while (offscreen_render_stack.size()) {
+    release_offscreen_texture(offscreen_render_stack.top().texture);
     offscreen_render_stack.pop();
   }
-  offscreen_resources.clear();
+
+  ++frame_number;
+  trim_offscreen_pool();
   window.clear();
 
   while (!global_offsets.empty()) {
@@ -81,24 +214,98 @@ sf::RenderTarget* Renderer::get_target() {
 Position Renderer::get_offset() { return global_offsets.top(); }
 void Renderer::add_offset(Position offset) { global_offsets.push(offset); }
 
-void Renderer::show() { window.display(); }
+void Renderer::show() {
+  flush_batch();
+  window.display();
 
-void Renderer::draw_rectangle(Size size, Position pos, Color color) {
-  sf::RectangleShape rect = sf::RectangleShape(size);
-  rect.setPosition((pos += get_offset()));
-  rect.setFillColor(color);
+  last_frame_stats = frame_stats;
+  frame_stats = {};
+}
+
+RenderStats Renderer::get_render_stats() { return last_frame_stats; }
+
+sf::Vertex* Renderer::batch_vertices(const sf::Texture* texture,
+                                     size_t vertices_count) {
+  auto target = get_target();
+  assert(target != nullptr);
+
+  if (texture != batch_texture || target != batch_target) {
+    flush_batch();
+    batch_texture = texture;
+    batch_target = target;
+  }
+
+  size_t first_vertex = batch.getVertexCount();
+  batch.resize(first_vertex + vertices_count);
+  ++frame_stats.primitives;
+
+  return &batch[first_vertex];
+}
+
+void Renderer::batch_quad(const sf::Texture* texture, sf::FloatRect rect,
+                          sf::FloatRect texture_rect, sf::Color color) {
+  float right = rect.left + rect.width;
+  float bottom = rect.top + rect.height;
+  float texture_right = texture_rect.left + texture_rect.width;
+  float texture_bottom = texture_rect.top + texture_rect.height;
+
+  sf::Vertex* quad = batch_vertices(texture, 6);
+  quad[0] = sf::Vertex(sf::Vector2f(rect.left, rect.top), color,
+                       sf::Vector2f(texture_rect.left, texture_rect.top));
+  quad[1] = sf::Vertex(sf::Vector2f(right, rect.top), color,
+                       sf::Vector2f(texture_right, texture_rect.top));
+  quad[2] = sf::Vertex(sf::Vector2f(rect.left, bottom), color,
+                       sf::Vector2f(texture_rect.left, texture_bottom));
+  quad[3] = quad[2];
+  quad[4] = quad[1];
+  quad[5] = sf::Vertex(sf::Vector2f(right, bottom), color,
+                       sf::Vector2f(texture_right, texture_bottom));
+}
+
+void Renderer::flush_batch() {
+  if (batch.getVertexCount() == 0) return;
+
+  batch_target->draw(batch, sf::RenderStates(batch_texture));
+  ++frame_stats.draw_calls;
+  batch.clear();
+}
+
+void Renderer::draw_unbatched(const sf::Drawable& drawable,
+                              const sf::RenderStates& states) {
+  flush_batch();
 
   auto target = get_target();
   assert(target != nullptr);
-  target->draw(rect);
+  target->draw(drawable, states);
+  ++frame_stats.draw_calls;
+}
+
+const sf::Texture* Renderer::get_shape_texture() {
+  const sf::Texture& atlas = ResourceManager::get_atlas();
+  return atlas.getSize().x ? &atlas : nullptr;
+}
+
+void Renderer::draw_rectangle(Size size, Position pos, Color color) {
+  sf::Vector2f white_texel = ResourceManager::get_white_texel();
+
+  pos += get_offset();
+  batch_quad(get_shape_texture(),
+             sf::FloatRect(pos.x, pos.y, size.width, size.height),
+             sf::FloatRect(white_texel.x, white_texel.y, 0, 0), color);
 }
 
 void Renderer::draw_text(Text text, Position pos) {
   sf::Text sfml_text = Renderer::get_sfml_text(text);
   sfml_text.setPosition((pos += get_offset()));
 
-  auto target = get_target();
-  target->draw(sfml_text);
+  ++frame_stats.primitives;
+  draw_unbatched(sfml_text);
+}
+
+Size Renderer::get_text_size(Text text) {
+  auto bounds = Renderer::get_sfml_text(text).getGlobalBounds();
+  return Size(std::ceil(bounds.left + bounds.width),
+              std::ceil(bounds.top + bounds.height));
 }
 
 MouseButtonEvent::MouseButton Renderer::get_mouse_button(
@@ -161,6 +368,10 @@ Event* Renderer::translateKeyboardEvent(sf::Event::KeyEvent sf_key_data) {
       key = KEY::Slash;
       break;
     }
+    case sf::Keyboard::Escape: {
+      key = KEY::Escape;
+      break;
+    }
   }
   return new KeyPressedEvent(key, sf_key_data.shift, sf_key_data.control);
 }
@@ -169,11 +380,46 @@ Event* Renderer::poll_event() {
   sf::Event sf_event;
 
   if (!window.pollEvent(sf_event)) return nullptr;
+  return translate_event(sf_event);
+}
+
+Event* Renderer::wait_event(int32_t timeout_ms) {
+  sf::Event sf_event;
+
+  if (timeout_ms < 0) {
+    if (!window.waitEvent(sf_event)) return nullptr;
+    return translate_event(sf_event);
+  }
+
+  /* SFML can not wait with a timeout, so the window is polled between
+   * short sleeps */
+  sf::Clock clock;
+  while (!window.pollEvent(sf_event)) {
+    int32_t time_left = timeout_ms - clock.getElapsedTime().asMilliseconds();
+    if (time_left <= 0) return nullptr;
+
+    sf::sleep(sf::milliseconds(std::min(time_left, WAIT_POLL_INTERVAL_MS)));
+  }
+
+  return translate_event(sf_event);
+}
+
+void Renderer::set_vertical_sync(bool enabled) {
+  window.setVerticalSyncEnabled(enabled);
+}
 
+Event* Renderer::translate_event(const sf::Event& sf_event) {
   switch (sf_event.type) {
     case sf::Event::Closed: {
       return new WindowClosedEvent();
     }
+
+    /* the window contents have to be drawn again, even if nothing changed */
+    case sf::Event::Resized:
+    case sf::Event::GainedFocus: {
+      return new Event(WINDOW_EXPOSED);
+    }
+
     case sf::Event::MouseButtonPressed: {
       return Renderer::translateMouseEvent(sf_event.mouseButton,
                                            MouseButtonEvent::Action::PRESSED);
@@ -198,13 +444,8 @@ Event* Renderer::poll_event() {
 }
 
 sf::Text Renderer::get_sfml_text(Text text) {
-  if (!fonts.contains(text.font_path)) {
-    sf::Font new_font;
-    new_font.loadFromFile(text.font_path);
-    fonts[text.font_path] = new_font;
-  }
-
-  sf::Text sfml_text(text.text, fonts[text.font_path], text.character_size);
+  sf::Text sfml_text(text.text, ResourceManager::get_font(text.font_path),
+                     text.character_size);
   sfml_text.setLineSpacing(text.line_spacing);
   sfml_text.setFillColor(text.color);
 
@@ -217,59 +458,87 @@ Image Renderer::load_image(const char* filename) {
 
   sf::Vector2u img_size = sf_img.getSize();
 
-  Image img(Size(img_size.x, img_size.y), Color(255, 255, 255));
-
-  for (int x = 0; x < img_size.x; ++x) {
-    for (int y = 0; y < img_size.y; ++y) {
-      auto sfml_color = sf_img.getPixel(x, y);
-      img.setPixel(
-          x, y, Color(sfml_color.r, sfml_color.g, sfml_color.b, sfml_color.a));
-    }
-  }
+  Image img(img_size.x, img_size.y, Color(255, 255, 255));
+  img.write_region(Region(0, 0, img_size.x, img_size.y),
+                   sf_img.getPixelsPtr());
 
   return img;
 }
 
 void Renderer::save_image(Image& img, const char* filename) {
+  std::vector<uint8_t> pixels(static_cast<size_t>(img.get_width()) *
+                              img.get_height() * sizeof(Color));
+  img.read_region(Region(0, 0, img.get_width(), img.get_height()),
+                  pixels.data());
+
   sf::Image sf_img;
-  sf_img.create(img.get_size().width, img.get_size().height, sf::Color::Black);
+  sf_img.create(img.get_width(), img.get_height(), pixels.data());
 
-  for (int x = 0; x < img.get_size().width; ++x) {
-    for (int y = 0; y < img.get_size().height; ++y) {
-      sf_img.setPixel(x, y, img.getPixel(x, y));
-    }
+  sf_img.saveToFile(filename);
+}
+
+void Renderer::upload_dirty_regions(Image& img, sf::Texture& texture) {
+  for (auto& region : img.get_dirty_regions()) {
+    if (region.empty()) continue;
+
+    upload_buffer.resize(region.width * region.height * sizeof(Color));
+    img.read_region(region, upload_buffer.data());
+    texture.update(upload_buffer.data(), region.width, region.height,
+                   region.x, region.y);
   }
 
-  sf_img.saveToFile(filename);
+  img.clear_dirty_regions();
 }
 
 void Renderer::draw_image(Position pos, Image& img) {
-  sf::Texture img_texture;
-  img_texture.create(img.get_size().width, img.get_size().height);
-  img_texture.update(img.get_pixel_array());
+  sf::Texture& img_texture = image_textures[&img];
+  auto texture_size = img_texture.getSize();
 
-  sf::Sprite img_sprite(img_texture);
+  /* quads already batched have to show the texture before the update */
+  if (batch_texture == &img_texture) {
+    flush_batch();
+  }
 
-  img_sprite.setPosition((pos += get_offset()));
+  if (texture_size.x != img.get_width() || texture_size.y != img.get_height()) {
+    img_texture.create(img.get_width(), img.get_height());
+    img.mark_all_dirty();
+  }
 
-  auto target = get_target();
-  target->draw(img_sprite);
+  upload_dirty_regions(img, img_texture);
+
+  pos += get_offset();
+  batch_quad(&img_texture,
+             sf::FloatRect(pos.x, pos.y, img.get_width(), img.get_height()),
+             sf::FloatRect(0, 0, img.get_width(), img.get_height()),
+             sf::Color::White);
+}
+
+void Renderer::release_image(const Image& img) {
+  auto texture = image_textures.find(&img);
+  if (texture == image_textures.end()) return;
+
+  if (batch_texture == &texture->second) {
+    flush_batch();
+    batch_texture = nullptr;
+  }
+
+  image_textures.erase(texture);
 }
 
 void Renderer::draw_sprite(Texture texture, Position pos) {
-  if (!textures.contains(texture.path)) {
-    sf::Texture new_texture;
-    new_texture.loadFromFile(texture.path);
-    textures.insert({texture.path, new_texture});
+  /* quads already batched refer to the old layout of the atlas */
+  if (ResourceManager::is_atlas_outdated()) {
+    flush_batch();
+    ResourceManager::update_atlas();
   }
 
-  sf::Sprite sfml_sprite(textures[texture.path]);
-  sfml_sprite.setPosition((pos += get_offset()));
+  sf::IntRect icon_rect = ResourceManager::get_icon_rect(texture.handle);
+  if (icon_rect.width == 0) return;
 
   float x_scale_factor = 0;
   float y_scale_factor = 0;
 
-  auto real_size = textures[texture.path].getSize();
+  sf::Vector2u real_size(icon_rect.width, icon_rect.height);
 
   if (real_size.x > texture.size.width) {
     x_scale_factor = static_cast<float>(texture.size.width) / real_size.x;
@@ -283,10 +552,11 @@ void Renderer::draw_sprite(Texture texture, Position pos) {
     y_scale_factor = static_cast<float>(real_size.y) / texture.size.height;
   }
 
-  sfml_sprite.setScale(x_scale_factor, y_scale_factor);
-
-  auto target = get_target();
-  target->draw(sfml_sprite);
+  pos += get_offset();
+  batch_quad(&ResourceManager::get_icon_texture(texture.handle),
+             sf::FloatRect(pos.x, pos.y, real_size.x * x_scale_factor,
+                           real_size.y * y_scale_factor),
+             sf::FloatRect(icon_rect), sf::Color::White);
 }
 
 void Renderer::draw_delayed() {
@@ -317,7 +587,7 @@ void Renderer::add_delayed(DelayedRenderData delayed_data) {
 void Renderer::remove_delayed() { has_delayed = false; }
 
 void Renderer::draw_ellipse(Size size, Position pos, Color color) {
-  sf::CircleShape ellipse(std::max(abs(size.width), abs(size.height)) / 2);
+  float radius = std::max(abs(size.width), abs(size.height)) / 2;
 
   if (size.width < 0) {
     pos.x += size.width;
@@ -327,21 +597,34 @@ void Renderer::draw_ellipse(Size size, Position pos, Color color) {
     pos.y += size.height;
   }
 
-  ellipse.setFillColor(color);
-  ellipse.setPosition((pos += get_offset()));
+  pos += get_offset();
 
-  float scale = 0;
+  float x_scale = 1.f;
+  float y_scale = 1.f;
 
   if (abs(size.width) > abs(size.height)) {
-    scale = fabs(static_cast<float>(size.height) / size.width);
-    ellipse.setScale(1.f, scale);
+    y_scale = fabs(static_cast<float>(size.height) / size.width);
   } else {
-    scale = fabs(static_cast<float>(size.width) / size.height);
-    ellipse.setScale(scale, 1.f);
+    x_scale = fabs(static_cast<float>(size.width) / size.height);
   }
 
-  auto target = get_target();
-  target->draw(ellipse);
+  /* the same fan of triangles sf::CircleShape is drawn with */
+  auto get_point = [&](size_t index) {
+    float angle = index * 2 * M_PI / ELLIPSE_POINT_COUNT - M_PI / 2;
+    return sf::Vector2f(pos.x + (radius + radius * std::cos(angle)) * x_scale,
+                        pos.y + (radius + radius * std::sin(angle)) * y_scale);
+  };
+
+  sf::Vector2f center(pos.x + radius * x_scale, pos.y + radius * y_scale);
+  sf::Vector2f white_texel = ResourceManager::get_white_texel();
+  sf::Vertex* fan =
+      batch_vertices(get_shape_texture(), 3 * ELLIPSE_POINT_COUNT);
+
+  for (size_t i = 0; i < ELLIPSE_POINT_COUNT; ++i) {
+    fan[3 * i] = sf::Vertex(center, color, white_texel);
+    fan[3 * i + 1] = sf::Vertex(get_point(i), color, white_texel);
+    fan[3 * i + 2] = sf::Vertex(get_point(i + 1), color, white_texel);
+  }
 }
 
 void Renderer::remove_offset() { global_offsets.pop(); }
@@ -15,12 +15,14 @@
 #include <SFML/Window/Event.hpp>
 #include <SFML/Window/VideoMode.hpp>
 #include <cassert>
+#include <memory>
 #include <stack>
 #include <unordered_map>
 #include <cmath>
 
 #include "../data_classes/data_classes.hpp"
 #include "../event/event.hpp"
+#include "../resource_manager/resource_manager.hpp"
 
 enum DELAYED_RENDER_TYPES { RECT, ELLIPSE };
 
@@ -31,13 +33,42 @@ struct DelayedRenderData {
   Color color;
 };
 
+/* entry of the offscreen target stack, flushed to pos of the target below */
 struct OffscreenRenderData {
-  sf::Sprite* sprite;
   sf::RenderTexture* texture;
+  Position pos;
+};
+
+/* render texture kept between frames for offscreen targets of its size */
+struct PooledRenderTexture {
+  std::unique_ptr<sf::RenderTexture> texture;
+  Size size;
+  bool in_use;
+  uint64_t last_used_frame;
+};
+
+struct OffscreenPoolStats {
+  size_t textures;
+  size_t bytes;
+  /* counted since the start */
+  size_t allocations;
+  size_t reuses;
+  size_t releases;
+};
 
-  OffscreenRenderData();
+/* counted per frame, from one show() to the next */
+struct RenderStats {
+  size_t draw_calls;
+  /* rectangles, ellipses, sprites, images and texts */
+  size_t primitives;
+};
+
+class Window;
 
-  void release();
+/* rendered subtree of a window, region is where it is drawn */
+struct SubtreeCache {
+  std::unique_ptr<sf::RenderTexture> texture;
+  Region region;
 };
 
 class Renderer {
@@ -47,15 +78,46 @@ class Renderer {
   static DelayedRenderData delayed_render;
   static bool has_delayed;
 
-  static std::unordered_map<const char*, sf::Font> fonts;
-  static std::unordered_map<const char*, sf::Texture> textures;
-  static std::vector<OffscreenRenderData> offscreen_resources;
+  static std::unordered_map<const Image*, sf::Texture> image_textures;
+  static std::unordered_map<const Window*, SubtreeCache> subtree_caches;
+  static std::vector<uint8_t> upload_buffer;
+  static std::vector<PooledRenderTexture> offscreen_pool;
+  static OffscreenPoolStats offscreen_pool_stats;
   static std::stack<OffscreenRenderData> offscreen_render_stack;
+  static uint64_t frame_number;
+
+  /* consecutive primitives with the same texture and target are drawn by
+   * one call, shapes share the icon atlas, so toolbars are one batch */
+  static sf::VertexArray batch;
+  static const sf::Texture* batch_texture;
+  static sf::RenderTarget* batch_target;
+
+  static RenderStats frame_stats;
+  static RenderStats last_frame_stats;
   static std::stack<Position> global_offsets;
 
   static sf::RenderTarget* get_target();
 
+  static void batch_quad(const sf::Texture* texture, sf::FloatRect rect,
+                         sf::FloatRect texture_rect, sf::Color color);
+  /* makes room for vertices_count vertices, returns the first of them */
+  static sf::Vertex* batch_vertices(const sf::Texture* texture,
+                                    size_t vertices_count);
+  static void flush_batch();
+  /* atlas with a white texel, nullptr until the atlas is built */
+  static const sf::Texture* get_shape_texture();
+  /* for drawables which can not be batched, keeps the painter's order */
+  static void draw_unbatched(const sf::Drawable& drawable,
+                             const sf::RenderStates& states =
+                                 sf::RenderStates::Default);
+
+  static sf::RenderTexture* acquire_offscreen_texture(Size size);
+  static void release_offscreen_texture(const sf::RenderTexture* texture);
+  /* frees textures which no target used for a while */
+  static void trim_offscreen_pool();
+
   static sf::Text get_sfml_text(Text text);
+  static void upload_dirty_regions(Image& img, sf::Texture& texture);
   static sf::Image get_sfml_image(
       const std::vector<std::vector<Color>>& buffer);
 
@@ -63,6 +125,8 @@ class Renderer {
   static Event* translateMouseEvent(sf::Event::MouseButtonEvent sf_mouse_data,
                                     MouseButtonEvent::Action action);
   static Event* translateKeyboardEvent(sf::Event::KeyEvent sf_key_data);
+  /* nullptr for events the application does not handle */
+  static Event* translate_event(const sf::Event& sf_event);
 
   Renderer();
 
@@ -70,20 +134,37 @@ class Renderer {
   static void init(Size window_size, const char* name);
   static void deinit();
 
+  /* targets reuse pooled textures of the same size */
   static void init_offscreen_target(Size target_size, Position target_pos);
   static void flush_offscreen_target();
+  static OffscreenPoolStats get_offscreen_pool_stats();
+  static RenderStats get_render_stats();
+
+  /* everything drawn between the calls goes into the cache of owner */
+  static void begin_cache(const Window* owner, Region region);
+  static void end_cache();
+  /* returns false if owner has no cache */
+  static bool draw_cache(const Window* owner);
+  static void release_cache(const Window* owner);
 
   static void clear();
   static void show();
 
   static Event* poll_event();
+  /* waits for the next event at most timeout_ms, forever if it is negative,
+   * returns nullptr on timeout */
+  static Event* wait_event(int32_t timeout_ms);
+
+  static void set_vertical_sync(bool enabled);
 
   static Image load_image(const char* filename);
   static void save_image(Image& img, const char* filename);
 
   static void draw_image(Position pos, Image& img);
+  static void release_image(const Image& img);
   static void draw_rectangle(Size size, Position pos, Color color);
   static void draw_text(Text text, Position pos);
+  static Size get_text_size(Text text);
   static void draw_ellipse(Size size, Position pos, Color color);
 
   static void draw_sprite(Texture texture, Position pos);
@@ -0,0 +1,228 @@
+/*!
+ * Brush stamp micro-benchmark. For every thickness in the range stamps the
+ * same random centers of a synthetic canvas with the per-pixel circle test
+ * the instruments used before BrushStampCache, and with every cached stamp
+ * shape, then prints JSON with stamps and megapixels per second of each.
+ *
+ * usage: stamp_bench [--width <pixels>] [--height <pixels>]
+ *                    [--stamps <count>] [--min-thickness <pixels>]
+ *                    [--max-thickness <pixels>] [--output <file>]
+ * */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../brush_stamps/brush_stamps.hpp"
+#include "../data_classes/data_classes.hpp"
+
+const unsigned BENCH_SEED = 1;
+const long MAX_CANVAS_SIZE = 1 << 15;
+const long MAX_STAMPS = 1 << 24;
+const long MAX_BENCH_THICKNESS = 255;
+
+struct BenchConfig {
+  std::string output_path;
+  int width = 1920;
+  int height = 1080;
+  int stamps = 2000;
+  int min_thickness = 1;
+  int max_thickness = 40;
+};
+
+struct StampResult {
+  double seconds = 0;
+  size_t pixels = 0;
+};
+
+static void print_usage() {
+  fprintf(stderr,
+          "usage: stamp_bench [--width <pixels>] [--height <pixels>]\n"
+          "                   [--stamps <count>] [--min-thickness <pixels>]\n"
+          "                   [--max-thickness <pixels>] [--output <file>]\n");
+}
+
+static bool parse_number(const char* text, long min, long max, long& value) {
+  char* end = nullptr;
+  value = strtol(text, &end, 10);
+  return *text && !*end && value >= min && value <= max;
+}
+
+static bool parse_args(int argc, char** argv, BenchConfig& config) {
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 == argc) return false;
+
+    const char* option = argv[i];
+    const char* value = argv[++i];
+    long number = 0;
+
+    if (!strcmp(option, "--output")) {
+      config.output_path = value;
+    } else if (!strcmp(option, "--width") &&
+               parse_number(value, 1, MAX_CANVAS_SIZE, number)) {
+      config.width = number;
+    } else if (!strcmp(option, "--height") &&
+               parse_number(value, 1, MAX_CANVAS_SIZE, number)) {
+      config.height = number;
+    } else if (!strcmp(option, "--stamps") &&
+               parse_number(value, 1, MAX_STAMPS, number)) {
+      config.stamps = number;
+    } else if (!strcmp(option, "--min-thickness") &&
+               parse_number(value, 1, MAX_BENCH_THICKNESS, number)) {
+      config.min_thickness = number;
+    } else if (!strcmp(option, "--max-thickness") &&
+               parse_number(value, 1, MAX_BENCH_THICKNESS, number)) {
+      config.max_thickness = number;
+    } else {
+      return false;
+    }
+  }
+
+  return config.min_thickness <= config.max_thickness;
+}
+
+/* what instruments did for every stamp before the cache */
+static size_t stamp_reference(Image& canvas, int thickness, Position center,
+                              Color color) {
+  size_t pixels = 0;
+
+  for (int i = -thickness; i <= thickness; ++i) {
+    for (int j = -thickness; j <= thickness; ++j) {
+      if (i * i + j * j < thickness * thickness) {
+        canvas.setPixel(center.x + i, center.y + j, color);
+        ++pixels;
+      }
+    }
+  }
+
+  return pixels;
+}
+
+static size_t get_stamp_pixels(BRUSH_SHAPE shape, int thickness) {
+  size_t pixels = 0;
+  for (auto& span : BrushStampCache::get(shape, thickness).spans) {
+    pixels += span.length;
+  }
+
+  return pixels;
+}
+
+template <typename Stamp>
+static StampResult time_stamps(const std::vector<Position>& centers,
+                               Stamp stamp) {
+  StampResult result;
+
+  auto start = std::chrono::steady_clock::now();
+  for (auto& center : centers) {
+    result.pixels += stamp(center);
+  }
+  std::chrono::duration<double> duration =
+      std::chrono::steady_clock::now() - start;
+
+  result.seconds = duration.count();
+  return result;
+}
+
+static void print_result(FILE* output, const char* name,
+                         const StampResult& result, size_t stamps,
+                         bool last) {
+  double stamps_per_second = result.seconds > 0 ? stamps / result.seconds : 0;
+  double throughput =
+      result.seconds > 0 ? result.pixels / result.seconds / 1e6 : 0;
+
+  fprintf(output,
+          "      \"%s\": {\"seconds\": %.6f, \"stamps_per_second\": %.1f, "
+          "\"megapixels_per_second\": %.3f}%s\n",
+          name, result.seconds, stamps_per_second, throughput,
+          last ? "" : ",");
+}
+
+int main(int argc, char** argv) {
+  BenchConfig config;
+  if (!parse_args(argc, argv, config)) {
+    print_usage();
+    return 1;
+  }
+
+  FILE* output = stdout;
+  if (!config.output_path.empty()) {
+    output = fopen(config.output_path.data(), "w");
+    if (!output) {
+      fprintf(stderr, "stamp_bench: can not write %s\n",
+              config.output_path.data());
+      return 1;
+    }
+  }
+
+  Image canvas(config.width, config.height, Color(255, 255, 255));
+  Color color(51, 102, 204);
+
+  /* tiles are allocated on the first write, which is not what is measured */
+  canvas.fill_rect(Region(0, 0, config.width, config.height),
+                   Color(255, 255, 255));
+
+  std::minstd_rand randomizer(BENCH_SEED);
+  std::vector<Position> centers(config.stamps);
+  for (auto& center : centers) {
+    center = Position(randomizer() % config.width,
+                      randomizer() % config.height);
+  }
+
+  fprintf(output,
+          "{\n  \"width\": %d,\n  \"height\": %d,\n  \"stamps\": %d,\n"
+          "  \"thicknesses\": [\n",
+          config.width, config.height, config.stamps);
+
+  for (int thickness = config.min_thickness;
+       thickness <= config.max_thickness; ++thickness) {
+    /* stamps are built outside of the timed loops, as the cache keeps them
+     * for the whole session */
+    size_t hard_disc_pixels = get_stamp_pixels(HARD_DISC, thickness);
+    size_t soft_disc_pixels = get_stamp_pixels(SOFT_DISC, thickness);
+    size_t square_pixels = get_stamp_pixels(SQUARE, thickness);
+
+    StampResult reference = time_stamps(centers, [&](Position center) {
+      return stamp_reference(canvas, thickness, center, color);
+    });
+
+    StampResult hard_disc = time_stamps(centers, [&](Position center) {
+      BrushStampCache::stamp(canvas, HARD_DISC, thickness, center, color);
+      return hard_disc_pixels;
+    });
+
+    StampResult soft_disc = time_stamps(centers, [&](Position center) {
+      BrushStampCache::stamp(canvas, SOFT_DISC, thickness, center, color);
+      return soft_disc_pixels;
+    });
+
+    StampResult square = time_stamps(centers, [&](Position center) {
+      BrushStampCache::stamp(canvas, SQUARE, thickness, center, color);
+      return square_pixels;
+    });
+
+    double speedup =
+        hard_disc.seconds > 0 ? reference.seconds / hard_disc.seconds : 0;
+
+    fprintf(output, "    {\n      \"thickness\": %d,\n", thickness);
+    print_result(output, "reference", reference, centers.size(), false);
+    print_result(output, "hard_disc", hard_disc, centers.size(), false);
+    print_result(output, "soft_disc", soft_disc, centers.size(), false);
+    print_result(output, "square", square, centers.size(), false);
+    fprintf(output, "      \"hard_disc_speedup\": %.2f\n    }%s\n", speedup,
+            thickness < config.max_thickness ? "," : "");
+
+    canvas.clear_dirty_regions();
+  }
+
+  fprintf(output, "  ]\n}\n");
+
+  if (output != stdout) {
+    fclose(output);
+  }
+
+  return 0;
+}
@@ -0,0 +1,134 @@
+#include "thread_pool.hpp"
+
+std::vector<std::thread> ThreadPool::workers;
+std::vector<std::unique_ptr<ThreadPool::WorkerQueue>> ThreadPool::queues;
+
+std::mutex ThreadPool::wake_mutex;
+std::condition_variable ThreadPool::wake_condition;
+std::atomic<size_t> ThreadPool::queued_tasks = 0;
+bool ThreadPool::stopping = false;
+
+void ThreadPool::init(size_t threads_count) {
+  if (!workers.empty()) return;
+
+  if (!threads_count) {
+    threads_count = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  stopping = false;
+
+  for (size_t i = 0; i < threads_count; ++i) {
+    queues.push_back(std::make_unique<WorkerQueue>());
+  }
+
+  for (size_t i = 0; i < threads_count; ++i) {
+    workers.emplace_back(worker_loop, i);
+  }
+}
+
+void ThreadPool::deinit() {
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex);
+    stopping = true;
+  }
+  wake_condition.notify_all();
+
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  workers.clear();
+  queues.clear();
+}
+
+size_t ThreadPool::get_threads_count() { return workers.size(); }
+
+bool ThreadPool::run_task(size_t first_queue) {
+  std::function<void()> task;
+
+  /* own queue is used as a stack to keep its data hot in cache, the other
+   * queues are robbed from the opposite end */
+  for (size_t i = 0; i < queues.size() && !task; ++i) {
+    auto& queue = *queues[(first_queue + i) % queues.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+
+    if (queue.tasks.empty()) continue;
+
+    if (i == 0) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    } else {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+  }
+
+  if (!task) return false;
+
+  --queued_tasks;
+  task();
+  return true;
+}
+
+void ThreadPool::worker_loop(size_t index) {
+  while (true) {
+    if (run_task(index)) continue;
+
+    std::unique_lock<std::mutex> lock(wake_mutex);
+    wake_condition.wait(lock, [] { return stopping || queued_tasks > 0; });
+
+    if (stopping) return;
+  }
+}
+
+void ThreadPool::parallel_for(size_t count,
+                              const std::function<void(size_t)>& task) {
+  if (!count) return;
+
+  /* without workers, or for a single task, the pool is only an overhead */
+  if (queues.empty() || count == 1) {
+    for (size_t i = 0; i < count; ++i) {
+      task(i);
+    }
+    return;
+  }
+
+  std::atomic<size_t> remaining = count;
+  std::mutex done_mutex;
+  std::condition_variable done_condition;
+
+  for (size_t i = 0; i < count; ++i) {
+    auto& queue = *queues[i % queues.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+
+    queue.tasks.push_back([&, i] {
+      task(i);
+
+      /* decremented under the lock, so the caller cannot return and
+       * destroy the mutex while the last task still holds it */
+      std::lock_guard<std::mutex> done_lock(done_mutex);
+      if (--remaining == 0) {
+        done_condition.notify_all();
+      }
+    });
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex);
+    queued_tasks += count;
+  }
+  wake_condition.notify_all();
+
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(done_mutex);
+      if (remaining == 0) return;
+    }
+
+    if (run_task(0)) continue;
+
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done_condition.wait(lock, [&] { return remaining == 0; });
+    return;
+  }
+}
@@ -0,0 +1,57 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*!
+ * Work-stealing pool of worker threads. Every worker owns a task deque: it
+ * takes tasks from the back of its own deque and, when it runs out of work,
+ * steals from the front of the other deques, so uneven tasks are balanced
+ * between workers without a central queue.
+ * */
+class ThreadPool {
+ private:
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  static std::vector<std::thread> workers;
+  static std::vector<std::unique_ptr<WorkerQueue>> queues;
+
+  static std::mutex wake_mutex;
+  static std::condition_variable wake_condition;
+  static std::atomic<size_t> queued_tasks;
+  static bool stopping;
+
+  static void worker_loop(size_t index);
+  static bool run_task(size_t first_queue);
+
+ public:
+  /*!
+   * Starts worker threads
+   * @param threads_count number of workers, 0 means one per hardware thread
+   * */
+  static void init(size_t threads_count = 0);
+  static void deinit();
+
+  /*!
+   * Runs task(0) ... task(count - 1) on the pool and returns when all of
+   * them are done. The calling thread executes tasks as well while waiting.
+   * */
+  static void parallel_for(size_t count,
+                           const std::function<void(size_t)>& task);
+
+  static size_t get_threads_count();
+
+  ThreadPool() = delete;
+};
+
+#endif
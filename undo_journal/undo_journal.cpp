@@ -0,0 +1,407 @@
+#include "undo_journal.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+
+const size_t UNDO_MEMORY_BUDGET = 256 * 1024 * 1024;
+const size_t UNDO_MAX_LEVELS = 100;
+
+/* Delta is a sequence of tokens, header of each token holds token type in
+ * two upper bits and word count in the rest */
+enum DELTA_TOKEN { ZERO_RUN, REPEAT_RUN, LITERAL_RUN };
+
+const int DELTA_TOKEN_SHIFT = 30;
+const uint32_t DELTA_COUNT_MASK = (1u << DELTA_TOKEN_SHIFT) - 1;
+const size_t DELTA_MIN_REPEAT = 3;
+
+UndoJournal::UndoJournal(size_t memory_budget, size_t max_levels)
+    : memory_budget(memory_budget),
+      max_levels(max_levels),
+      memory_used(0),
+      spill_file(nullptr),
+      spill_end(0),
+      spilled_count(0) {}
+
+UndoJournal::~UndoJournal() { clear(); }
+
+/*---------------------------------------*/
+/*             Compression               */
+/*---------------------------------------*/
+
+void UndoJournal::compress(const std::vector<uint32_t>& words,
+                           std::vector<uint32_t>& data) {
+  size_t literal_start = 0;
+  size_t pos = 0;
+
+  auto flush_literal = [&](size_t end) {
+    if (end == literal_start) return;
+
+    data.push_back((LITERAL_RUN << DELTA_TOKEN_SHIFT) | (end - literal_start));
+    data.insert(data.end(), words.begin() + literal_start,
+                words.begin() + end);
+  };
+
+  while (pos < words.size()) {
+    size_t run = 1;
+    while (pos + run < words.size() && words[pos + run] == words[pos]) {
+      ++run;
+    }
+
+    if (words[pos] != 0 && run < DELTA_MIN_REPEAT) {
+      pos += run;
+      continue;
+    }
+
+    flush_literal(pos);
+
+    if (words[pos] == 0) {
+      data.push_back((ZERO_RUN << DELTA_TOKEN_SHIFT) | run);
+    } else {
+      data.push_back((REPEAT_RUN << DELTA_TOKEN_SHIFT) | run);
+      data.push_back(words[pos]);
+    }
+
+    pos += run;
+    literal_start = pos;
+  }
+
+  flush_literal(pos);
+}
+
+void UndoJournal::apply_xor(const std::vector<uint32_t>& data,
+                            std::vector<uint32_t>& words) {
+  size_t pos = 0;
+
+  for (size_t i = 0; i < data.size();) {
+    uint32_t type = data[i] >> DELTA_TOKEN_SHIFT;
+    uint32_t count = data[i] & DELTA_COUNT_MASK;
+    ++i;
+
+    switch (type) {
+      case REPEAT_RUN: {
+        for (uint32_t j = 0; j < count; ++j) {
+          words[pos + j] ^= data[i];
+        }
+        ++i;
+        break;
+      }
+
+      case LITERAL_RUN: {
+        for (uint32_t j = 0; j < count; ++j) {
+          words[pos + j] ^= data[i + j];
+        }
+        i += count;
+        break;
+      }
+    }
+
+    pos += count;
+  }
+}
+
+/*---------------------------------------*/
+/*               Journal                 */
+/*---------------------------------------*/
+
+void UndoJournal::begin(const Image& img) {
+  snapshot = std::make_unique<Image>(img);
+}
+
+bool UndoJournal::is_recording() const { return snapshot != nullptr; }
+
+void UndoJournal::commit(const Image& img) {
+  if (!snapshot) return;
+
+  if (snapshot->get_width() != img.get_width() ||
+      snapshot->get_height() != img.get_height()) {
+    clear();
+    return;
+  }
+
+  Entry entry = {};
+
+  for (auto& region : img.get_changed_tiles(*snapshot)) {
+    size_t pixels_count = region.width * region.height;
+    before_buffer.resize(pixels_count);
+    after_buffer.resize(pixels_count);
+
+    snapshot->read_region(region,
+                          reinterpret_cast<uint8_t*>(before_buffer.data()));
+    img.read_region(region, reinterpret_cast<uint8_t*>(after_buffer.data()));
+
+    bool changed = false;
+    for (size_t i = 0; i < pixels_count; ++i) {
+      after_buffer[i] ^= before_buffer[i];
+      changed |= after_buffer[i] != 0;
+    }
+
+    if (!changed) continue;
+
+    TileDelta delta = {region, {}};
+    compress(after_buffer, delta.data);
+    entry.memory_size += delta.data.size() * sizeof(uint32_t);
+
+    entry.deltas.push_back(std::move(delta));
+  }
+
+  snapshot.reset();
+
+  if (entry.deltas.empty()) return;
+
+  for (auto& redo_entry : redo_entries) {
+    memory_used -= redo_entry.memory_size;
+  }
+  redo_entries.clear();
+
+  memory_used += entry.memory_size;
+  undo_entries.push_back(std::move(entry));
+
+  enforce_budget();
+}
+
+bool UndoJournal::apply(Image& img, Entry& entry) {
+  if (entry.spilled && !restore(entry)) return false;
+
+  for (auto& delta : entry.deltas) {
+    before_buffer.resize(delta.region.width * delta.region.height);
+    img.read_region(delta.region,
+                    reinterpret_cast<uint8_t*>(before_buffer.data()));
+    apply_xor(delta.data, before_buffer);
+    img.write_region(delta.region,
+                     reinterpret_cast<uint8_t*>(before_buffer.data()));
+  }
+
+  return true;
+}
+
+bool UndoJournal::undo(Image& img) {
+  if (undo_entries.empty()) return false;
+
+  /* older operations can not be undone without this one */
+  if (!apply(img, undo_entries.back())) {
+    drop_oldest(undo_entries.size());
+    return false;
+  }
+
+  Entry entry = std::move(undo_entries.back());
+  undo_entries.pop_back();
+  redo_entries.push_back(std::move(entry));
+
+  enforce_budget();
+  return true;
+}
+
+bool UndoJournal::redo(Image& img) {
+  if (redo_entries.empty()) return false;
+
+  Entry entry = std::move(redo_entries.back());
+  redo_entries.pop_back();
+
+  apply(img, entry);
+  undo_entries.push_back(std::move(entry));
+
+  enforce_budget();
+  return true;
+}
+
+void UndoJournal::clear() {
+  undo_entries.clear();
+  redo_entries.clear();
+  snapshot.reset();
+  memory_used = 0;
+
+  if (spill_file) {
+    fclose(spill_file);
+    spill_file = nullptr;
+  }
+
+  free_extents.clear();
+  spill_end = 0;
+  spilled_count = 0;
+}
+
+/*---------------------------------------*/
+/*            Memory budget              */
+/*---------------------------------------*/
+
+void UndoJournal::enforce_budget() {
+  if (undo_entries.size() > max_levels) {
+    drop_oldest(undo_entries.size() - max_levels);
+  }
+
+  /* the oldest operations are the least likely to be undone */
+  size_t i = 0;
+  while (memory_used > memory_budget && i < undo_entries.size()) {
+    if (undo_entries[i].spilled || spill(undo_entries[i])) {
+      ++i;
+      continue;
+    }
+
+    drop_oldest(i + 1);
+    i = 0;
+  }
+}
+
+void UndoJournal::drop_oldest(size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    Entry& entry = undo_entries.front();
+
+    if (entry.spilled) {
+      release_spill(entry);
+    } else {
+      memory_used -= entry.memory_size;
+    }
+
+    undo_entries.pop_front();
+  }
+}
+
+/* first fit, the file grows only when no free extent is large enough */
+long UndoJournal::allocate_extent(long size) {
+  for (auto extent = free_extents.begin(); extent != free_extents.end();
+       ++extent) {
+    if (extent->size < size) continue;
+
+    long offset = extent->offset;
+    extent->offset += size;
+    extent->size -= size;
+
+    if (extent->size == 0) {
+      free_extents.erase(extent);
+    }
+
+    return offset;
+  }
+
+  long offset = spill_end;
+  spill_end += size;
+  return offset;
+}
+
+/* extents are kept sorted by offset and merged with their neighbours */
+void UndoJournal::free_extent(long offset, long size) {
+  auto next = std::lower_bound(
+      free_extents.begin(), free_extents.end(), offset,
+      [](const SpillExtent& extent, long value) {
+        return extent.offset < value;
+      });
+  auto extent = free_extents.insert(next, SpillExtent{offset, size});
+
+  if (extent + 1 != free_extents.end() &&
+      extent->offset + extent->size == (extent + 1)->offset) {
+    extent->size += (extent + 1)->size;
+    free_extents.erase(extent + 1);
+  }
+
+  if (extent != free_extents.begin() &&
+      (extent - 1)->offset + (extent - 1)->size == extent->offset) {
+    (extent - 1)->size += extent->size;
+    extent = free_extents.erase(extent) - 1;
+  }
+
+  /* the tail of the file is given back to the file system */
+  if (extent->offset + extent->size == spill_end) {
+    long new_end = extent->offset;
+    free_extents.erase(extent);
+    truncate_spill(new_end);
+  }
+}
+
+void UndoJournal::truncate_spill(long size) {
+  spill_end = size;
+
+  /* if this fails the file only stays larger than needed */
+  if (ftruncate(fileno(spill_file), size) != 0) return;
+}
+
+bool UndoJournal::spill(Entry& entry) {
+  if (!spill_file) {
+    spill_file = tmpfile();
+    if (!spill_file) return false;
+  }
+
+  entry.file_size = sizeof(uint32_t);
+  for (auto& delta : entry.deltas) {
+    entry.file_size += sizeof(Region) + sizeof(uint32_t) +
+                       delta.data.size() * sizeof(uint32_t);
+  }
+
+  entry.file_offset = allocate_extent(entry.file_size);
+
+  uint32_t deltas_count = entry.deltas.size();
+  bool written = fseek(spill_file, entry.file_offset, SEEK_SET) == 0 &&
+                 fwrite(&deltas_count, sizeof(deltas_count), 1, spill_file) ==
+                     1;
+
+  for (auto& delta : entry.deltas) {
+    if (!written) break;
+
+    uint32_t data_size = delta.data.size();
+    written =
+        fwrite(&delta.region, sizeof(Region), 1, spill_file) == 1 &&
+        fwrite(&data_size, sizeof(data_size), 1, spill_file) == 1 &&
+        fwrite(delta.data.data(), sizeof(uint32_t), data_size, spill_file) ==
+            data_size;
+  }
+
+  /* a short write may only show up when the buffer is flushed */
+  if (!written || fflush(spill_file) != 0) {
+    clearerr(spill_file);
+    free_extent(entry.file_offset, entry.file_size);
+    return false;
+  }
+
+  std::vector<TileDelta>().swap(entry.deltas);
+  entry.spilled = true;
+  ++spilled_count;
+  memory_used -= entry.memory_size;
+  return true;
+}
+
+bool UndoJournal::restore(Entry& entry) {
+  uint32_t deltas_count = 0;
+  bool read = fseek(spill_file, entry.file_offset, SEEK_SET) == 0 &&
+              fread(&deltas_count, sizeof(deltas_count), 1, spill_file) == 1 &&
+              deltas_count * (sizeof(Region) + sizeof(uint32_t)) <
+                  static_cast<size_t>(entry.file_size);
+
+  std::vector<TileDelta> deltas(read ? deltas_count : 0);
+
+  for (auto& delta : deltas) {
+    uint32_t data_size = 0;
+    read = fread(&delta.region, sizeof(Region), 1, spill_file) == 1 &&
+           fread(&data_size, sizeof(data_size), 1, spill_file) == 1 &&
+           data_size * sizeof(uint32_t) <= entry.memory_size;
+    if (!read) break;
+
+    delta.data.resize(data_size);
+    read = fread(delta.data.data(), sizeof(uint32_t), data_size,
+                 spill_file) == data_size;
+    if (!read) break;
+  }
+
+  if (!read) {
+    clearerr(spill_file);
+    return false;
+  }
+
+  release_spill(entry);
+  entry.deltas = std::move(deltas);
+  memory_used += entry.memory_size;
+  return true;
+}
+
+void UndoJournal::release_spill(Entry& entry) {
+  entry.spilled = false;
+  --spilled_count;
+
+  /* nothing is left in the file, so it is emptied at once */
+  if (spilled_count == 0) {
+    free_extents.clear();
+    truncate_spill(0);
+    return;
+  }
+
+  free_extent(entry.file_offset, entry.file_size);
+}
@@ -0,0 +1,108 @@
+#ifndef UNDO_JOURNAL_HPP
+#define UNDO_JOURNAL_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "../data_classes/data_classes.hpp"
+
+extern const size_t UNDO_MEMORY_BUDGET;
+extern const size_t UNDO_MAX_LEVELS;
+
+/*!
+ * Undo/redo history of an image. Each operation is stored as XOR of the
+ * tiles it changed before and after the operation, so the same delta is
+ * applied both to undo and to redo it. Deltas are run-length compressed and
+ * the oldest operations are moved to a temporary file when the journal
+ * exceeds its memory budget. Space of operations read back or dropped is
+ * reused, and the file is truncated once no operation is left in it.
+ *
+ * Deltas only make sense applied in order, so when an operation can not be
+ * written to or read from the file, it is dropped with all the older ones.
+ * */
+class UndoJournal {
+ private:
+  struct TileDelta {
+    Region region;
+    std::vector<uint32_t> data;
+  };
+
+  struct Entry {
+    std::vector<TileDelta> deltas;
+    size_t memory_size;
+
+    bool spilled;
+    long file_offset;
+    long file_size;
+  };
+
+  /* unused range of the spill file */
+  struct SpillExtent {
+    long offset;
+    long size;
+  };
+
+  size_t memory_budget;
+  size_t max_levels;
+  size_t memory_used;
+
+  std::deque<Entry> undo_entries;
+  std::vector<Entry> redo_entries;
+  std::unique_ptr<Image> snapshot;
+
+  FILE* spill_file;
+  std::vector<SpillExtent> free_extents;
+  /* bytes of the file used by extents, live or free */
+  long spill_end;
+  size_t spilled_count;
+
+  std::vector<uint32_t> before_buffer;
+  std::vector<uint32_t> after_buffer;
+
+  static void compress(const std::vector<uint32_t>& words,
+                       std::vector<uint32_t>& data);
+  static void apply_xor(const std::vector<uint32_t>& data,
+                        std::vector<uint32_t>& words);
+
+  bool apply(Image& img, Entry& entry);
+  void enforce_budget();
+  /* drops count oldest undo entries */
+  void drop_oldest(size_t count);
+
+  long allocate_extent(long size);
+  void free_extent(long offset, long size);
+  void truncate_spill(long size);
+  bool spill(Entry& entry);
+  bool restore(Entry& entry);
+  void release_spill(Entry& entry);
+
+ public:
+  UndoJournal(size_t memory_budget = UNDO_MEMORY_BUDGET,
+              size_t max_levels = UNDO_MAX_LEVELS);
+  UndoJournal(const UndoJournal& other) = delete;
+  ~UndoJournal();
+
+  /*!
+   * Starts recording an operation. Image is copied by sharing its tiles, so
+   * this doesn't depend on the image size.
+   * */
+  void begin(const Image& img);
+
+  /*!
+   * Finishes the operation started with begin(), storing the tiles which
+   * have been changed since then
+   * */
+  void commit(const Image& img);
+
+  bool is_recording() const;
+
+  bool undo(Image& img);
+  bool redo(Image& img);
+
+  void clear();
+};
+
+#endif
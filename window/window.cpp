@@ -9,6 +9,13 @@ const float INPUTBOX_TEXT_OFFSET = 5;
 const int16_t INPUTBOX_SAVE_DIALOG_OFFSET_X = 30;
 const int16_t INPUTBOX_SAVE_DIALOG_OFFSET_Y = 530;
 const int16_t DIRECTORY_ENTRY_TEXT_OFFSET = 5;
+const int16_t PROGRESS_HEIGHT = 6;
+const Color PROGRESS_COLOR = Color(70, 130, 220);
+const Color PROGRESS_BACKGROUND_COLOR = Color(200, 200, 200);
+const Color PLUGIN_BUTTON_COLOR = Color(236, 236, 236);
+const Color PLUGIN_BUTTON_PICKED_COLOR = Color(160, 200, 240);
+const uint32_t CHAIN_BUTTON_VALUE = UINT32_MAX;
+const char* CHAIN_BUTTON_ICON_PATH = "icons/filter_chain.png";
 
 /*---------------------------------------*/
 /*            SliderParameters           */
@@ -46,7 +53,7 @@ InterfaceClickable::~InterfaceClickable() = default;
 /*---------------------------------------*/
 void RootWindow::render() {
   for (auto& subwindow : subwindows) {
-    subwindow->render();
+    subwindow->render_subtree();
   }
 }
 void RootWindow::handle_event(Event* event) { SEND(this, event); };
@@ -64,17 +71,27 @@ RenderWindow::~RenderWindow() {
 
 RenderWindow::RenderWindow(Size size, Position pos) : size(size), pos(pos) {}
 
-void RenderWindow::set_pos(Position pos) { this->pos = pos; }
+void RenderWindow::set_pos(Position pos) {
+  this->pos = pos;
+  invalidate();
+}
 
 Position RenderWindow::get_position() const { return pos; }
 
-void RenderWindow::set_size(Size new_size) { this->size = new_size; }
+void RenderWindow::set_size(Size new_size) {
+  this->size = new_size;
+  invalidate();
+}
 
 Size RenderWindow::get_size() const { return size; }
 
+Region RenderWindow::get_bounds() const {
+  return Region(pos.x, pos.y, size.width, size.height);
+}
+
 void RenderWindow::render() {
   for (auto& subwindow : subwindows) {
-    subwindow->render();
+    subwindow->render_subtree();
   }
 }
 
@@ -94,7 +111,13 @@ void RectWindow::render() {
   RenderWindow::render();
 }
 
-void RectWindow::set_color(Color color) { this->color = color; }
+void RectWindow::set_color(Color color) {
+  /* buttons are reset on every mouse release, most of them are unchanged */
+  if (static_cast<int32_t>(this->color) == static_cast<int32_t>(color)) return;
+
+  this->color = color;
+  invalidate();
+}
 
 Color RectWindow::get_color() const { return color; }
 
@@ -122,7 +145,7 @@ void RectButton::on_mouse_press(MouseButtonEvent* event) {
   assert(event != nullptr);
   if (!is_point_inside(event->pos)) return;
 
-  this->color = RectWindow::get_color() - PRESS_FADE_DELTA;
+  set_color(RectWindow::get_color() - PRESS_FADE_DELTA);
 }
 
 void RectButton::on_mouse_release(MouseButtonEvent* event) {
@@ -132,7 +155,7 @@ void RectButton::on_mouse_release(MouseButtonEvent* event) {
     SEND(this, new ButtonPressEvent(value));
   }
 
-  this->color = default_color;
+  set_color(default_color);
 }
 
 void RectButton::handle_event(Event* event) {
@@ -157,13 +180,21 @@ TextWindow::TextWindow(Text text, Position pos) : text(text) { set_pos(pos); }
 
 Text TextWindow::get_text() const { return text; }
 
-void TextWindow::set_text(Text text) { this->text = text; }
+void TextWindow::set_text(Text text) {
+  this->text = text;
+  invalidate();
+}
 
 void TextWindow::render() {
   Renderer::draw_text(text, pos);
   RenderWindow::render();
 }
 
+Region TextWindow::get_bounds() const {
+  Size text_size = Renderer::get_text_size(text);
+  return Region(pos.x, pos.y, text_size.width, text_size.height);
+}
+
 /*---------------------------------------*/
 /*                Slider                 */
 /*---------------------------------------*/
@@ -200,9 +231,10 @@ void Slider::move_relative(float offset) {
   pos.*primary_axis =
       params.lower_bound + (params.upper_bound - params.lower_bound) * offset;
   pos.*primary_axis =
-      std::max(pos.*primary_axis, static_cast<int16_t>(params.lower_bound));
+      std::max(pos.*primary_axis, static_cast<int32_t>(params.lower_bound));
   pos.*primary_axis =
-      std::min(pos.*primary_axis, static_cast<int16_t>(params.upper_bound));
+      std::min(pos.*primary_axis, static_cast<int32_t>(params.upper_bound));
+  invalidate();
 }
 
 void Slider::move(int delta) {
@@ -211,6 +243,7 @@ void Slider::move(int delta) {
   new_pos = std::min(static_cast<uint16_t>(new_pos), params.upper_bound);
 
   pos.*primary_axis = new_pos;
+  invalidate();
 }
 
 float Slider::get_relative_pos() {
@@ -250,7 +283,7 @@ void Slider::on_mouse_press(MouseButtonEvent* event) {
   assert(event != nullptr);
   if (!is_point_inside(event->pos)) return;
 
-  this->color = RectWindow::get_color() - PRESS_FADE_DELTA;
+  set_color(RectWindow::get_color() - PRESS_FADE_DELTA);
   pressed = true;
   last_mouse_pos = event->pos;
 }
@@ -271,7 +304,7 @@ void Slider::on_mouse_move(MouseMoveEvent* event) {
 void Slider::on_mouse_release(MouseButtonEvent* event) {
   assert(event != nullptr);
 
-  this->color = default_color;
+  set_color(default_color);
   pressed = false;
 }
 
@@ -293,11 +326,11 @@ void Scrollbar::setup_controls(uint16_t viewport_size,
 
   /* Setting up pointers to members to unify further calculations */
 
-  int16_t Position::*primary_axis = &Position::y;
-  int16_t Position::*secondary_axis = &Position::x;
+  int32_t Position::*primary_axis = &Position::y;
+  int32_t Position::*secondary_axis = &Position::x;
 
-  int16_t Size::*primary_size = &Size::height;
-  int16_t Size::*secondary_size = &Size::width;
+  int32_t Size::*primary_size = &Size::height;
+  int32_t Size::*secondary_size = &Size::width;
 
   if (horizontal) {
     std::swap(primary_axis, secondary_axis);
@@ -327,7 +360,7 @@ void Scrollbar::setup_controls(uint16_t viewport_size,
                               scroll_block_size * size.*primary_size *
                               (1 - 2 * SCROLLBAR_BUTTON_RATIO);
   slider_size.*primary_size = std::min(
-      static_cast<int16_t>(size.*primary_size - 2 * button_size.*primary_size),
+      static_cast<int32_t>(size.*primary_size - 2 * button_size.*primary_size),
       slider_size.*primary_size);
   slider_size.*secondary_size = size.*secondary_size;
 
@@ -400,6 +433,8 @@ void ScrollableWindow::render() {
   Renderer::flush_offscreen_target();
 }
 
+Region ScrollableWindow::get_subtree_bounds() const { return get_bounds(); }
+
 void ScrollableWindow::handle_event(Event* event) {
   assert(event != nullptr);
 
@@ -408,6 +443,7 @@ void ScrollableWindow::handle_event(Event* event) {
       auto scroll_event = dynamic_cast<ScrollEvent*>(event);
       offset_y =
           -scroll_event->position * (inner_container_size.height - size.height);
+      invalidate();
       break;
     }
     case MOUSE_BUTTON: {
@@ -429,35 +465,113 @@ void ScrollableWindow::handle_event(Event* event) {
 Canvas::Canvas(Size size, Position pos, Color color)
     : RectWindow(size, pos, color), img(size, color) {}
 
+Canvas::~Canvas() { Renderer::release_image(img); }
+
 void Canvas::on_mouse_press(MouseButtonEvent* event) {
   if (!is_point_inside(event->pos)) return;
+  /* the canvas is busy until the running plugin task is committed */
+  if (PluginTask::is_running()) return;
+
   if (event->button == MouseButtonEvent::MouseButton::LEFT) {
-    InstrumentManager::start_applying(img, event->pos);
+    journal.begin(img);
+    if (!InstrumentManager::start_applying(img, event->pos)) {
+      /* nothing has changed, so this only drops the snapshot */
+      journal.commit(img);
+      return;
+    }
+
     InstrumentManager::apply(img, event->pos);
+    invalidate();
   }
 }
 
 void Canvas::on_mouse_release(MouseButtonEvent* event) {
   if (event->button == MouseButtonEvent::MouseButton::LEFT) {
+    if (InstrumentManager::is_applying()) invalidate();
     InstrumentManager::stop_applying(img, event->pos);
+
+    /* asynchronous plugin changes the image later, in on_plugin_task_end */
+    if (journal.is_recording() && !PluginTask::is_running_on(img)) {
+      journal.commit(img);
+    }
   }
 }
 
 void Canvas::on_mouse_move(MouseMoveEvent* event) {
-  if (InstrumentManager::is_applying() && is_point_inside(event->pos)) {
-    InstrumentManager::apply(img, event->pos);
+  if (!InstrumentManager::is_applying()) return;
+
+  std::vector<Position> path;
+  for (auto& point : event->path) {
+    if (is_point_inside(point)) {
+      path.push_back(point);
+    }
+  }
+
+  InstrumentManager::apply(img, path);
+  invalidate();
+}
+
+void Canvas::on_key_press(KeyPressedEvent* event) {
+  if (event->key == Escape && PluginTask::is_running_on(img)) {
+    PluginTask::cancel();
+    return;
+  }
+
+  if (!event->ctrl || InstrumentManager::is_applying()) return;
+  if (PluginTask::is_running()) return;
+
+  if (event->key == Z && !event->shift) {
+    journal.undo(img);
+    invalidate();
+  }
+
+  if (event->key == Y || (event->key == Z && event->shift)) {
+    journal.redo(img);
+    invalidate();
+  }
+}
+
+void Canvas::on_plugin_task_end(PluginTaskEvent* event) {
+  if (event->canvas != &img) return;
+
+  PluginTask::finish(img);
+  invalidate();
+
+  if (journal.is_recording()) {
+    journal.commit(img);
   }
 }
 
 void Canvas::load_from_file(const char* filename) {
+  PluginTask::cancel();
+
   img = std::move(Renderer::load_image(filename));
+  journal.clear();
+  invalidate();
 }
 
 void Canvas::save_to_file(const char* filename) {
   Renderer::save_image(img, filename);
 }
 
-void Canvas::render() { Renderer::draw_image(pos, img); }
+void Canvas::render() {
+  /* a running filter shows its reduced resolution preview first */
+  Image* preview = PluginTask::get_preview(img);
+  Renderer::draw_image(pos, preview ? *preview : img);
+
+  if (PluginTask::is_running_on(img)) {
+    Position bar_pos = Position(pos.x, pos.y + size.height - PROGRESS_HEIGHT);
+    int32_t done_width = size.width * PluginTask::get_progress();
+
+    Renderer::draw_rectangle(Size(size.width, PROGRESS_HEIGHT), bar_pos,
+                             PROGRESS_BACKGROUND_COLOR);
+    Renderer::draw_rectangle(Size(done_width, PROGRESS_HEIGHT), bar_pos,
+                             PROGRESS_COLOR);
+
+    /* the worker does not notify about progress and previews */
+    invalidate();
+  }
+}
 
 void Canvas::handle_event(Event* event) {
   assert(event != nullptr);
@@ -474,6 +588,18 @@ void Canvas::handle_event(Event* event) {
       break;
     }
 
+    case KEY_PRESSED: {
+      auto key_event = dynamic_cast<KeyPressedEvent*>(event);
+      on_key_press(key_event);
+      break;
+    }
+
+    case PLUGIN_TASK_FINISHED: {
+      auto task_event = dynamic_cast<PluginTaskEvent*>(event);
+      on_plugin_task_end(task_event);
+      break;
+    }
+
     case CANVAS_ACTION: {
       auto action_event = dynamic_cast<CanvasFileEvent*>(event);
       if (action_event->type == CanvasFileEvent::CanvasAction::SAVE) {
@@ -491,6 +617,7 @@ void Canvas::handle_event(Event* event) {
 
 Sprite::Sprite(Texture text, Position pos) : texture(text) {
   RenderWindow::pos = pos;
+  RenderWindow::size = text.size;
 }
 void Sprite::render() { Renderer::draw_sprite(texture, pos); }
 
@@ -574,6 +701,8 @@ void SVselector::redraw_canvas(float hue) {
       canvas->img.setPixel(x, y, cur_color);
     }
   }
+
+  canvas->invalidate();
 }
 
 void SVselector::handle_event(Event* event) {
@@ -654,6 +783,7 @@ void Fader::on_mouse_press(MouseButtonEvent* event) {
   if (event->button == MouseButtonEvent::MouseButton::LEFT) {
     pressed = true;
     this->pos = event->pos;
+    invalidate();
     float pos_x = static_cast<float>(pos.x - lower_bound.x) /
                   (upper_bound.x - lower_bound.x);
     float pos_y = static_cast<float>(pos.y - lower_bound.y) /
@@ -675,6 +805,7 @@ void Fader::on_mouse_move(MouseMoveEvent* event) {
   if (!pressed) return;
 
   this->pos = event->pos;
+  invalidate();
   float pos_x = static_cast<float>(pos.x - lower_bound.x) /
                 (upper_bound.x - lower_bound.x);
   float pos_y = static_cast<float>(pos.y - lower_bound.y) /
@@ -718,6 +849,7 @@ void SVFader::handle_event(Event* event) {
 
       pos.x = lower_bound.x + pos_x;
       pos.y = lower_bound.y + pos_y;
+      invalidate();
 
       SEND(this, new FaderMoveEvent(s, 1.f - v));
       break;
@@ -785,6 +917,8 @@ void Inputbox::handle_event(Event* event) {
             break;
           }
         }
+
+        invalidate();
       }
       break;
     }
@@ -796,6 +930,7 @@ void Inputbox::handle_event(Event* event) {
     case CHANGE_INPUTBOX_VALUE: {
       auto change_event = dynamic_cast<ChangeInputboxValueEvent*>(event);
       this->input_value = change_event->value;
+      invalidate();
     }
   }
 }
@@ -829,7 +964,7 @@ FileList::FileList(Size viewport_size, Size inner_container_size, Position pos,
 }
 
 void FileList::create_entry(Size size, Position pos, std::string name,
-                            const char* icon, int type) {
+                            TextureHandle icon, int type) {
   CREATE(entry_window, DirectoryEntry, size, pos, Color(255, 255, 255),
          Text("smth", 25, "fonts/Roboto-Thin.ttf", Color(0, 0, 0),
               Color(255, 255, 255)),
@@ -842,16 +977,20 @@ void FileList::create_entry(Size size, Position pos, std::string name,
 
 void FileList::build_entries_list() {
   subwindows.clear();
+  invalidate();
+
+  int32_t cur_offset = 0;
+  TextureHandle folder_icon = ResourceManager::get_icon("icons/folder.png");
+  TextureHandle file_icon = ResourceManager::get_icon("icons/file.png");
 
-  int16_t cur_offset = 0;
   create_entry(Size(size.width, 30), Position(0, cur_offset), "..",
-               "icons/folder.png", DirectoryEntry::FOLDER);
+               folder_icon, DirectoryEntry::FOLDER);
   cur_offset += 30;
 
   for (const auto& entry : std::filesystem::directory_iterator(cur_path)) {
     if (entry.is_directory()) {
       create_entry(Size(size.width, 30), Position(0, cur_offset),
-                   entry.path().filename(), "icons/folder.png",
+                   entry.path().filename(), folder_icon,
                    DirectoryEntry::FOLDER);
       cur_offset += 30;
     }
@@ -859,7 +998,7 @@ void FileList::build_entries_list() {
   for (const auto& entry : std::filesystem::directory_iterator(cur_path)) {
     if (!entry.is_directory()) {
       create_entry(Size(size.width, 30), Position(0, cur_offset),
-                   entry.path().filename(), "icons/file.png",
+                   entry.path().filename(), file_icon,
                    DirectoryEntry::REGFILE);
       cur_offset += 30;
     }
@@ -906,6 +1045,12 @@ DialogWindow::DialogWindow(Size size, Position pos, Color color,
 
 DialogWindow::~DialogWindow() { SubscriptionManager::cleanup(); }
 
+Region DialogWindow::get_bounds() const {
+  return Region(pos.x - outline_thickness, pos.y - outline_thickness,
+                size.width + 2 * outline_thickness,
+                size.height + 2 * outline_thickness);
+}
+
 void DialogWindow::render() {
   Position outline_pos =
       Position(pos.x - outline_thickness, pos.y - outline_thickness);
@@ -966,6 +1111,7 @@ void FileDialogButton::handle_event(Event* event) {
   RectButton::handle_event(event);
   if (event->get_type() == DIALOG_END) {
     subwindows.pop_back();
+    invalidate();
   }
 }
 
@@ -995,18 +1141,18 @@ void DialogEndButton::on_mouse_release(MouseButtonEvent* event) {
 /*             DirectoryEntry            */
 /*---------------------------------------*/
 DirectoryEntry::DirectoryEntry(Size size, Position pos, Color color, Text text,
-                               const std::string& name, const char* icon_path,
+                               const std::string& name, TextureHandle icon,
                                int type)
     : RectButton(size, pos, color),
       name(name),
-      icon_path(icon_path),
+      icon(icon),
       text(text),
       type(type) {}
 
 void DirectoryEntry::on_mouse_release(MouseButtonEvent* event) {
   assert(event != nullptr);
 
-  this->color = default_color;
+  set_color(default_color);
   if (!is_point_inside(event->pos)) return;
 
   if (type == FOLDER) {
@@ -1018,8 +1164,7 @@ void DirectoryEntry::on_mouse_release(MouseButtonEvent* event) {
 
 void DirectoryEntry::render() {
   RectButton::render();
-  Renderer::draw_sprite(Texture(icon_path, Size(size.height, size.height)),
-                        pos);
+  Renderer::draw_sprite(Texture(icon, Size(size.height, size.height)), pos);
   text.text = name.data();
   Renderer::draw_text(
       text, Position(pos.x + size.height + DIRECTORY_ENTRY_TEXT_OFFSET, pos.y));
@@ -1049,34 +1194,107 @@ PluginToolbar::PluginToolbar(Position pos) : pos(pos) {}
 
 void PluginToolbar::render() {
   for (auto& subwindow : subwindows) {
-    subwindow->render();
+    subwindow->render_subtree();
   }
 }
 
 void PluginToolbar::create_plugin_buttons() {
-  Position cur_pos = pos;
+  next_button_pos = pos;
+  chain_button = add_button(CHAIN_BUTTON_VALUE, CHAIN_BUTTON_ICON_PATH);
+
+  for (size_t i = 0; i < InstrumentManager::plugins_info.size(); ++i) {
+    plugin_buttons.push_back(
+        add_button(i, InstrumentManager::plugins_info[i].icon_path));
+  }
+}
+
+RectButton* PluginToolbar::add_button(uint32_t value,
+                                      const std::string& icon_path) {
+  Position button_pos = Position(next_button_pos.x + 5, next_button_pos.y + 5);
 
-  int cur_plugin = 0;
+  CREATE(outline, RectWindow, Size(60, 60), next_button_pos,
+         Color(80, 90, 91));
+  CREATE(button, RectButton, Size(50, 50), button_pos, PLUGIN_BUTTON_COLOR,
+         value);
+  CREATE(button_sprite, Sprite,
+         Texture(ResourceManager::get_icon(icon_path), Size(50, 50)),
+         button_pos);
 
-  for (auto& plugin : InstrumentManager::plugins_info) {
-    Position button_pos = Position(cur_pos.x + 5, cur_pos.y + 5);
+  SUBSCRIBE(SubscriptionManager::get_system_event_sender(), button.get());
+  SUBSCRIBE(button.get(), this);
 
-    CREATE(outline, RectWindow, Size(60, 60), cur_pos, Color(80, 90, 91));
-    CREATE(button, RectButton, Size(50, 50), button_pos, Color(236, 236, 236),
-           cur_plugin);
-    CREATE(button_sprite, Sprite,
-           Texture(plugin.icon_path.data(), Size(50, 50)), button_pos);
+  auto plugin_button = static_cast<RectButton*>(button.get());
 
-    SUBSCRIBE(SubscriptionManager::get_system_event_sender(), button.get());
-    SUBSCRIBE(button.get(), this);
+  ADOPT(button, button_sprite);
+  ADOPT(outline, button);
+  ADOPT(this, outline);
 
-    ADOPT(button, button_sprite);
-    ADOPT(outline, button);
-    ADOPT(this, outline);
+  next_button_pos.x += 70;
+  return plugin_button;
+}
 
-    cur_pos.x += 70;
-    ++cur_plugin;
+void PluginToolbar::set_button_picked(RectButton* button, bool picked) {
+  Color color = picked ? PLUGIN_BUTTON_PICKED_COLOR : PLUGIN_BUTTON_COLOR;
+
+  button->set_default_color(color);
+  button->set_color(color);
+}
+
+void PluginToolbar::toggle_chain_building() {
+  building_chain = !building_chain;
+  set_button_picked(chain_button, building_chain);
+  if (building_chain) return;
+
+  for (int stage : chain_stages) {
+    set_button_picked(plugin_buttons[stage], false);
+  }
+
+  /* a single stage is just the plugin itself */
+  std::vector<int> stages;
+  stages.swap(chain_stages);
+  if (stages.size() < 2) return;
+
+  int chain =
+      InstrumentManager::create_filter_chain(get_chain_name(stages), stages);
+  if (!InstrumentManager::save_filter_chain(chain)) {
+    printf("Failed to save filter chain %s\n",
+           InstrumentManager::plugins_info[chain].name.data());
   }
+
+  plugin_buttons.push_back(add_button(chain, CHAIN_BUTTON_ICON_PATH));
+  InstrumentManager::select_plugin(chain);
+}
+
+void PluginToolbar::pick_chain_stage(int plugin) {
+  /* chains of chains are not supported */
+  if (InstrumentManager::is_filter_chain(plugin)) return;
+
+  chain_stages.push_back(plugin);
+  set_button_picked(plugin_buttons[plugin], true);
+}
+
+std::string PluginToolbar::get_chain_name(const std::vector<int>& stages) {
+  std::string name;
+  for (int stage : stages) {
+    if (!name.empty()) name += " + ";
+    name += InstrumentManager::plugins_info[stage].name;
+  }
+
+  /* chains are saved under their names, so an existing one is not
+   * overwritten */
+  auto is_taken = [](const std::string& name) {
+    for (auto& plugin : InstrumentManager::plugins_info) {
+      if (plugin.name == name) return true;
+    }
+    return false;
+  };
+
+  std::string unique_name = name;
+  for (int copy = 2; is_taken(unique_name); ++copy) {
+    unique_name = name + " " + std::to_string(copy);
+  }
+
+  return unique_name;
 }
 
 void PluginToolbar::handle_event(Event* event) {
@@ -1086,8 +1304,14 @@ void PluginToolbar::handle_event(Event* event) {
 
   if (event->get_type() == BUTTON_PRESSED) {
     auto button_event = dynamic_cast<ButtonPressEvent*>(event);
-    InstrumentManager::enable_plugin();
-    InstrumentManager::set_instrument(button_event->value);
+
+    if (button_event->value == CHAIN_BUTTON_VALUE) {
+      toggle_chain_building();
+    } else if (building_chain) {
+      pick_chain_stage(button_event->value);
+    } else {
+      InstrumentManager::select_plugin(button_event->value);
+    }
   }
 }
 
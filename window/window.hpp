@@ -18,8 +18,10 @@
 #include "../event_queue/event_queue.hpp"
 #include "../instruments_manager/instruments_manager.hpp"
 #include "../layouts/macro.hpp"
+#include "../resource_manager/resource_manager.hpp"
 #include "../sfml_engine/sfml_engine.hpp"
 #include "../subscription_manager/subscription_manager.hpp"
+#include "../undo_journal/undo_journal.hpp"
 #include "../window_base/window_base.hpp"
 
 extern const uint8_t PRESS_FADE_DELTA;
@@ -78,8 +80,8 @@ class RootWindow : public Window {
 
 class RenderWindow : public Window {
  protected:
-  Position pos;
-  Size size;
+  Position pos = Position(0, 0);
+  Size size = Size(0, 0);
 
  public:
   RenderWindow();
@@ -94,6 +96,8 @@ class RenderWindow : public Window {
 
   virtual void set_size(Size new_size);
   Size get_size() const;
+
+  virtual Region get_bounds() const override;
 };
 
 class RectWindow : public RenderWindow {
@@ -125,6 +129,7 @@ class TextWindow : public RenderWindow {
   void set_text(Text text);
 
   virtual void render() override;
+  virtual Region get_bounds() const override;
 };
 
 class RectButton : public RectWindow, public InterfaceClickable {
@@ -153,7 +158,7 @@ class Slider : public RectWindow, public InterfaceDraggable {
   Position last_mouse_pos;
   bool pressed;
 
-  int16_t Position::*primary_axis;
+  int32_t Position::*primary_axis;
 
   void move(int delta);
   void on_button(uint32_t value);
@@ -201,16 +206,24 @@ class ScrollableWindow : public RectWindow {
                    Color bg_color);
   virtual void render() override;
   virtual void handle_event(Event* event) override;
+
+  /* subwindows are clipped by the viewport */
+  virtual Region get_subtree_bounds() const override;
 };
 
 class Canvas : public RectWindow, public InterfaceClickable {
  private:
   Image img;
+  UndoJournal journal;
+
+  void on_key_press(KeyPressedEvent* event);
+  void on_plugin_task_end(PluginTaskEvent* event);
 
  public:
   enum ACTIONS { SAVE };
 
   Canvas(Size size, Position pos, Color color);
+  virtual ~Canvas();
 
   virtual void handle_event(Event* event) override;
   void load_from_file(const char* filename);
@@ -310,7 +323,7 @@ class FileList : public ScrollableWindow {
   std::filesystem::path cur_path;
 
   void create_entry(Size size, Position pos, std::string name,
-                    const char* icon, int type);
+                    TextureHandle icon, int type);
 
  public:
   FileList(Size viewport_size, Size inner_container_size, Position pos,
@@ -330,6 +343,7 @@ class DialogWindow : public RectWindow {
   DialogWindow(Size size, Position pos, Color color, Color outline_color,
                int16_t outline_thickness, Window* creator);
   void render() override;
+  Region get_bounds() const override;
   virtual ~DialogWindow();
 };
 
@@ -361,14 +375,14 @@ class DirectoryEntry : public RectButton {
  private:
   Text text;
   std::string name;
-  const char* icon_path;
+  TextureHandle icon;
 
  public:
   enum Type { REGFILE, FOLDER };
   const int type;
 
   DirectoryEntry(Size size, Position pos, Color color, Text text,
-                 const std::string& name, const char* icon_path, int type);
+                 const std::string& name, TextureHandle icon, int type);
   virtual void on_mouse_release(MouseButtonEvent* event) override;
   virtual void render() override;
 
@@ -387,10 +401,28 @@ class FileDialogEndButton : public DialogEndButton {
   virtual void on_mouse_release(MouseButtonEvent* event) override;
 };
 
+/*!
+ * Buttons of the plugins. The first button builds filter chains: after it
+ * is pressed the plugins clicked are picked as stages, and pressing it
+ * again creates and saves the chain, which gets a button of its own.
+ * */
 class PluginToolbar : public Window {
     private:
         Position pos;
+        Position next_button_pos;
+
+        RectButton* chain_button = nullptr;
+        std::vector<RectButton*> plugin_buttons;
+        bool building_chain = false;
+        std::vector<int> chain_stages;
+
         void create_plugin_buttons();
+        RectButton* add_button(uint32_t value, const std::string& icon_path);
+        void set_button_picked(RectButton* button, bool picked);
+
+        void toggle_chain_building();
+        void pick_chain_stage(int plugin);
+        static std::string get_chain_name(const std::vector<int>& stages);
     public:
         PluginToolbar(Position pos);
 
@@ -1,20 +1,76 @@
 #include "window_base.hpp"
 
+#include "../sfml_engine/sfml_engine.hpp"
+
 /*---------------------------------------*/
 /*              Window                   */
 /*---------------------------------------*/
 
-Window::Window() = default;
+Window::Window() : parent(nullptr), dirty(true), cached(false) {}
 
 void Window::add_child_window(std::unique_ptr<Window>& child) {
+  child->parent = this;
   subwindows.push_back(std::move(child));
+  invalidate();
 }
 
-Window::~Window() {}
+Window::~Window() { Renderer::release_cache(this); }
 
 void Window::handle_event(Event* event) {}
 
 void Window::delete_child_window(
     std::list<std::unique_ptr<Window>>::iterator child) {
     subwindows.erase(child);
+    invalidate();
+}
+
+void Window::invalidate() {
+  /* ancestors of a dirty window are always dirty, so the walk stops at the
+   * first one already marked */
+  for (Window* window = this; window && !window->dirty;
+       window = window->parent) {
+    window->dirty = true;
+  }
+}
+
+bool Window::is_dirty() const { return dirty; }
+
+Region Window::get_bounds() const { return Region(); }
+
+Region Window::get_subtree_bounds() const {
+  Region bounds = get_bounds();
+  for (auto& subwindow : subwindows) {
+    bounds = bounds.united(subwindow->get_subtree_bounds());
+  }
+
+  return bounds;
+}
+
+void Window::render_subtree() {
+  /* windows invalidated while rendering stay dirty for the next frame */
+  bool was_dirty = dirty;
+  dirty = false;
+
+  if (!was_dirty && cached && Renderer::draw_cache(this)) return;
+
+  /* a subtree which has just changed is likely to change again, so it is
+   * cached only after a frame without changes, and single windows are as
+   * cheap to draw as their cache */
+  if (was_dirty || subwindows.empty()) {
+    cached = false;
+    render();
+    return;
+  }
+
+  Region bounds = get_subtree_bounds();
+  if (bounds.empty()) {
+    render();
+    return;
+  }
+
+  Renderer::begin_cache(this, bounds);
+  render();
+  Renderer::end_cache();
+
+  cached = Renderer::draw_cache(this);
 }
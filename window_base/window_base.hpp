@@ -5,9 +5,22 @@
 #include <list>
 #include <memory>
 
+#include "../data_classes/data_classes.hpp"
 #include "../event/event.hpp"
 
+/*!
+ * Node of the window tree. Windows are rendered in retained mode: a window
+ * changing its look calls invalidate(), which marks it and all of its
+ * ancestors dirty. Subtrees which stayed clean for a frame are rendered once
+ * more into a cached texture and then drawn from it until invalidated.
+ * */
 class Window {
+ protected:
+  Window* parent;
+  bool dirty;
+  /* the renderer holds the subtree as it was rendered last time */
+  bool cached;
+
  public:
   std::list<std::unique_ptr<Window>> subwindows;
 
@@ -18,6 +31,21 @@ class Window {
   void delete_child_window(std::list<std::unique_ptr<Window>>::iterator child);
   virtual void handle_event(Event* event);
   virtual void render() = 0;
+
+  /* marks the window to be rendered again in the next frame */
+  void invalidate();
+  bool is_dirty() const;
+
+  /* area the window itself draws over, empty if it draws nothing */
+  virtual Region get_bounds() const;
+  virtual Region get_subtree_bounds() const;
+
+  /*!
+   * Renders the window with its subwindows, or draws them from the cached
+   * texture if none of them changed since it was filled. Parents call it
+   * for their subwindows instead of render().
+   * */
+  void render_subtree();
 };
 
 #endif